@@ -0,0 +1,402 @@
+/**
+ Micro-benchmarks of the ray-tracer hot kernels.
+
+ Each kernel is run on inputs generated from a fixed seed, every run
+ times a fixed number of operations and the statistics over the runs
+ are written to the standard output as JSON.
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <math.h>
+#include <stdio.h>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <random>
+#include <chrono>
+#include <algorithm>
+#include "raytracer.hpp"
+
+#define BENCHMARK_SEED 1
+#define BENCHMARK_INPUTS 4096                          // number of generated inputs the kernels cycle through
+#define BENCHMARK_MESH_FILE "benchmark_mesh.obj"      // generated, removed after the benchmark
+#define BENCHMARK_SHADOW_MESH_FILE "benchmark_shadow_mesh.obj"
+
+using namespace std;
+
+typedef struct
+  {
+    string name;
+    unsigned int iterations;      // operations per run
+    double items_per_op;          // processed items per operation (e.g. triangles for load_obj)
+    vector<double> ns_per_op;     // one value per run
+  } benchmark_result;
+
+class benchmark_scene: public scene_3D   // exposes the protected kernels
+  {
+    public:
+      benchmark_scene(unsigned int width, unsigned int height): scene_3D(width,height)
+        {
+        }
+
+      using scene_3D::compute_lighting;
+  };
+
+mt19937 generator(BENCHMARK_SEED);
+volatile double sink;             // results are accumulated here so that the kernels aren't optimized out
+
+double random_range(double from, double to)
+  {
+    return uniform_real_distribution<double>(from,to)(generator);
+  }
+
+point_3D random_point(double range)
+  {
+    point_3D result;
+
+    result.x = random_range(-range,range);
+    result.y = random_range(-range,range);
+    result.z = random_range(-range,range);
+
+    return result;
+  }
+
+point_3D random_direction()
+  {
+    point_3D result;
+
+    do
+      result = random_point(1.0);
+    while (vector_length(result) < 0.01);
+
+    normalize(result);
+    return result;
+  }
+
+bool write_grid_obj(string filename, unsigned int size)
+
+  /**<
+   Writes a height field grid of size x size quads with texture
+   coordinates and normals, the heights are random.
+   */
+
+  {
+    ofstream file(filename.c_str());
+    unsigned int x, y, a, b, c, d;
+
+    if (!file.is_open())
+      return false;
+
+    for (y = 0; y <= size; y++)
+      for (x = 0; x <= size; x++)
+        {
+          file << "v " << (x / (double) size - 0.5) << " " << (y / (double) size - 0.5) << " " <<
+            random_range(-0.02,0.02) << endl;
+          file << "vt " << (x / (double) size) << " " << (y / (double) size) << endl;
+          file << "vn 0 0 1" << endl;
+        }
+
+    for (y = 0; y < size; y++)
+      for (x = 0; x < size; x++)
+        {
+          a = y * (size + 1) + x + 1;
+          b = a + 1;
+          c = b + size + 1;
+          d = a + size + 1;
+
+          file << "f " << a << "/" << a << "/" << a << " " << b << "/" << b << "/" << b << " " <<
+            c << "/" << c << "/" << c << " " << d << "/" << d << "/" << d << endl;
+        }
+
+    return true;
+  }
+
+template <class kernel_type>
+benchmark_result run_benchmark(string name, unsigned int iterations, unsigned int runs, double items_per_op, kernel_type kernel)
+
+  /**<
+   Times the kernel (called with the operation number), one warm-up run
+   isn't counted.
+   */
+
+  {
+    benchmark_result result;
+    unsigned int run, i;
+
+    result.name = name;
+    result.iterations = iterations;
+    result.items_per_op = items_per_op;
+
+    cerr << "running " << name << endl;
+
+    for (run = 0; run <= runs; run++)
+      {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+        for (i = 0; i < iterations; i++)
+          kernel(i);
+
+        chrono::steady_clock::time_point end = chrono::steady_clock::now();
+
+        if (run > 0)
+          result.ns_per_op.push_back(chrono::duration<double,nano>(end - start).count() / iterations);
+      }
+
+    return result;
+  }
+
+void print_results(vector<benchmark_result> &results, unsigned int runs)
+  {
+    unsigned int i, j;
+    double mean, variance, median;
+    vector<double> sorted;
+
+    cout << setprecision(10);
+    cout << "{" << endl;
+    cout << "  \"seed\": " << BENCHMARK_SEED << "," << endl;
+    cout << "  \"runs\": " << runs << "," << endl;
+    cout << "  \"benchmarks\": [" << endl;
+
+    for (i = 0; i < results.size(); i++)
+      {
+        sorted = results[i].ns_per_op;
+        sort(sorted.begin(),sorted.end());
+
+        mean = 0;
+
+        for (j = 0; j < sorted.size(); j++)
+          mean += sorted[j];
+
+        mean /= sorted.size();
+        variance = 0;
+
+        for (j = 0; j < sorted.size(); j++)
+          variance += (sorted[j] - mean) * (sorted[j] - mean);
+
+        variance = sorted.size() > 1 ? variance / (sorted.size() - 1) : 0;
+        median = sorted.size() % 2 == 1 ? sorted[sorted.size() / 2] :
+          (sorted[sorted.size() / 2 - 1] + sorted[sorted.size() / 2]) / 2.0;
+
+        cout << "    {" << endl;
+        cout << "      \"name\": \"" << results[i].name << "\"," << endl;
+        cout << "      \"iterations\": " << results[i].iterations << "," << endl;
+        cout << "      \"ns_per_op\": {\"mean\": " << mean << ", \"median\": " << median <<
+          ", \"min\": " << sorted[0] << ", \"max\": " << sorted[sorted.size() - 1] <<
+          ", \"variance\": " << variance << ", \"stddev\": " << sqrt(variance) << "}," << endl;
+        cout << "      \"ops_per_second\": " << 1e9 / mean << "," << endl;
+        cout << "      \"items_per_op\": " << results[i].items_per_op << "," << endl;
+        cout << "      \"items_per_second\": " << results[i].items_per_op * 1e9 / mean << endl;
+        cout << "    }" << (i + 1 < results.size() ? "," : "") << endl;
+      }
+
+    cout << "  ]" << endl;
+    cout << "}" << endl;
+  }
+
+int main(int argc, char **argv)
+  {
+    unsigned int runs, i;
+    string helper;
+    vector<benchmark_result> results;
+
+    runs = 10;
+
+    for (i = 1; i < (unsigned int) argc; i++)
+      {
+        helper = argv[i];
+
+        if (helper.compare("-h") == 0)
+          {
+            cout << "ray-tracer kernel benchmarks, usage:" << endl;
+            cout << "benchmark [-r N | -h]" << endl << endl;
+            cout << "-r N sets the number of timed runs of each kernel (default 10)." << endl;
+            cout << "-h prints help." << endl << endl;
+            cout << "The results are written to the standard output as JSON." << endl;
+            return 0;
+          }
+        else if (helper.compare("-r") == 0 && i + 1 < (unsigned int) argc)
+          {
+            i++;
+            runs = max(1,atoi(argv[i]));
+          }
+        else
+          {
+            cerr << "error: bad argument " << helper << endl;
+            return 1;
+          }
+      }
+
+    srand(BENCHMARK_SEED);      // random_double used by the tracer
+
+    // line_3D::intersects_triangle
+
+    vector<line_3D> lines;
+    vector<triangle_3D> triangles;
+    vector<point_3D> centers;
+    vector<double> radii;
+
+    for (i = 0; i < BENCHMARK_INPUTS; i++)
+      {
+        point_3D origin = random_point(1.0), target = random_point(1.0);
+
+        origin.y -= 5;
+        lines.push_back(line_3D(origin,target));
+
+        triangle_3D triangle;
+        point_3D center = random_point(1.0);
+
+        triangle.a = random_point(0.5);
+        triangle.b = random_point(0.5);
+        triangle.c = random_point(0.5);
+        substract_vectors(triangle.a,center,triangle.a);
+        substract_vectors(triangle.b,center,triangle.b);
+        substract_vectors(triangle.c,center,triangle.c);
+        triangles.push_back(triangle);
+
+        centers.push_back(random_point(1.0));
+        radii.push_back(random_range(0.05,0.5));
+      }
+
+    results.push_back(run_benchmark("line_3D::intersects_triangle",4000000,runs,1,[&](unsigned int n)
+      {
+        double a, b, c, t;
+        unsigned int index = n % BENCHMARK_INPUTS;
+
+        if (lines[index].intersects_triangle(triangles[(index * 7) % BENCHMARK_INPUTS],a,b,c,t))
+          sink = sink + t;
+      }));
+
+    // line_3D::intersects_sphere
+
+    results.push_back(run_benchmark("line_3D::intersects_sphere",4000000,runs,1,[&](unsigned int n)
+      {
+        unsigned int index = n % BENCHMARK_INPUTS;
+
+        if (lines[index].intersects_sphere(centers[(index * 7) % BENCHMARK_INPUTS],radii[index]))
+          sink = sink + 1;
+      }));
+
+    // make_refraction_vector
+
+    vector<point_3D> normals, directions;
+    vector<double> indices;
+
+    for (i = 0; i < BENCHMARK_INPUTS; i++)
+      {
+        normals.push_back(random_direction());
+        directions.push_back(random_direction());
+        indices.push_back(random_range(0.6,1.6));
+      }
+
+    results.push_back(run_benchmark("make_refraction_vector",4000000,runs,1,[&](unsigned int n)
+      {
+        unsigned int index = n % BENCHMARK_INPUTS;
+        point_3D refracted = make_refraction_vector(normals[index],directions[index],indices[index]);
+
+        sink = sink + refracted.x;
+      }));
+
+    // scene_3D::compute_lighting
+
+    benchmark_scene scene(320,240);
+    mesh_3D shadow_mesh;
+    light_3D light1, light2;
+    vector<point_3D> positions;
+    material surface;
+
+    if (!write_grid_obj(BENCHMARK_SHADOW_MESH_FILE,16) || !shadow_mesh.load_obj(BENCHMARK_SHADOW_MESH_FILE))
+      {
+        cerr << "error: couldn't write the benchmark mesh" << endl;
+        return 1;
+      }
+
+    remove(BENCHMARK_SHADOW_MESH_FILE);
+
+    shadow_mesh.scale(4,4,4);
+    shadow_mesh.translate(0,10,0);
+    light1.set_position(-3,8,5);
+    light1.distance_factor = 50;
+    light2.set_position(4,12,3);
+    light2.distance_factor = 50;
+
+    scene.add_mesh(&shadow_mesh);
+    scene.add_light(&light1);
+    scene.add_light(&light2);
+    scene.set_distribution_parameters(1,0,1,0,1,1,1,1,0);
+
+    surface.ambient_intensity = 0.2;
+    surface.diffuse_intensity = 0.8;
+    surface.specular_intensity = 0.5;
+    surface.specular_exponent = 20;
+    surface.reflection = 0;
+    surface.transparency = 0;
+    surface.refractive_index = 1;
+    surface.glitter = 0;
+    surface.surface_color.red = 200;
+    surface.surface_color.green = 150;
+    surface.surface_color.blue = 100;
+    surface.surface_color.alpha = 255;
+
+    for (i = 0; i < BENCHMARK_INPUTS; i++)
+      {
+        point_3D position = random_point(2.0);
+
+        position.y += 10;
+        position.z -= 2.5;        // below the grid, half of the shadow rays are blocked
+        positions.push_back(position);
+      }
+
+    results.push_back(run_benchmark("scene_3D::compute_lighting",20000,runs,1,[&](unsigned int n)
+      {
+        unsigned int index = n % BENCHMARK_INPUTS;
+        color result = scene.compute_lighting(positions[index],surface,normals[index]);
+
+        sink = sink + result.red;
+      }));
+
+    // color_buffer_get_pixel
+
+    t_color_buffer buffer;
+    vector<unsigned int> coordinates;
+
+    color_buffer_init(&buffer,1024,1024);
+
+    for (i = 0; i < 1024 * 1024; i++)
+      color_buffer_set_pixel(&buffer,i % 1024,i / 1024,generator() % 256,generator() % 256,generator() % 256);
+
+    for (i = 0; i < BENCHMARK_INPUTS; i++)
+      coordinates.push_back(generator() % (1024 * 1024));
+
+    results.push_back(run_benchmark("color_buffer_get_pixel",20000000,runs,1,[&](unsigned int n)
+      {
+        unsigned char r, g, b;
+        unsigned int coordinate = coordinates[n % BENCHMARK_INPUTS];
+
+        color_buffer_get_pixel(&buffer,coordinate % 1024,coordinate / 1024,&r,&g,&b);
+        sink = sink + r;
+      }));
+
+    color_buffer_destroy(&buffer);
+
+    // mesh_3D::load_obj
+
+    if (!write_grid_obj(BENCHMARK_MESH_FILE,128))
+      {
+        cerr << "error: couldn't write the benchmark mesh" << endl;
+        return 1;
+      }
+
+    results.push_back(run_benchmark("mesh_3D::load_obj",5,runs,128 * 128 * 2,[&](unsigned int n)
+      {
+        mesh_3D mesh;
+
+        if (mesh.load_obj(BENCHMARK_MESH_FILE))
+          sink = sink + mesh.bounding_sphere_radius;
+      }));
+
+    remove(BENCHMARK_MESH_FILE);
+
+    print_results(results,runs);
+    return 0;
+  }
@@ -11,6 +11,7 @@
 //#include "general.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <math.h>
 
 //----------------------------------------------------------------------
 
@@ -176,6 +177,44 @@ void color_buffer_copy_data(t_color_buffer *buffer,
 
 //----------------------------------------------------------------------
 
+void color_buffer_destroy_mipmaps(t_color_buffer *buffer)
+
+  {
+    unsigned int i;
+
+    if (buffer->mipmaps != NULL)
+      {
+        for (i = 0; i < buffer->mipmap_count; i++)
+          free(buffer->mipmaps[i].data);
+
+        free(buffer->mipmaps);
+      }
+
+    buffer->mipmaps = NULL;
+    buffer->mipmap_count = 0;
+  }
+
+//----------------------------------------------------------------------
+
+void color_buffer_destroy_tiled(t_color_buffer *buffer)
+
+  {
+    unsigned int i;
+
+    if (buffer->tiled != NULL)
+      {
+        for (i = 0; i < buffer->tiled->level_count; i++)
+          free(buffer->tiled->levels[i].allocation);
+
+        free(buffer->tiled->levels);
+        free(buffer->tiled);
+      }
+
+    buffer->tiled = NULL;
+  }
+
+//----------------------------------------------------------------------
+
 void color_buffer_destroy(t_color_buffer *buffer)
 
   {
@@ -183,6 +222,9 @@ void color_buffer_destroy(t_color_buffer *buffer)
       free(buffer->data);
 
     buffer->data = NULL;
+
+    color_buffer_destroy_mipmaps(buffer);
+    color_buffer_destroy_tiled(buffer);
   }
 
 //----------------------------------------------------------------------
@@ -195,6 +237,9 @@ int color_buffer_init(t_color_buffer *buffer, int width, int height)
 
     buffer->width = width;         // set the new width and height
     buffer->height = height;
+    buffer->mipmap_count = 0;
+    buffer->mipmaps = NULL;
+    buffer->tiled = NULL;
 
     length = width * height * 3 * sizeof(char);
 
@@ -226,6 +271,10 @@ int color_buffer_save_to_png(t_color_buffer *buffer, char *filename)
 int color_buffer_load_from_png(t_color_buffer *buffer, char *filename)
 
   {
+    buffer->mipmap_count = 0;
+    buffer->mipmaps = NULL;
+    buffer->tiled = NULL;
+
     if (lodepng_decode24_file(&(buffer->data),&buffer->width,
         &buffer->height,filename) == 0)
       return 1;
@@ -234,3 +283,379 @@ int color_buffer_load_from_png(t_color_buffer *buffer, char *filename)
   }
 
 //----------------------------------------------------------------------
+
+int color_buffer_load_from_png_data(t_color_buffer *buffer,
+  const unsigned char *data, unsigned int size)
+
+  {
+    buffer->mipmap_count = 0;
+    buffer->mipmaps = NULL;
+    buffer->tiled = NULL;
+
+    if (lodepng_decode24(&(buffer->data),&buffer->width,
+        &buffer->height,data,size) == 0)
+      return 1;
+    else
+      return 0;
+  }
+
+//----------------------------------------------------------------------
+
+int color_buffer_build_mipmaps(t_color_buffer *buffer)
+
+  {
+    unsigned int count, width, height, i, x, y, channel;
+    unsigned int x2, y2;
+    t_color_buffer *previous, *level;
+
+    color_buffer_destroy_mipmaps(buffer);
+
+    count = 0;
+    width = buffer->width;
+    height = buffer->height;
+
+    while (width > 1 || height > 1)
+      {
+        width = width > 1 ? width / 2 : 1;
+        height = height > 1 ? height / 2 : 1;
+        count++;
+      }
+
+    if (count == 0)
+      return 1;
+
+    buffer->mipmaps = (t_color_buffer *) malloc(count * sizeof(t_color_buffer));
+
+    if (buffer->mipmaps == NULL)
+      return 0;
+
+    previous = buffer;
+
+    for (i = 0; i < count; i++)
+      {
+        level = &(buffer->mipmaps[i]);
+        level->width = previous->width > 1 ? previous->width / 2 : 1;
+        level->height = previous->height > 1 ? previous->height / 2 : 1;
+        level->mipmap_count = 0;
+        level->mipmaps = NULL;
+        level->tiled = NULL;
+        level->data = (unsigned char *) malloc(level->width * level->height * 3);
+
+        if (level->data == NULL)
+          {
+            buffer->mipmap_count = i;
+            color_buffer_destroy_mipmaps(buffer);
+            return 0;
+          }
+
+        for (y = 0; y < level->height; y++)
+          for (x = 0; x < level->width; x++)
+            {
+              // average of 2x2 block, odd edges are clamped
+              x2 = 2 * x + 1 < previous->width ? 2 * x + 1 : 2 * x;
+              y2 = 2 * y + 1 < previous->height ? 2 * y + 1 : 2 * y;
+
+              for (channel = 0; channel < 3; channel++)
+                level->data[3 * (y * level->width + x) + channel] = (
+                  previous->data[3 * (2 * y * previous->width + 2 * x) + channel] +
+                  previous->data[3 * (2 * y * previous->width + x2) + channel] +
+                  previous->data[3 * (y2 * previous->width + 2 * x) + channel] +
+                  previous->data[3 * (y2 * previous->width + x2) + channel] + 2) / 4;
+            }
+
+        previous = level;
+      }
+
+    buffer->mipmap_count = count;
+    return 1;
+  }
+
+//----------------------------------------------------------------------
+
+static void sample_bilinear(t_color_buffer *buffer, double u, double v,
+  double result[3])
+
+  {
+    double x, y, fraction_x, fraction_y;
+    int x0, y0, x1, y1, channel;
+    unsigned char *p00, *p10, *p01, *p11;
+
+    x = u * buffer->width - 0.5;   // pixel centers are at half coordinations
+    y = v * buffer->height - 0.5;
+
+    x0 = (int) floor(x);
+    y0 = (int) floor(y);
+    fraction_x = x - x0;
+    fraction_y = y - y0;
+
+    x1 = transform_coordination(x0 + 1,buffer->width);
+    y1 = transform_coordination(y0 + 1,buffer->height);
+    x0 = transform_coordination(x0,buffer->width);
+    y0 = transform_coordination(y0,buffer->height);
+
+    p00 = buffer->data + 3 * (y0 * buffer->width + x0);
+    p10 = buffer->data + 3 * (y0 * buffer->width + x1);
+    p01 = buffer->data + 3 * (y1 * buffer->width + x0);
+    p11 = buffer->data + 3 * (y1 * buffer->width + x1);
+
+    for (channel = 0; channel < 3; channel++)
+      result[channel] =
+        (p00[channel] * (1 - fraction_x) + p10[channel] * fraction_x) * (1 - fraction_y) +
+        (p01[channel] * (1 - fraction_x) + p11[channel] * fraction_x) * fraction_y;
+  }
+
+//----------------------------------------------------------------------
+
+void color_buffer_sample_trilinear(t_color_buffer *buffer, double u,
+  double v, double level, unsigned char *red, unsigned char *green,
+  unsigned char *blue)
+
+  {
+    double color1[3], color2[3], fraction;
+    unsigned int level1;
+    t_color_buffer *buffer1, *buffer2;
+
+    if (!(level > 0))     // also catches NaN
+      level = 0;
+
+    if (level > buffer->mipmap_count)
+      level = buffer->mipmap_count;
+
+    level1 = (unsigned int) level;
+    fraction = level - level1;
+
+    buffer1 = level1 == 0 ? buffer : &(buffer->mipmaps[level1 - 1]);
+    sample_bilinear(buffer1,u,v,color1);
+
+    if (fraction > 0 && level1 < buffer->mipmap_count)
+      {
+        buffer2 = &(buffer->mipmaps[level1]);
+        sample_bilinear(buffer2,u,v,color2);
+
+        color1[0] = color1[0] * (1 - fraction) + color2[0] * fraction;
+        color1[1] = color1[1] * (1 - fraction) + color2[1] * fraction;
+        color1[2] = color1[2] * (1 - fraction) + color2[2] * fraction;
+      }
+
+    *red = round_to_char((int) (color1[0] + 0.5));
+    *green = round_to_char((int) (color1[1] + 0.5));
+    *blue = round_to_char((int) (color1[2] + 0.5));
+  }
+
+//----------------------------------------------------------------------
+
+static unsigned int tiled_index(t_tiled_level *level, unsigned int x,
+  unsigned int y)
+
+  {
+    return ((y / COLOR_BUFFER_TILE_SIZE * level->tiles_x + x / COLOR_BUFFER_TILE_SIZE) *
+      COLOR_BUFFER_TILE_SIZE + y % COLOR_BUFFER_TILE_SIZE) * COLOR_BUFFER_TILE_SIZE +
+      x % COLOR_BUFFER_TILE_SIZE;
+  }
+
+//----------------------------------------------------------------------
+
+static int tiled_level_init(t_tiled_level *level, t_color_buffer *buffer)
+
+  {
+    unsigned int x, y, tiles_y;
+    unsigned char *pixel;
+    size_t tile_bytes;
+
+    tile_bytes = COLOR_BUFFER_TILE_SIZE * COLOR_BUFFER_TILE_SIZE * sizeof(unsigned int);
+
+    level->width = buffer->width;
+    level->height = buffer->height;
+    level->tiles_x = (buffer->width + COLOR_BUFFER_TILE_SIZE - 1) / COLOR_BUFFER_TILE_SIZE;
+    tiles_y = (buffer->height + COLOR_BUFFER_TILE_SIZE - 1) / COLOR_BUFFER_TILE_SIZE;
+    level->mask_x = (buffer->width & (buffer->width - 1)) == 0 ? buffer->width - 1 : 0;
+    level->mask_y = (buffer->height & (buffer->height - 1)) == 0 ? buffer->height - 1 : 0;
+
+    level->allocation = calloc(level->tiles_x * tiles_y + 1,tile_bytes);
+
+    if (level->allocation == NULL)
+      return 0;
+
+    // align the texels to the tile size so that each tile is in one cache line
+    level->texels = (unsigned int *) (((size_t) level->allocation + tile_bytes - 1) / tile_bytes * tile_bytes);
+
+    for (y = 0; y < buffer->height; y++)
+      for (x = 0; x < buffer->width; x++)
+        {
+          pixel = buffer->data + 3 * (y * buffer->width + x);
+          level->texels[tiled_index(level,x,y)] = pixel[0] | (pixel[1] << 8) | (pixel[2] << 16);
+        }
+
+    return 1;
+  }
+
+//----------------------------------------------------------------------
+
+int color_buffer_build_tiled(t_color_buffer *buffer)
+
+  {
+    unsigned int i;
+    int own_mipmaps;
+
+    color_buffer_destroy_tiled(buffer);
+
+    own_mipmaps = buffer->mipmaps == NULL;
+
+    if (own_mipmaps && !color_buffer_build_mipmaps(buffer))
+      return 0;
+
+    buffer->tiled = (t_tiled_texture *) malloc(sizeof(t_tiled_texture));
+
+    if (buffer->tiled != NULL)
+      {
+        buffer->tiled->level_count = 0;
+        buffer->tiled->levels = (t_tiled_level *)
+          malloc((buffer->mipmap_count + 1) * sizeof(t_tiled_level));
+      }
+
+    if (buffer->tiled == NULL || buffer->tiled->levels == NULL)
+      {
+        free(buffer->tiled);
+        buffer->tiled = NULL;
+
+        if (own_mipmaps)
+          color_buffer_destroy_mipmaps(buffer);
+
+        return 0;
+      }
+
+    for (i = 0; i <= buffer->mipmap_count; i++)
+      {
+        if (!tiled_level_init(&(buffer->tiled->levels[i]),
+          i == 0 ? buffer : &(buffer->mipmaps[i - 1])))
+          {
+            color_buffer_destroy_tiled(buffer);
+
+            if (own_mipmaps)
+              color_buffer_destroy_mipmaps(buffer);
+
+            return 0;
+          }
+
+        buffer->tiled->level_count++;
+      }
+
+    if (own_mipmaps)      // the tiled copy has its own mipmaps
+      color_buffer_destroy_mipmaps(buffer);
+
+    return 1;
+  }
+
+//----------------------------------------------------------------------
+
+static unsigned int tiled_wrap(int coordination, unsigned int mask,
+  unsigned int limit)
+
+  {
+    if (mask != 0 || limit == 1)
+      return ((unsigned int) coordination) & mask;
+
+    return transform_coordination(coordination,limit);
+  }
+
+//----------------------------------------------------------------------
+
+static void sample_tiled_bilinear(t_tiled_level *level, double u, double v,
+  double result[3])
+
+  {
+    double x, y, fraction_x, fraction_y, weights[4];
+    int x0, y0;
+    unsigned int x1, y1, texels[4], i, channel;
+
+    x = u * level->width - 0.5;
+    y = v * level->height - 0.5;
+
+    x0 = (int) floor(x);
+    y0 = (int) floor(y);
+    fraction_x = x - x0;
+    fraction_y = y - y0;
+
+    x1 = tiled_wrap(x0 + 1,level->mask_x,level->width);
+    y1 = tiled_wrap(y0 + 1,level->mask_y,level->height);
+    x0 = tiled_wrap(x0,level->mask_x,level->width);
+    y0 = tiled_wrap(y0,level->mask_y,level->height);
+
+    texels[0] = level->texels[tiled_index(level,x0,y0)];
+    texels[1] = level->texels[tiled_index(level,x1,y0)];
+    texels[2] = level->texels[tiled_index(level,x0,y1)];
+    texels[3] = level->texels[tiled_index(level,x1,y1)];
+
+    weights[0] = (1 - fraction_x) * (1 - fraction_y);
+    weights[1] = fraction_x * (1 - fraction_y);
+    weights[2] = (1 - fraction_x) * fraction_y;
+    weights[3] = fraction_x * fraction_y;
+
+    for (channel = 0; channel < 3; channel++)
+      {
+        result[channel] = 0;
+
+        for (i = 0; i < 4; i++)
+          result[channel] += ((texels[i] >> (8 * channel)) & 0xff) * weights[i];
+      }
+  }
+
+//----------------------------------------------------------------------
+
+void color_buffer_sample_tiled(t_color_buffer *buffer, double u,
+  double v, double level, unsigned char *red, unsigned char *green,
+  unsigned char *blue)
+
+  {
+    double color1[3], color2[3], fraction;
+    unsigned int level1, last_level;
+
+    last_level = buffer->tiled->level_count - 1;
+
+    if (!(level > 0))     // also catches NaN
+      level = 0;
+
+    if (level > last_level)
+      level = last_level;
+
+    level1 = (unsigned int) level;
+    fraction = level - level1;
+
+    sample_tiled_bilinear(&(buffer->tiled->levels[level1]),u,v,color1);
+
+    if (fraction > 0 && level1 < last_level)
+      {
+        sample_tiled_bilinear(&(buffer->tiled->levels[level1 + 1]),u,v,color2);
+
+        color1[0] = color1[0] * (1 - fraction) + color2[0] * fraction;
+        color1[1] = color1[1] * (1 - fraction) + color2[1] * fraction;
+        color1[2] = color1[2] * (1 - fraction) + color2[2] * fraction;
+      }
+
+    *red = round_to_char((int) (color1[0] + 0.5));
+    *green = round_to_char((int) (color1[1] + 0.5));
+    *blue = round_to_char((int) (color1[2] + 0.5));
+  }
+
+//----------------------------------------------------------------------
+
+void color_buffer_get_tiled_pixel(t_color_buffer *buffer, int position_x,
+  int position_y, unsigned char *red, unsigned char *green,
+  unsigned char *blue)
+
+  {
+    t_tiled_level *level;
+    unsigned int texel;
+
+    level = &(buffer->tiled->levels[0]);
+
+    texel = level->texels[tiled_index(level,
+      tiled_wrap(position_x,level->mask_x,level->width),
+      tiled_wrap(position_y,level->mask_y,level->height))];
+
+    *red = texel & 0xff;
+    *green = (texel >> 8) & 0xff;
+    *blue = (texel >> 16) & 0xff;
+  }
+
+//----------------------------------------------------------------------
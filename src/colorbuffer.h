@@ -13,13 +13,46 @@
 
 //**********************************************************************
 
+#define COLOR_BUFFER_TILE_SIZE 4  ///< tiled texture tile width and height, 4x4 32bit texels = 64 B (cache line)
+
+                           /** one level of tiled texture, texels are
+                               stored by 4x4 tiles so that the
+                               neighbouring texels in both directions
+                               are mostly in the same cache line */
+typedef struct
+  {
+    unsigned int width;    ///< level width
+    unsigned int height;   ///< level height
+    unsigned int tiles_x;  ///< number of tiles in one row of tiles
+    unsigned int mask_x;   ///< width - 1 if width is power of two, 0 otherwise
+    unsigned int mask_y;   ///< height - 1 if height is power of two, 0 otherwise
+    unsigned int *texels;  ///< 32bit texels (0x00BBGGRR) in tile order, aligned to the tile size
+    void *allocation;      ///< allocated memory the texels are in
+  } t_tiled_level;
+
+                           /** texture stored in tiled layout for fast
+                               sampling, including mipmap levels */
+typedef struct
+  {
+    unsigned int level_count;
+    t_tiled_level *levels; ///< levels, 0 is the full resolution
+  } t_tiled_texture;
+
                            /** color buffer structure, it holds the
                                pointer to image in the memory */
-typedef struct
+typedef struct t_color_buffer_struct
   {
     unsigned int width;    ///< bitmap width
     unsigned int height;   ///< bitmap height
     unsigned char *data;   ///< raw pixel data in RGB 24bit mode
+    unsigned int mipmap_count;              ///< number of mipmap levels
+    struct t_color_buffer_struct *mipmaps;  /**< mipmap levels (each
+                                                 half the size of the
+                                                 previous one), NULL if
+                                                 not built */
+    t_tiled_texture *tiled;                 /**< tiled copy of the image
+                                                 for texture sampling,
+                                                 NULL if not built */
   } t_color_buffer;
 
 //----------------------------------------------------------------------
@@ -178,4 +211,110 @@ int color_buffer_load_from_png(t_color_buffer *buffer, char *filename);
 
 //----------------------------------------------------------------------
 
+int color_buffer_load_from_png_data(t_color_buffer *buffer,
+  const unsigned char *data, unsigned int size);
+
+  /**<
+   * Decodes png image stored in memory (e.g. embedded in another file)
+   * and stores it in given color buffer.
+   *
+   * @param buffer buffer to store the image to, it should be dealocated
+   *        before this function is called
+   * @param data png file data
+   * @param size size of the data in bytes
+   *
+   * @return 1 if evreything was ok, or 0 if the data could not be
+   *         decoded
+   */
+
+//----------------------------------------------------------------------
+
+int color_buffer_build_mipmaps(t_color_buffer *buffer);
+
+  /**<
+   * Builds the mipmap pyramid of the buffer down to 1x1 level (by
+   * averaging 2x2 pixel blocks), previously built mipmaps are rebuilt.
+   * The pyramid is deallocated with color_buffer_destroy.
+   *
+   * @param buffer buffer to build the mipmaps for
+   *
+   * @return 1 if everything was ok, or 0 if memory could not be
+   *         allocated
+   */
+
+//----------------------------------------------------------------------
+
+void color_buffer_destroy_mipmaps(t_color_buffer *buffer);
+
+  /**<
+   * Dealocates the mipmaps of the buffer, the buffer itself is kept.
+   *
+   * @param buffer buffer whose mipmaps should be destroyed
+   */
+
+//----------------------------------------------------------------------
+
+void color_buffer_sample_trilinear(t_color_buffer *buffer, double u,
+  double v, double level, unsigned char *red, unsigned char *green,
+  unsigned char *blue);
+
+  /**<
+   * Samples the buffer as a texture with bilinear filtering between the
+   * pixels and linear filtering between two nearest mipmap levels. The
+   * coordinations wrap around the edges. If the mipmaps have not been
+   * built, only the base level is used.
+   *
+   * @param u horizontal texture coordination, 0 and 1 are the left and
+   *        right edge
+   * @param v vertical texture coordination, 0 and 1 are the top and
+   *        bottom edge
+   * @param level mipmap level, 0 is the full resolution, each level
+   *        halves it, it can be fractional
+   * @param red variable to store the red value to
+   * @param green variable to store the green value to
+   * @param blue variable to store the blue value to
+   */
+
+//----------------------------------------------------------------------
+
+int color_buffer_build_tiled(t_color_buffer *buffer);
+
+  /**<
+   * Builds the tiled copy of the buffer including all mipmap levels,
+   * which is faster to sample than the buffer itself: the texels are
+   * 32bit aligned, neighbouring texels share cache lines and power of
+   * two sizes are wrapped by masking. The row-major mipmaps are used if
+   * they exist, otherwise they are built only temporarily. The copy is
+   * deallocated with color_buffer_destroy.
+   *
+   * @param buffer buffer to build the tiled copy for
+   *
+   * @return 1 if everything was ok, or 0 if memory could not be
+   *         allocated
+   */
+
+//----------------------------------------------------------------------
+
+void color_buffer_sample_tiled(t_color_buffer *buffer, double u,
+  double v, double level, unsigned char *red, unsigned char *green,
+  unsigned char *blue);
+
+  /**<
+   * Same as color_buffer_sample_trilinear, but samples the tiled copy,
+   * which must have been built.
+   */
+
+//----------------------------------------------------------------------
+
+void color_buffer_get_tiled_pixel(t_color_buffer *buffer, int position_x,
+  int position_y, unsigned char *red, unsigned char *green,
+  unsigned char *blue);
+
+  /**<
+   * Same as color_buffer_get_pixel, but reads the full resolution level
+   * of the tiled copy, which must have been built.
+   */
+
+//----------------------------------------------------------------------
+
 #endif
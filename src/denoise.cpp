@@ -0,0 +1,136 @@
+#include "raytracer.hpp"
+
+/*
+ Edge-avoiding a-trous wavelet denoiser: the 5x5 B3 spline kernel is
+ applied repeatedly with the taps spread by 1, 2, 4, ... pixels, each
+ tap weighted by how similar the pixel features are so that the filter
+ doesn't blur across object edges and texture detail. The lighting is
+ filtered instead of the color, i.e. the color divided by the albedo.
+ */
+
+static const double kernel[5] = {1.0 / 16.0, 1.0 / 4.0, 3.0 / 8.0, 1.0 / 4.0, 1.0 / 16.0};
+
+denoise_parameters default_denoise_parameters()
+  {
+    denoise_parameters result;
+
+    result.iterations = 5;
+    result.sigma_color = 1.0;
+    result.normal_exponent = 64;
+    result.sigma_depth = 0.02;
+    result.sigma_albedo = 0.1;
+
+    return result;
+  }
+
+bool denoise(t_color_buffer *buffer, const aux_buffers &aux, denoise_parameters parameters)
+  {
+    unsigned int i, count, iteration;
+    int x, y, dx, dy, qx, qy, step, width, height;
+    double weight, sum_weight, sum[3], difference, sigma_color, dot;
+    unsigned char r, g, b;
+
+    if (aux.width != buffer->width || aux.height != buffer->height || aux.depth.size() == 0)
+      return false;
+
+    width = buffer->width;
+    height = buffer->height;
+    count = width * height;
+
+    vector<float> lighting(3 * count), filtered(3 * count);
+
+    for (i = 0; i < count; i++)
+      {
+        color_buffer_get_pixel(buffer,i % width,i / width,&r,&g,&b);
+
+        lighting[3 * i] = r / 255.0 / (aux.albedo[3 * i] + DENOISE_ALBEDO_OFFSET);
+        lighting[3 * i + 1] = g / 255.0 / (aux.albedo[3 * i + 1] + DENOISE_ALBEDO_OFFSET);
+        lighting[3 * i + 2] = b / 255.0 / (aux.albedo[3 * i + 2] + DENOISE_ALBEDO_OFFSET);
+      }
+
+    sigma_color = parameters.sigma_color;
+
+    for (iteration = 0; iteration < parameters.iterations; iteration++)
+      {
+        step = 1 << iteration;
+
+        for (y = 0; y < height; y++)
+          for (x = 0; x < width; x++)
+            {
+              unsigned int p = y * width + x;
+
+              if (aux.depth[p] < 0)             // background, kept as it is
+                {
+                  filtered[3 * p] = lighting[3 * p];
+                  filtered[3 * p + 1] = lighting[3 * p + 1];
+                  filtered[3 * p + 2] = lighting[3 * p + 2];
+                  continue;
+                }
+
+              sum[0] = 0;
+              sum[1] = 0;
+              sum[2] = 0;
+              sum_weight = 0;
+
+              for (dy = -2; dy <= 2; dy++)
+                for (dx = -2; dx <= 2; dx++)
+                  {
+                    qx = x + dx * step;
+                    qy = y + dy * step;
+
+                    if (qx < 0 || qy < 0 || qx >= width || qy >= height)
+                      continue;
+
+                    unsigned int q = qy * width + qx;
+
+                    if (aux.depth[q] < 0)
+                      continue;
+
+                    weight = kernel[dx + 2] * kernel[dy + 2];
+
+                    difference =
+                      (lighting[3 * p] - lighting[3 * q]) * (lighting[3 * p] - lighting[3 * q]) +
+                      (lighting[3 * p + 1] - lighting[3 * q + 1]) * (lighting[3 * p + 1] - lighting[3 * q + 1]) +
+                      (lighting[3 * p + 2] - lighting[3 * q + 2]) * (lighting[3 * p + 2] - lighting[3 * q + 2]);
+                    weight *= exp(-difference / (sigma_color * sigma_color));
+
+                    dot =
+                      aux.normal[3 * p] * aux.normal[3 * q] +
+                      aux.normal[3 * p + 1] * aux.normal[3 * q + 1] +
+                      aux.normal[3 * p + 2] * aux.normal[3 * q + 2];
+                    weight *= pow(dot > 0 ? dot : 0,parameters.normal_exponent);
+
+                    difference = fabs(aux.depth[p] - aux.depth[q]) /
+                      (parameters.sigma_depth * aux.depth[p] * step * sqrt(dx * dx + dy * dy) + 0.0001);
+                    weight *= exp(-difference);
+
+                    difference =
+                      (aux.albedo[3 * p] - aux.albedo[3 * q]) * (aux.albedo[3 * p] - aux.albedo[3 * q]) +
+                      (aux.albedo[3 * p + 1] - aux.albedo[3 * q + 1]) * (aux.albedo[3 * p + 1] - aux.albedo[3 * q + 1]) +
+                      (aux.albedo[3 * p + 2] - aux.albedo[3 * q + 2]) * (aux.albedo[3 * p + 2] - aux.albedo[3 * q + 2]);
+                    weight *= exp(-difference / (parameters.sigma_albedo * parameters.sigma_albedo));
+
+                    sum[0] += weight * lighting[3 * q];
+                    sum[1] += weight * lighting[3 * q + 1];
+                    sum[2] += weight * lighting[3 * q + 2];
+                    sum_weight += weight;
+                  }
+
+              // the center tap always has full feature weight, so sum_weight > 0
+              filtered[3 * p] = sum[0] / sum_weight;
+              filtered[3 * p + 1] = sum[1] / sum_weight;
+              filtered[3 * p + 2] = sum[2] / sum_weight;
+            }
+
+        lighting.swap(filtered);
+        sigma_color /= 2.0;
+      }
+
+    for (i = 0; i < count; i++)
+      color_buffer_set_pixel(buffer,i % width,i / width,
+        saturate_int(lighting[3 * i] * (aux.albedo[3 * i] + DENOISE_ALBEDO_OFFSET) * 255 + 0.5,0,255),
+        saturate_int(lighting[3 * i + 1] * (aux.albedo[3 * i + 1] + DENOISE_ALBEDO_OFFSET) * 255 + 0.5,0,255),
+        saturate_int(lighting[3 * i + 2] * (aux.albedo[3 * i + 2] + DENOISE_ALBEDO_OFFSET) * 255 + 0.5,0,255));
+
+    return true;
+  }
@@ -13,395 +13,96 @@
 #include <string>
 #include <fstream>
 #include "raytracer.hpp"
+#include "scenes.hpp"
 
 #define RESOURCE_PATH "resources/"
 #define RESULT_PATH "results/"
+#define MODEL_PATH ""             // the model files are in the source root
+#define PREVIEW_SHADOW_MAP_RESOLUTION 512
 
 unsigned int width;
 unsigned int height;
+bool print_statistics;
+bool save_heatmap;
+bool save_trace;
+bool count_phases;
+bool save_denoised;
+bool preview_shadows;
+bool rasterize_primary;
+unsigned int light_samples;
+unsigned int adaptive_probes;
+texture_registry textures(0);  // textures shared by all the scene variants
 
 using namespace std;
 
-void print_progress(int line)
+void print_progress(render_progress progress)
   {
-    if (line % 10 == 0)
-      cout << ((int) (line / ((double) height - 1) * 100)) << " %" << endl;
-  }
+    cout << ((int) (progress.completed_units * 100.0 / progress.total_units)) << " % (" <<
+      progress.completed_units << "/" << progress.total_units << " rows, " <<
+      ((int) progress.elapsed_seconds) << " s elapsed";
 
-void render_scene_1(unsigned int n)
-  /* shadow demonstration, n goes from 0 to 4:
-     0: hard shadows
-     1: soft shadows, few rays, small range
-     2: soft shadows, many rays, small range
-     3: soft shadows, few rays, high range
-     4: soft shadows, many rays, high range
-     */
-  {
-    t_color_buffer buffer,cube_texture,floor_texture;
-    scene_3D scene(width,height);
-    mesh_3D cube, floor, cup, sphere;
-    light_3D light, light2;
-
-    color_buffer_load_from_png(&cube_texture,RESOURCE_PATH "compcube.png");
-    color_buffer_load_from_png(&floor_texture,RESOURCE_PATH "floor.png");
-
-    light.set_position(-6,-4,3);
-    light.set_intensity(0.7);
-    light.distance_factor = 100;
-
-    light2.set_position(6,3,3);
-    light2.set_intensity(0.4);
-    light2.distance_factor = 50;
-
-    color c1, c2;
-    c1.red = 255;
-    c1.green = 0;
-    c1.blue = 0;
-    c2.red = 0;
-    c2.green = 255;
-    c2.blue = 0;
-
-    texture_3D_checkers checkers(c1,c2,1,true,true,false);
-
-    sphere.load_obj(RESOURCE_PATH "sphere.obj");
-    sphere.scale(0.9,0.9,0.9);
-    sphere.translate(8.5,24,8);
-    sphere.mat.reflection = 0.5;
-    sphere.mat.specular_exponent = 50;
-    sphere.mat.specular_intensity = 1.0;
-
-    cup.load_obj(RESOURCE_PATH "cup.obj");
-    cup.rotate(- PI / 2.0,AROUND_X);
-    cup.scale(1.5,1.5,1.5);
-    cup.translate(15,14.5,5);
-    cup.use_3D_texture = true;
-    cup.set_texture_3D(&checkers);
-    cup.mat.ambient_intensity = 0.3;
-    cup.mat.diffuse_intensity = 0.8;
-    cup.mat.specular_intensity = 0.9;
-    cup.mat.specular_exponent = 1;
-
-    cube.load_obj(RESOURCE_PATH "compcube.obj");
-    cube.mat.ambient_intensity = 0.4;
-    cube.mat.diffuse_intensity = 0.6;
-    cube.mat.specular_intensity = 0.5;
-    cube.mat.specular_exponent = 30;
-    cube.scale(0.8,0.8,0.8);
-    cube.set_texture(&cube_texture);
-
-    cube.rotate(PI,AROUND_X);
-    cube.rotate(PI + PI / 2.0,AROUND_Z);
-    cube.translate(3,13,5);
-
-    floor.load_obj(RESOURCE_PATH "plane.obj");
-    floor.scale(10,10,10);
-    floor.rotate(-PI / 2.0,AROUND_X);
-    floor.translate(0,0,-5);
-    floor.translate(-1,19,2);
-    floor.set_texture(&floor_texture);
-    floor.mat.ambient_intensity = 0.2;
-
-    scene.add_mesh(&cube);
-    scene.add_mesh(&sphere);
-    scene.add_mesh(&cup);
-    scene.add_mesh(&floor);
-    scene.add_light(&light2);
-    scene.add_light(&light);
-
-    scene.camera_translate(11,3,15);
-    scene.camera_rotate(-0.1,AROUND_Z);
-    scene.camera_rotate(0.5,AROUND_X);
-    scene.set_background_color(255,200,100);
-
-    unsigned int rays;
-    double range;
-    string filename, info;
-
-    switch (n)
-      {
-        case 0: rays = 1; range = 0; filename = RESULT_PATH "scene1_0.png"; info = "hard shadows"; break;
-        case 1: rays = 3; range = 0.2; filename = RESULT_PATH "scene1_1.png"; info = "soft shadows, few lines, small range"; break;
-        case 2: rays = 15; range = 0.2; filename = RESULT_PATH "scene1_2.png"; info = "soft shadows, many lines, small range"; break;
-        case 3: rays = 3; range = 1.2; filename = RESULT_PATH "scene1_3.png"; info = "soft shadows, few lines, high range"; break;
-        default: n = 4; rays = 15; range = 1.2; filename = RESULT_PATH "scene1_4.png"; info = "soft shadows, many lines, high range"; break;
-      }
+    if (progress.rays_per_second > 0)
+      cout << ", " << ((int) (progress.rays_per_second / 1000)) << " krays/s";
 
-    scene.set_distribution_parameters(
-      rays,  // shadow rays
-      range, // shadow range
-      1,     // reflection rays
-      1,     // reflection range
-      1,     // DOF rays
-      1,     // lens width
-      1,     // focus distance
-      1,     // refraction rays
-      0      // refraction range
-      );
-
-    scene.set_focal_distance(0.4);
-    cout << "rendering scene 1, " << (n + 1) << " out of 5 (" << info << ")" << endl;
-    scene.render(&buffer,print_progress);
-    color_buffer_save_to_png(&buffer,(char *) filename.c_str());
+    if (progress.completed_units < progress.total_units)
+      cout << ", ETA " << ((int) ceil(progress.eta_seconds)) << " s";
 
-    color_buffer_destroy(&buffer);
-    color_buffer_destroy(&cube_texture);
-    color_buffer_destroy(&floor_texture);
+    cout << ")" << endl;
   }
 
-void render_scene_2(unsigned int n)
-  /* depth of field and reflection demonstration, n can be:
-     0: non-distributed raytracing
-     1: distributed reflection, small range
-     2: distributed reflection, high range
-     3: depth of field distance 1
-     4: depth of field distance 2
-     5: depth of field distance 3
-     6: depth of field distance 4
-     7: depth of field distance 2, lens wisth 1
-     8: depth of field distance 2, lens wisth 2
-   */
+void render_scene(unsigned int scene_number, unsigned int variant)
   {
-    t_color_buffer buffer,floor_texture,wall_texture,pyramid_texture;
-    scene_3D scene(width,height);
-    mesh_3D floor, cup, wall, mirror, pyramid;
-    light_3D light, light2;
-
-    color_buffer_load_from_png(&floor_texture,RESOURCE_PATH "floor.png");
-    color_buffer_load_from_png(&wall_texture,RESOURCE_PATH "wall.png");
-    color_buffer_load_from_png(&pyramid_texture,RESOURCE_PATH "pyramid.png");
-
-    light.set_position(-50,-10,5);
-    light.set_intensity(1.0);
-    light.distance_factor = 200;
-
-    light2.set_position(-50,20,3);
-    light2.set_intensity(1.0);
-    light2.distance_factor = 150;
-
-    cup.load_obj(RESOURCE_PATH "cup.obj");
-    cup.rotate(- PI / 2.0,AROUND_X);
-    cup.rotate(-0.6,AROUND_Y);
-    cup.rotate(-0.3,AROUND_Z);
-    cup.scale(1.5,1.5,1.5);
-    cup.translate(20,14.5,5);
-    cup.mat.surface_color.red = 100;
-    cup.mat.surface_color.green = 100;
-    cup.mat.surface_color.blue = 0;
-    cup.mat.diffuse_intensity = 0.8;
-    cup.mat.specular_intensity = 0.7;
-    cup.mat.specular_exponent = 5;
-
-    pyramid.load_obj(RESOURCE_PATH "pyramid.obj");
-    pyramid.rotate(0.4,AROUND_Z);
-    pyramid.translate(5,30,0);
-    pyramid.set_texture(&pyramid_texture);
-    pyramid.mat.diffuse_intensity = 0.9;
-
-    floor.load_obj(RESOURCE_PATH "plane.obj");
-    floor.scale(10,10,10);
-    floor.rotate(-PI / 2.0,AROUND_X);
-    floor.translate(0,0,-5);
-    floor.translate(-1,19,2);
-    floor.set_texture(&floor_texture);
-    floor.mat.ambient_intensity = 0.2;
-
-    wall.load_obj(RESOURCE_PATH "plane.obj");
-    wall.scale(10,10,10);
-    wall.translate(0,20,-5);
-    wall.translate(-1,19,2);
-    wall.set_texture(&wall_texture);
-    wall.mat.ambient_intensity = 0.2;
-
-    mirror.load_obj(RESOURCE_PATH "plane.obj");
-    mirror.scale(2,2,1);
-    mirror.mat.reflection = 0.7;
-    mirror.rotate(-PI / 2.0,AROUND_Z);
-    mirror.translate(-10,19,5);
-    mirror.mat.ambient_intensity = 0.2;
-
-    scene.add_mesh(&cup);
-    scene.add_mesh(&floor);
-    scene.add_mesh(&wall);
-    scene.add_mesh(&mirror);
-    scene.add_mesh(&pyramid);
-    scene.add_light(&light2);
-    scene.add_light(&light);
-
-    scene.camera_translate(40,25,10);
-    scene.camera_rotate(-1.6,AROUND_Z);
-    scene.camera_rotate(0.2,AROUND_X);
-    scene.set_background_color(50,10,10);
-
-    scene.set_focal_distance(0.6);
-    scene.set_recursion_depth(4);
-
-    unsigned int reflection_rays, dof_rays;
-    double distance, reflection_range;
-    string filename, info;
-    double lens_width;
-
-    switch (n)
+    t_color_buffer buffer;
+    demo_scene scene(width,height);
+    string filename;
+
+    if (!scene.setup(scene_number,variant,&textures,RESOURCE_PATH,MODEL_PATH))
       {
-        case 0: reflection_rays = 1; reflection_range = 0.7; dof_rays = 1; distance = 0; lens_width = 1.0; filename = RESULT_PATH "scene2_0.png"; info = "non-distributed raytracing"; break;
-        case 1: reflection_rays = 30; reflection_range = 0.05; dof_rays = 1; distance = 0; lens_width = 1.0; filename = RESULT_PATH "scene2_1.png"; info = "distributed reflection, small range"; break;
-        case 2: reflection_rays = 30; reflection_range = 0.2; dof_rays = 1; distance = 0; lens_width = 1.0; filename = RESULT_PATH "scene2_2.png"; info = "distributed reflection, high range"; break;
-        case 3: reflection_rays = 1; reflection_range = 0; dof_rays = 30; distance = 20; lens_width = 1.5; filename = RESULT_PATH "scene2_3.png"; info = "depth of field distance 1"; break;
-        case 4: reflection_rays = 1; reflection_range = 0; dof_rays = 30; distance = 30; lens_width = 1.5; filename = RESULT_PATH "scene2_4.png"; info = "depth of field distance 2"; break;
-        case 5: reflection_rays = 1; reflection_range = 0; dof_rays = 30; distance = 40; lens_width = 1.5; filename = RESULT_PATH "scene2_5.png"; info = "depth of field distance 3"; break;
-        case 6: reflection_rays = 1; reflection_range = 0; dof_rays = 30; distance = 50; lens_width = 1.5; filename = RESULT_PATH "scene2_6.png"; info = "depth of field distance 4"; break;
-        case 7: reflection_rays = 1; reflection_range = 0; dof_rays = 30; distance = 30; lens_width = 2.3; filename = RESULT_PATH "scene2_7.png"; info = "depth of field distance 2, lens width 2"; break;
-        default: n = 8; reflection_rays = 1; reflection_range = 0; dof_rays = 30; distance = 30; lens_width = 3.0; filename = RESULT_PATH "scene2_8.png"; info = "depth of field distance 3, lens width 3"; break;
+        cerr << "error: couldn't load the resources of scene " << (scene_number + 1) << endl;
+        return;
       }
 
-    scene.set_distribution_parameters(
-      1,                 // shadow rays
-      0,                 // shadow range
-      reflection_rays,   // reflection rays
-      reflection_range,  // reflection range
-      dof_rays,          // DOF rays
-      lens_width,        // lens width
-      distance,          // focus distance
-      1,                 // refraction rays
-      0                  // refraction range
-      );
-
-    cout << "rendering scene 2, " << (n + 1) << " out of 9 (" << info << ")" << endl;
-
-    scene.render(&buffer,print_progress);
-    color_buffer_save_to_png(&buffer,(char *) filename.c_str());
-    color_buffer_destroy(&buffer);
-    color_buffer_destroy(&floor_texture);
-    color_buffer_destroy(&wall_texture);
-    color_buffer_destroy(&pyramid_texture);
-  }
+    filename = RESULT_PATH + scene.name + ".png";
 
-void render_scene_3(unsigned int n)
-  /* refraction demonstration, n can be:
-     0: perfect refraction
-     1: distributed refraction, few rays, small range
-     2: distributed refraction, many rays, small range
-     3: distributed refraction, few rays, high range
-     4: distributed refraction, many rays, high range
-     */
-  {
-    t_color_buffer buffer,floor_texture;
-    scene_3D scene(width,height);
-    mesh_3D cube, floor, cup, sphere;
-    light_3D light, light2;
-
-    color_buffer_load_from_png(&floor_texture,RESOURCE_PATH "floor.png");
-
-    light.set_position(-3,2,30);
-    light.set_intensity(0.8);
-    light.distance_factor = 100;
-
-    light2.set_position(6,3,3);
-    light2.set_intensity(0.6);
-    light2.distance_factor = 50;
-
-    color c1, c2;
-    c1.red = 255;
-    c1.green = 0;
-    c1.blue = 0;
-    c2.red = 0;
-    c2.green = 255;
-    c2.blue = 0;
-
-    texture_3D_checkers checkers(c1,c2,1,true,true,false);
-
-    sphere.load_obj(RESOURCE_PATH "sphere.obj");
-    sphere.scale(1.0,1.0,1.0);
-    sphere.translate(12,24,11);
-    sphere.mat.surface_color.red = 0;
-    sphere.mat.surface_color.green = 230;
-    sphere.mat.surface_color.blue = 255;
-    sphere.mat.transparency = 0.8;
-    sphere.mat.specular_exponent = 50;
-    sphere.mat.specular_intensity = 1.0;
-
-    cup.load_obj(RESOURCE_PATH "cup.obj");
-    cup.rotate(- PI / 2.0,AROUND_X);
-    cup.scale(5,5,5);
-    cup.translate(-1,40,15);
-    cup.mat.ambient_intensity = 0.3;
-    cup.mat.diffuse_intensity = 0.8;
-    cup.mat.specular_intensity = 0.9;
-    cup.mat.surface_color.red = 255;
-    cup.mat.surface_color.green = 0;
-    cup.mat.surface_color.blue = 0;
-    cup.mat.specular_exponent = 100;
-
-    cube.load_obj(RESOURCE_PATH "cube.obj");
-    cube.mat.ambient_intensity = 0.4;
-    cube.mat.diffuse_intensity = 0.6;
-    cube.mat.specular_intensity = 0.5;
-    cube.mat.specular_exponent = 30;
-    cube.mat.transparency = 0.9;
-    cube.mat.surface_color.red = 255;
-    cube.mat.surface_color.green = 255;
-    cube.mat.surface_color.blue = 0;
-    cube.rotate(PI,AROUND_X);
-    cube.scale(0.2,1.0,1.2);
-    cube.rotate(PI,AROUND_X);
-    cube.rotate(PI + PI / 2.0,AROUND_Z);
-    cube.translate(3,13,5);
-
-    floor.load_obj(RESOURCE_PATH "plane.obj");
-    floor.scale(10,10,10);
-    floor.rotate(-PI / 2.0,AROUND_X);
-    floor.translate(0,0,-5);
-    floor.translate(-1,19,2);
-    floor.set_texture(&floor_texture);
-    floor.mat.ambient_intensity = 0.2;
-
-    scene.add_mesh(&cube);
-    scene.add_mesh(&sphere);
-    scene.add_mesh(&cup);
-    scene.add_mesh(&floor);
-    scene.add_light(&light2);
-    scene.add_light(&light);
-
-    scene.camera_translate(11,3,15);
-    scene.camera_rotate(-0.1,AROUND_Z);
-    scene.camera_rotate(0.5,AROUND_X);
-    scene.set_background_color(255,200,100);
-
-    scene.set_focal_distance(0.4);
-    scene.set_recursion_depth(4);
-
-    unsigned int rays;
-    double range;
-    string filename, info;
-
-    switch (n)
+    cout << "rendering scene " << (scene_number + 1) << ", " << (variant + 1) << " out of " <<
+      demo_scene::get_variant_count(scene_number) << " (" << scene.info << ")" << endl;
+
+    if (save_heatmap)
+      scene.scene.set_cost_map(COST_TIME);
+
+    scene.scene.set_phase_counters(count_phases);
+    scene.scene.set_memory_report(true);
+    scene.scene.set_aux_buffers(save_denoised);
+    scene.scene.set_shadow_maps(preview_shadows ? PREVIEW_SHADOW_MAP_RESOLUTION : 0);
+    scene.scene.set_primary_rasterization(rasterize_primary);
+    scene.scene.set_light_samples(light_samples);
+    scene.scene.set_adaptive_sampling(adaptive_probes,DEFAULT_ADAPTIVE_THRESHOLD);
+
+    render_statistics statistics = scene.scene.render(&buffer,print_progress);
+
+    if (print_statistics)
       {
-        case 0: rays = 1; range = 0; filename = RESULT_PATH "scene3_0.png"; info = "perfect refraction"; break;
-        case 1: rays = 3; range = 0.02; filename = RESULT_PATH "scene3_1.png"; info = "distributed refraction, few rays, small range"; break;
-        case 2: rays = 7; range = 0.02; filename = RESULT_PATH "scene3_2.png"; info = "distributed refraction, many rays, small range"; break;
-        case 3: rays = 3; range = 0.08; filename = RESULT_PATH "scene3_3.png"; info = "distributed refraction, few rays, high range"; break;
-        default: n = 4; rays = 7; range = 0.08; filename = RESULT_PATH "scene3_4.png"; info = "distributed refraction, many rays, high range"; break;
+        print_render_statistics(statistics,cout);
+        cout << endl;
       }
 
-    scene.set_distribution_parameters(
-      1,     // shadow rays
-      0,     // shadow range
-      1,     // reflection rays
-      1,     // reflection range
-      1,     // DOF rays
-      1,     // lens width
-      1,     // focus distance
-      rays,  // refraction rays
-      range  // refraction range
-      );
+    {
+      TRACE_ZONE("encode png","output");
+      color_buffer_save_to_png(&buffer,(char *) filename.c_str());
+    }
 
-    scene.set_focal_distance(0.4);
-    cout << "rendering scene 3, " << (n + 1) << " out of 5 (" << info << ")" << endl;
+    if (save_denoised)
+      {
+        TRACE_ZONE("denoise","output");
+
+        if (denoise(&buffer,scene.scene.get_aux_buffers(),default_denoise_parameters()))
+          color_buffer_save_to_png(&buffer,(char *) (RESULT_PATH + scene.name + "_denoised.png").c_str());
+      }
 
-    scene.render(&buffer,print_progress);
-    color_buffer_save_to_png(&buffer,(char *) filename.c_str());
+    if (save_heatmap)
+      scene.scene.save_cost_heatmap(RESULT_PATH + scene.name + "_heatmap.png");
 
     color_buffer_destroy(&buffer);
-    color_buffer_destroy(&floor_texture);
   }
 
 int main(int argc, char **argv)
@@ -409,7 +110,7 @@ int main(int argc, char **argv)
     int i, scene_number;
     string helper;
 
-    if (argc > 3)
+    if (argc > 14)
       {
         cerr << "error: bad number of arguments" << endl;
         return 1;
@@ -418,6 +119,15 @@ int main(int argc, char **argv)
     width = 640;        // default values
     height = 480;
     scene_number = 0;
+    print_statistics = false;
+    save_heatmap = false;
+    save_trace = false;
+    count_phases = false;
+    save_denoised = false;
+    preview_shadows = false;
+    rasterize_primary = false;
+    light_samples = 0;
+    adaptive_probes = 0;
 
     for (i = 1; i < argc; i++)
       {
@@ -426,10 +136,25 @@ int main(int argc, char **argv)
         if (helper.compare("-h") == 0)
           {
             cout << "distributed raytracer demo, usage:" << endl;
-            cout << "demo [[-s|-l] [X] | -h] " << endl << endl;
+            cout << "demo [[-s|-l] [-j] [-p] [-m] [-t] [-d] [-f] [-r] [-k N] [-a N] [X] | -h] " << endl << endl;
             cout << "-s sets small resolution (fast). " << endl;
             cout << "-s sets large resolution (slow). " << endl;
-            cout << "X is the scene number (0, 1 or 2). " << endl;
+            cout << "X is the scene number (0, 1 or 2, 3 and 4 are the synthetic scenes, 5 the model files). " << endl;
+            cout << "-j prints the render statistics (ray counts) as JSON. " << endl;
+            cout << "-p adds the hardware counters (cycles, instructions, cache and branch misses) " << endl;
+            cout << "   of each render phase to the statistics, implies -j. " << endl;
+            cout << "-m writes a heatmap of the render time of each pixel next to the image. " << endl;
+            cout << "-t writes Chrome trace of the loading and rendering to " RESULT_PATH "trace.json. " << endl;
+            cout << "-d also writes the image denoised with the help of the first hit albedo, " << endl;
+            cout << "   normal and depth. " << endl;
+            cout << "-f fast preview, approximates the shadows with filtered shadow maps instead " << endl;
+            cout << "   of casting shadow rays. " << endl;
+            cout << "-r rasterizes the primary visibility instead of tracing the primary rays " << endl;
+            cout << "   (same image, faster). " << endl;
+            cout << "-k N samples N lights per shading point instead of evaluating all of them " << endl;
+            cout << "   (faster with many lights, e.g. the last variant of scene 3, but noisy). " << endl;
+            cout << "-a N samples adaptively, the shadow, reflection and refraction rays start with " << endl;
+            cout << "   N probe rays and the rest is only cast where they disagree. " << endl;
             cout << "-h prints help. " << endl << endl;
             return 0;
           }
@@ -443,19 +168,69 @@ int main(int argc, char **argv)
             width = 1024;
             height = 768;
           }
+        else if (helper.compare("-j") == 0)
+          {
+            print_statistics = true;
+          }
+        else if (helper.compare("-p") == 0)
+          {
+            print_statistics = true;
+            count_phases = true;
+          }
+        else if (helper.compare("-m") == 0)
+          {
+            save_heatmap = true;
+          }
+        else if (helper.compare("-t") == 0)
+          {
+            save_trace = true;
+          }
+        else if (helper.compare("-d") == 0)
+          {
+            save_denoised = true;
+          }
+        else if (helper.compare("-f") == 0)
+          {
+            preview_shadows = true;
+          }
+        else if (helper.compare("-r") == 0)
+          {
+            rasterize_primary = true;
+          }
+        else if ((helper.compare("-a") == 0 || helper.compare("-k") == 0) && i + 1 >= argc)
+          {
+            cerr << "error: " << helper << " needs a value" << endl;
+            return 1;
+          }
+        else if (helper.compare("-a") == 0)
+          {
+            i++;
+            adaptive_probes = atoi(argv[i]);
+          }
+        else if (helper.compare("-k") == 0)
+          {
+            i++;
+            light_samples = atoi(argv[i]);
+          }
+        else if (helper[0] == '-')
+          {
+            cerr << "error: bad argument " << helper << endl;
+            return 1;
+          }
         else
           {
             scene_number = atoi(helper.c_str());
           }
       }
 
-    switch (scene_number)
-      {
-        case 0: for (i = 0; i < 5; i++) render_scene_1(i); break;
-        case 1: for (i = 0; i < 9; i++) render_scene_2(i); break;
-        case 2: for (i = 0; i < 5; i++) render_scene_3(i); break;
-        default: break;
-      }
+    if (save_trace)
+      trace_start();
+
+    for (i = 0; i < (int) demo_scene::get_variant_count(scene_number); i++)
+      render_scene(scene_number,i);
+
+    if (save_trace && !trace_stop(RESULT_PATH "trace.json"))
+      cerr << "error: couldn't write the trace" << endl;
 
     return 0;
   }
@@ -0,0 +1,1699 @@
+#include "raytracer.hpp"
+#include <string.h>
+#include <unordered_map>
+#include <sstream>
+
+/*
+ Loaders of other mesh file formats than obj. The binary formats are
+ read with the assumption of a little-endian machine.
+ */
+
+#define STL_HEADER_SIZE 84
+#define STL_RECORD_SIZE 50
+#define STL_CHUNK_RECORDS 4096
+
+typedef struct         /**< key used to find vertices to weld */
+  {
+    float position[3];
+    float normal[3];   /**< zeros when welding by position only */
+  } weld_key;
+
+struct weld_key_hash
+  {
+    size_t operator()(const weld_key &key) const
+      {
+        const unsigned char *bytes = (const unsigned char *) &key;
+        size_t hash = 2166136261u;   // FNV-1a
+        unsigned int i;
+
+        for (i = 0; i < sizeof(weld_key); i++)
+          hash = (hash ^ bytes[i]) * 16777619u;
+
+        return hash;
+      }
+  };
+
+struct weld_key_equal
+  {
+    bool operator()(const weld_key &key1, const weld_key &key2) const
+      {
+        return memcmp(&key1,&key2,sizeof(weld_key)) == 0;
+      }
+  };
+
+typedef unordered_map<weld_key,unsigned int,weld_key_hash,weld_key_equal> weld_map;
+
+static weld_key make_weld_key(point_3D position, point_3D normal)
+  {
+    weld_key key;
+
+    // adding 0 turns -0.0 to 0.0 so that they have the same bits
+    key.position[0] = ((float) position.x) + 0.0f;
+    key.position[1] = ((float) position.y) + 0.0f;
+    key.position[2] = ((float) position.z) + 0.0f;
+    key.normal[0] = ((float) normal.x) + 0.0f;
+    key.normal[1] = ((float) normal.y) + 0.0f;
+    key.normal[2] = ((float) normal.z) + 0.0f;
+
+    return key;
+  }
+
+static point_3D facet_normal(point_3D a, point_3D b, point_3D c)
+
+  /**<
+    Computes the facet normal by the counter-clockwise vertex order, the
+    result is not normalized (its length is twice the facet area).
+   */
+
+  {
+    point_3D edge1, edge2, normal;
+
+    substract_vectors(a,b,edge1);
+    substract_vectors(a,c,edge2);
+    cross_product(edge1,edge2,normal);
+
+    return normal;
+  }
+
+class stl_builder      /**< builds the mesh from the stl triangles */
+  {
+    protected:
+      mesh_3D *mesh;
+      bool weld;
+      bool smooth_normals;
+      weld_map welded;
+
+      unsigned int add_vertex(point_3D position, point_3D normal)
+        {
+          vertex_3D vertex;
+          point_3D zero;
+
+          if (this->weld)
+            {
+              zero.x = 0;
+              zero.y = 0;
+              zero.z = 0;
+
+              weld_key key = make_weld_key(position,this->smooth_normals ? zero : normal);
+              weld_map::iterator item = this->welded.find(key);
+
+              if (item != this->welded.end())
+                return item->second;
+
+              this->welded[key] = this->mesh->vertices.size();
+            }
+
+          vertex.position = position;
+          vertex.normal = normal;
+          vertex.texture_coords[0] = 0;
+          vertex.texture_coords[1] = 0;
+          vertex.texture_coords[2] = 0;
+          this->mesh->vertices.push_back(vertex);
+
+          return this->mesh->vertices.size() - 1;
+        }
+
+    public:
+      stl_builder(mesh_3D *mesh, bool weld, bool smooth_normals, unsigned int expected_triangles)
+        {
+          this->mesh = mesh;
+          this->weld = weld;
+          this->smooth_normals = smooth_normals;
+
+          mesh->vertices.clear();
+          mesh->triangle_indices.clear();
+          mesh->materials.clear();
+          mesh->triangle_materials.clear();
+          mesh->material_names.clear();
+          mesh->triangle_indices.reserve(expected_triangles * 3);
+
+          if (!weld)
+            mesh->vertices.reserve(expected_triangles * 3);
+        }
+
+      void add_triangle(const float positions[3][3], const float stored_normal[3])
+        {
+          point_3D points[3], normal;
+          unsigned int i;
+
+          for (i = 0; i < 3; i++)
+            {
+              points[i].x = positions[i][0];
+              points[i].y = positions[i][1];
+              points[i].z = positions[i][2];
+            }
+
+          normal = facet_normal(points[0],points[1],points[2]);
+
+          if (vector_length(normal) == 0)   // degenerate facet, trust the file
+            {
+              normal.x = stored_normal[0];
+              normal.y = stored_normal[1];
+              normal.z = stored_normal[2];
+            }
+
+          if (vector_length(normal) != 0)
+            normalize(normal);
+
+          for (i = 0; i < 3; i++)
+            this->mesh->triangle_indices.push_back(this->add_vertex(points[i],normal));
+        }
+
+      void finish()
+        {
+          unsigned int i, j;
+          point_3D zero, normal;
+          weld_map positions;
+          vector<point_3D> sums;
+
+          if (!this->smooth_normals)
+            return;
+
+          zero.x = 0;
+          zero.y = 0;
+          zero.z = 0;
+
+          // accumulate area weighted facet normals at each distinct position:
+
+          for (i = 0; i < this->mesh->triangle_indices.size(); i += 3)
+            {
+              vertex_3D *triangle[3];
+
+              for (j = 0; j < 3; j++)
+                triangle[j] = &this->mesh->vertices[this->mesh->triangle_indices[i + j]];
+
+              normal = facet_normal(triangle[0]->position,triangle[1]->position,triangle[2]->position);
+
+              for (j = 0; j < 3; j++)
+                {
+                  weld_key key = make_weld_key(triangle[j]->position,zero);
+                  weld_map::iterator item = positions.find(key);
+                  unsigned int index;
+
+                  if (item == positions.end())
+                    {
+                      index = sums.size();
+                      positions[key] = index;
+                      sums.push_back(zero);
+                    }
+                  else
+                    index = item->second;
+
+                  sums[index].x += normal.x;
+                  sums[index].y += normal.y;
+                  sums[index].z += normal.z;
+                }
+            }
+
+          for (i = 0; i < this->mesh->vertices.size(); i++)
+            {
+              weld_map::iterator item = positions.find(make_weld_key(this->mesh->vertices[i].position,zero));
+
+              if (item == positions.end() || vector_length(sums[item->second]) == 0)
+                continue;
+
+              normal = sums[item->second];
+              normalize(normal);
+              this->mesh->vertices[i].normal = normal;
+            }
+        }
+  };
+
+static bool load_stl_binary(ifstream &file, unsigned int triangle_count, stl_builder &builder)
+  {
+    vector<char> buffer(STL_CHUNK_RECORDS * STL_RECORD_SIZE);
+    float positions[3][3], normal[3];
+    unsigned int loaded, records, i;
+    const char *record;
+
+    file.seekg(STL_HEADER_SIZE,ios::beg);
+    loaded = 0;
+
+    while (loaded < triangle_count)
+      {
+        records = triangle_count - loaded;
+
+        if (records > STL_CHUNK_RECORDS)
+          records = STL_CHUNK_RECORDS;
+
+        if (!file.read(buffer.data(),records * STL_RECORD_SIZE))
+          return false;
+
+        for (i = 0; i < records; i++)
+          {
+            // record: normal (3 floats), 3 vertices (3 floats each), attribute (uint16)
+            record = buffer.data() + i * STL_RECORD_SIZE;
+            memcpy(normal,record,sizeof(normal));
+            memcpy(positions,record + sizeof(normal),sizeof(positions));
+            builder.add_triangle(positions,normal);
+          }
+
+        loaded += records;
+      }
+
+    return true;
+  }
+
+static bool load_stl_ascii(ifstream &file, stl_builder &builder)
+  {
+    string token;
+    float positions[3][3], normal[3];
+    unsigned int vertex_number;
+
+    file.seekg(0,ios::beg);
+    vertex_number = 0;
+    normal[0] = 0;
+    normal[1] = 0;
+    normal[2] = 0;
+
+    while (file >> token)
+      {
+        if (token.compare("normal") == 0)
+          {
+            file >> normal[0] >> normal[1] >> normal[2];
+          }
+        else if (token.compare("vertex") == 0)
+          {
+            if (vertex_number >= 3 || !(file >> positions[vertex_number][0] >> positions[vertex_number][1] >> positions[vertex_number][2]))
+              return false;
+
+            vertex_number++;
+          }
+        else if (token.compare("endloop") == 0)
+          {
+            if (vertex_number == 3)
+              builder.add_triangle(positions,normal);
+
+            vertex_number = 0;
+          }
+      }
+
+    return true;
+  }
+
+bool mesh_3D::load_stl(string filename, bool weld, bool smooth_normals)
+  {
+    TRACE_ZONE("load stl","load");
+
+    ifstream file(filename.c_str(),ios::in | ios::binary);
+    char header[STL_HEADER_SIZE];
+    uint32_t triangle_count;
+    long long file_size;
+    bool binary, result;
+
+    if (!file.is_open())
+      return false;
+
+    file.seekg(0,ios::end);
+    file_size = file.tellg();
+    file.seekg(0,ios::beg);
+
+    if (file_size < 0)
+      return false;
+
+    triangle_count = 0;
+    memset(header,0,sizeof(header));
+    file.read(header,file_size < STL_HEADER_SIZE ? file_size : STL_HEADER_SIZE);
+    file.clear();
+
+    if (file_size >= STL_HEADER_SIZE)
+      memcpy(&triangle_count,header + 80,sizeof(triangle_count));
+
+    /* Binary files can also begin with "solid" (e.g. many CAD exporters
+       write it), so the size is checked first. */
+
+    if (file_size == STL_HEADER_SIZE + ((long long) triangle_count) * STL_RECORD_SIZE)
+      binary = true;
+    else if (file_size >= 5 && strncmp(header,"solid",5) == 0)
+      binary = false;
+    else if (file_size > STL_HEADER_SIZE + ((long long) triangle_count) * STL_RECORD_SIZE)
+      binary = true;   // trailing data after the records
+    else
+      return false;
+
+    this->mapping.reset();
+
+    stl_builder builder(this,weld,smooth_normals,binary ? triangle_count : 0);
+
+    result = binary ? load_stl_binary(file,triangle_count,builder) : load_stl_ascii(file,builder);
+
+    file.close();
+
+    if (!result || this->triangle_indices.size() == 0)
+      return false;
+
+    builder.finish();
+    this->update_bounding_sphere();
+    return true;
+  }
+
+typedef enum
+  {
+    PLY_INT8,
+    PLY_UINT8,
+    PLY_INT16,
+    PLY_UINT16,
+    PLY_INT32,
+    PLY_UINT32,
+    PLY_FLOAT32,
+    PLY_FLOAT64,
+    PLY_UNKNOWN
+  } ply_type;
+
+typedef struct
+  {
+    string name;
+    ply_type type;          /**< type of the value or of the list items */
+    bool is_list;
+    ply_type count_type;    /**< type of the list item count */
+  } ply_property;
+
+typedef struct
+  {
+    string name;
+    unsigned long long count;
+    vector<ply_property> properties;
+  } ply_element;
+
+static ply_type ply_type_from_name(string name)
+  {
+    if (name == "char" || name == "int8")
+      return PLY_INT8;
+    else if (name == "uchar" || name == "uint8")
+      return PLY_UINT8;
+    else if (name == "short" || name == "int16")
+      return PLY_INT16;
+    else if (name == "ushort" || name == "uint16")
+      return PLY_UINT16;
+    else if (name == "int" || name == "int32")
+      return PLY_INT32;
+    else if (name == "uint" || name == "uint32")
+      return PLY_UINT32;
+    else if (name == "float" || name == "float32")
+      return PLY_FLOAT32;
+    else if (name == "double" || name == "float64")
+      return PLY_FLOAT64;
+
+    return PLY_UNKNOWN;
+  }
+
+static unsigned int ply_type_size(ply_type type)
+  {
+    switch (type)
+      {
+        case PLY_INT8: case PLY_UINT8: return 1;
+        case PLY_INT16: case PLY_UINT16: return 2;
+        case PLY_INT32: case PLY_UINT32: case PLY_FLOAT32: return 4;
+        case PLY_FLOAT64: return 8;
+        default: return 0;
+      }
+  }
+
+static inline double ply_read_value(const char *data, ply_type type)
+  {
+    switch (type)
+      {
+        case PLY_INT8:    { int8_t v; memcpy(&v,data,1); return v; }
+        case PLY_UINT8:   { uint8_t v; memcpy(&v,data,1); return v; }
+        case PLY_INT16:   { int16_t v; memcpy(&v,data,2); return v; }
+        case PLY_UINT16:  { uint16_t v; memcpy(&v,data,2); return v; }
+        case PLY_INT32:   { int32_t v; memcpy(&v,data,4); return v; }
+        case PLY_UINT32:  { uint32_t v; memcpy(&v,data,4); return v; }
+        case PLY_FLOAT32: { float v; memcpy(&v,data,4); return v; }
+        case PLY_FLOAT64: { double v; memcpy(&v,data,8); return v; }
+        default: return 0;
+      }
+  }
+
+static bool ply_parse_header(const char *data, size_t size, vector<ply_element> &elements, size_t &header_size)
+  {
+    const char *end_header;
+    string line, token;
+    size_t position;
+
+    if (size < 4 || memcmp(data,"ply",3) != 0)
+      return false;
+
+    end_header = 0;
+
+    for (position = 0; position + 10 <= size; position++)
+      if (memcmp(data + position,"end_header",10) == 0)
+        {
+          end_header = data + position;
+          break;
+        }
+
+    if (end_header == 0)
+      return false;
+
+    header_size = end_header - data + 10;
+
+    if (header_size < size && data[header_size] == '\r')
+      header_size++;
+
+    if (header_size >= size || data[header_size] != '\n')
+      return false;
+
+    header_size++;
+
+    istringstream header(string(data,end_header - data));
+
+    while (getline(header,line))
+      {
+        istringstream words(line);
+
+        if (!(words >> token))
+          continue;
+
+        if (token == "format")
+          {
+            words >> token;
+
+            if (token != "binary_little_endian")
+              return false;
+          }
+        else if (token == "element")
+          {
+            ply_element element;
+
+            if (!(words >> element.name >> element.count))
+              return false;
+
+            elements.push_back(element);
+          }
+        else if (token == "property")
+          {
+            ply_property property;
+            string type_name;
+
+            if (elements.size() == 0 || !(words >> type_name))
+              return false;
+
+            property.is_list = type_name == "list";
+            property.count_type = PLY_UNKNOWN;
+
+            if (property.is_list)
+              {
+                if (!(words >> type_name))
+                  return false;
+
+                property.count_type = ply_type_from_name(type_name);
+
+                if (!(words >> type_name))
+                  return false;
+              }
+
+            property.type = ply_type_from_name(type_name);
+
+            if (!(words >> property.name) || property.type == PLY_UNKNOWN ||
+                (property.is_list && property.count_type == PLY_UNKNOWN))
+              return false;
+
+            elements.back().properties.push_back(property);
+          }
+      }
+
+    return true;
+  }
+
+static bool ply_skip_item(const char *&data, const char *end, const ply_element &element)
+
+  /**<
+    Moves the data pointer behind one item of given element.
+   */
+
+  {
+    unsigned int i;
+    double count;
+
+    for (i = 0; i < element.properties.size(); i++)
+      {
+        if (element.properties[i].is_list)
+          {
+            if (data + ply_type_size(element.properties[i].count_type) > end)
+              return false;
+
+            count = ply_read_value(data,element.properties[i].count_type);
+            data += ply_type_size(element.properties[i].count_type);
+          }
+        else
+          count = 1;
+
+        if (count < 0 || data + ((size_t) count) * ply_type_size(element.properties[i].type) > end)
+          return false;
+
+        data += ((size_t) count) * ply_type_size(element.properties[i].type);
+      }
+
+    return true;
+  }
+
+static void compute_vertex_normals(mesh_3D *mesh)
+
+  /**<
+    Sets the mesh vertex normals to the normalized sum of the adjacent
+    face normals (weighted by the face area).
+   */
+
+  {
+    unsigned int i;
+    point_3D normal;
+
+    for (i = 0; i < mesh->vertices.size(); i++)
+      {
+        mesh->vertices[i].normal.x = 0;
+        mesh->vertices[i].normal.y = 0;
+        mesh->vertices[i].normal.z = 0;
+      }
+
+    for (i = 0; i + 2 < mesh->triangle_indices.size(); i += 3)
+      {
+        vertex_3D *a = &mesh->vertices[mesh->triangle_indices[i]];
+        vertex_3D *b = &mesh->vertices[mesh->triangle_indices[i + 1]];
+        vertex_3D *c = &mesh->vertices[mesh->triangle_indices[i + 2]];
+
+        normal = facet_normal(a->position,b->position,c->position);
+
+        a->normal.x += normal.x; a->normal.y += normal.y; a->normal.z += normal.z;
+        b->normal.x += normal.x; b->normal.y += normal.y; b->normal.z += normal.z;
+        c->normal.x += normal.x; c->normal.y += normal.y; c->normal.z += normal.z;
+      }
+
+    for (i = 0; i < mesh->vertices.size(); i++)
+      if (vector_length(mesh->vertices[i].normal) != 0)
+        normalize(mesh->vertices[i].normal);
+  }
+
+static bool ply_load_vertices(const char *&data, const char *end, const ply_element &element, mesh_3D *mesh, bool &has_normals)
+  {
+    // position, normal and texture coordinate property indices (-1 = not present):
+    int attributes[8];
+    unsigned int offsets[8];
+    ply_type types[8];
+    unsigned int i, j, stride;
+    unsigned long long k;
+    vertex_3D vertex;
+    const char *item;
+
+    for (i = 0; i < 8; i++)
+      attributes[i] = -1;
+
+    stride = 0;
+
+    for (i = 0; i < element.properties.size(); i++)
+      {
+        const string &name = element.properties[i].name;
+        int attribute = -1;
+
+        if (element.properties[i].is_list)
+          return false;   // vertices are expected to be of fixed size
+
+        if (name == "x") attribute = 0;
+        else if (name == "y") attribute = 1;
+        else if (name == "z") attribute = 2;
+        else if (name == "nx") attribute = 3;
+        else if (name == "ny") attribute = 4;
+        else if (name == "nz") attribute = 5;
+        else if (name == "u" || name == "s" || name == "texture_u" || name == "texture_s") attribute = 6;
+        else if (name == "v" || name == "t" || name == "texture_v" || name == "texture_t") attribute = 7;
+
+        if (attribute >= 0)
+          {
+            attributes[attribute] = i;
+            offsets[attribute] = stride;
+            types[attribute] = element.properties[i].type;
+          }
+
+        stride += ply_type_size(element.properties[i].type);
+      }
+
+    if (attributes[0] < 0 || attributes[1] < 0 || attributes[2] < 0 ||
+        ((size_t) (end - data)) / stride < element.count)
+      return false;
+
+    has_normals = attributes[3] >= 0 && attributes[4] >= 0 && attributes[5] >= 0;
+
+    mesh->vertices.resize(element.count);
+
+    for (k = 0; k < element.count; k++)
+      {
+        double values[8] = {0,0,0,0,0,0,0,0};
+
+        item = data + k * stride;
+
+        for (j = 0; j < 8; j++)
+          if (attributes[j] >= 0)
+            values[j] = ply_read_value(item + offsets[j],types[j]);
+
+        vertex.position.x = values[0];
+        vertex.position.y = values[1];
+        vertex.position.z = values[2];
+        vertex.normal.x = values[3];
+        vertex.normal.y = values[4];
+        vertex.normal.z = values[5];
+        vertex.texture_coords[0] = values[6];
+        vertex.texture_coords[1] = values[7];
+        vertex.texture_coords[2] = 0;
+
+        mesh->vertices[k] = vertex;
+      }
+
+    data += element.count * stride;
+    return true;
+  }
+
+static bool ply_load_faces(const char *&data, const char *end, const ply_element &element, mesh_3D *mesh)
+  {
+    int index_property;
+    unsigned int i, j, count_size, index_size;
+    unsigned long long k;
+    unsigned int polygon[3];
+    double count;
+
+    index_property = -1;
+
+    for (i = 0; i < element.properties.size(); i++)
+      if (element.properties[i].is_list &&
+          (element.properties[i].name == "vertex_indices" || element.properties[i].name == "vertex_index"))
+        index_property = i;
+
+    if (index_property < 0)
+      return false;
+
+    count_size = ply_type_size(element.properties[index_property].count_type);
+    index_size = ply_type_size(element.properties[index_property].type);
+
+    mesh->triangle_indices.reserve(element.count * 3);
+
+    for (k = 0; k < element.count; k++)
+      {
+        for (i = 0; i < element.properties.size(); i++)
+          {
+            if ((int) i != index_property)
+              {
+                // other face properties are skipped
+                ply_element single;
+                single.properties.push_back(element.properties[i]);
+
+                if (!ply_skip_item(data,end,single))
+                  return false;
+
+                continue;
+              }
+
+            if (data + count_size > end)
+              return false;
+
+            count = ply_read_value(data,element.properties[i].count_type);
+            data += count_size;
+
+            if (count < 0 || data + ((size_t) count) * index_size > end)
+              return false;
+
+            for (j = 0; j < (unsigned int) count; j++)   // triangle fan
+              {
+                double index = ply_read_value(data + j * index_size,element.properties[i].type);
+
+                if (index < 0 || index >= mesh->vertices.size())
+                  return false;
+
+                if (j < 2)
+                  {
+                    polygon[j] = index;
+                    continue;
+                  }
+
+                polygon[2] = index;
+
+                mesh->triangle_indices.push_back(polygon[0]);
+                mesh->triangle_indices.push_back(polygon[1]);
+                mesh->triangle_indices.push_back(polygon[2]);
+
+                polygon[1] = polygon[2];
+              }
+
+            data += ((size_t) count) * index_size;
+          }
+      }
+
+    return true;
+  }
+
+bool mesh_3D::load_ply(string filename)
+  {
+    TRACE_ZONE("load ply","load");
+
+    mapped_file file;
+    vector<ply_element> elements;
+    size_t header_size;
+    const char *data, *end;
+    unsigned int i;
+    unsigned long long k;
+    bool has_normals, has_vertices;
+
+    if (!file.map(filename))
+      return false;
+
+    data = (const char *) file.get_data();
+    end = data + file.get_size();
+
+    if (!ply_parse_header(data,file.get_size(),elements,header_size))
+      return false;
+
+    data += header_size;
+
+    this->vertices.clear();
+    this->triangle_indices.clear();
+    this->materials.clear();
+    this->triangle_materials.clear();
+    this->material_names.clear();
+    this->mapping.reset();
+
+    has_normals = false;
+    has_vertices = false;
+
+    for (i = 0; i < elements.size(); i++)
+      {
+        if (elements[i].name == "vertex")
+          {
+            if (!ply_load_vertices(data,end,elements[i],this,has_normals))
+              return false;
+
+            has_vertices = true;
+          }
+        else if (elements[i].name == "face" && has_vertices)
+          {
+            if (!ply_load_faces(data,end,elements[i],this))
+              return false;
+          }
+        else
+          {
+            for (k = 0; k < elements[i].count; k++)
+              if (!ply_skip_item(data,end,elements[i]))
+                return false;
+          }
+      }
+
+    if (this->triangle_indices.size() == 0)
+      return false;
+
+    if (!has_normals)
+      compute_vertex_normals(this);
+
+    this->update_bounding_sphere();
+    return true;
+  }
+
+#define GLB_MAGIC 0x46546C67        // "glTF"
+#define GLB_CHUNK_JSON 0x4E4F534A   // "JSON"
+#define GLB_CHUNK_BIN 0x004E4942    // "BIN\0"
+#define GLTF_MAX_NODE_DEPTH 64
+#define GLTF_MAX_SIZE 9007199254740992.0   // 2^53, bigger integers can't be exact doubles
+#define GLTF_MAX_STRIDE 252
+#define JSON_MAX_DEPTH 128
+
+class json_value       /**< parsed JSON value */
+  {
+    public:
+      typedef enum
+        {
+          JSON_NULL,
+          JSON_BOOL,
+          JSON_NUMBER,
+          JSON_STRING,
+          JSON_ARRAY,
+          JSON_OBJECT
+        } json_type;
+
+      json_type type;
+      double number;               /**< value of number, or 1/0 for bool */
+      string text;
+      vector<json_value> items;    /**< array items or object member values */
+      vector<string> keys;         /**< object member names */
+
+      json_value()
+        {
+          this->type = JSON_NULL;
+          this->number = 0;
+        }
+
+      const json_value &get(const string &key) const;
+
+      /**<
+        Gets object member of given name, returns null value if this is
+        not an object or the member doesn't exist.
+       */
+
+      const json_value &at(double index) const;
+
+      /**<
+        Gets array item at given index, returns null value if this is
+        not an array or the index is out of range.
+       */
+
+      size_t size() const
+        {
+          return this->type == JSON_ARRAY ? this->items.size() : 0;
+        }
+
+      double get_number(double default_value) const
+        {
+          return (this->type == JSON_NUMBER || this->type == JSON_BOOL) ? this->number : default_value;
+        }
+
+      bool is_null() const
+        {
+          return this->type == JSON_NULL;
+        }
+  };
+
+static const json_value json_null;
+
+const json_value &json_value::get(const string &key) const
+  {
+    unsigned int i;
+
+    if (this->type == JSON_OBJECT)
+      for (i = 0; i < this->keys.size(); i++)
+        if (this->keys[i] == key)
+          return this->items[i];
+
+    return json_null;
+  }
+
+const json_value &json_value::at(double index) const
+  {
+    if (this->type != JSON_ARRAY || index < 0 || index >= this->items.size())
+      return json_null;
+
+    return this->items[(size_t) index];
+  }
+
+static void json_skip_whitespace(const char *&position, const char *end)
+  {
+    while (position < end && (*position == ' ' || *position == '\t' || *position == '\n' || *position == '\r'))
+      position++;
+  }
+
+static bool json_parse_string(const char *&position, const char *end, string &result)
+  {
+    unsigned int code, i;
+
+    result.clear();
+    position++;   // opening quote
+
+    while (position < end && *position != '"')
+      {
+        if (*position != '\\')
+          {
+            result += *position;
+            position++;
+            continue;
+          }
+
+        position++;
+
+        if (position >= end)
+          return false;
+
+        switch (*position)
+          {
+            case 'b': result += '\b'; break;
+            case 'f': result += '\f'; break;
+            case 'n': result += '\n'; break;
+            case 'r': result += '\r'; break;
+            case 't': result += '\t'; break;
+
+            case 'u':
+              if (end - position < 5)
+                return false;
+
+              code = 0;
+
+              for (i = 1; i <= 4; i++)
+                {
+                  char digit = position[i];
+                  code *= 16;
+
+                  if (digit >= '0' && digit <= '9')
+                    code += digit - '0';
+                  else if (digit >= 'a' && digit <= 'f')
+                    code += digit - 'a' + 10;
+                  else if (digit >= 'A' && digit <= 'F')
+                    code += digit - 'A' + 10;
+                  else
+                    return false;
+                }
+
+              // UTF-8 encoding (surrogate pairs are not combined, names are expected to be mostly ASCII)
+              if (code < 0x80)
+                result += (char) code;
+              else if (code < 0x800)
+                {
+                  result += (char) (0xc0 | (code >> 6));
+                  result += (char) (0x80 | (code & 0x3f));
+                }
+              else
+                {
+                  result += (char) (0xe0 | (code >> 12));
+                  result += (char) (0x80 | ((code >> 6) & 0x3f));
+                  result += (char) (0x80 | (code & 0x3f));
+                }
+
+              position += 4;
+              break;
+
+            default: result += *position; break;   // \" \\ \/
+          }
+
+        position++;
+      }
+
+    if (position >= end)
+      return false;
+
+    position++;   // closing quote
+    return true;
+  }
+
+static bool json_parse(const char *&position, const char *end, json_value &value, unsigned int depth)
+  {
+    if (depth > JSON_MAX_DEPTH)
+      return false;
+
+    json_skip_whitespace(position,end);
+
+    if (position >= end)
+      return false;
+
+    switch (*position)
+      {
+        case '{':
+          value.type = json_value::JSON_OBJECT;
+          position++;
+          json_skip_whitespace(position,end);
+
+          if (position < end && *position == '}')
+            {
+              position++;
+              return true;
+            }
+
+          while (true)
+            {
+              string key;
+
+              json_skip_whitespace(position,end);
+
+              if (position >= end || *position != '"' || !json_parse_string(position,end,key))
+                return false;
+
+              json_skip_whitespace(position,end);
+
+              if (position >= end || *position != ':')
+                return false;
+
+              position++;
+
+              value.keys.push_back(key);
+              value.items.push_back(json_value());
+
+              if (!json_parse(position,end,value.items.back(),depth + 1))
+                return false;
+
+              json_skip_whitespace(position,end);
+
+              if (position < end && *position == ',')
+                position++;
+              else if (position < end && *position == '}')
+                {
+                  position++;
+                  return true;
+                }
+              else
+                return false;
+            }
+
+        case '[':
+          value.type = json_value::JSON_ARRAY;
+          position++;
+          json_skip_whitespace(position,end);
+
+          if (position < end && *position == ']')
+            {
+              position++;
+              return true;
+            }
+
+          while (true)
+            {
+              value.items.push_back(json_value());
+
+              if (!json_parse(position,end,value.items.back(),depth + 1))
+                return false;
+
+              json_skip_whitespace(position,end);
+
+              if (position < end && *position == ',')
+                position++;
+              else if (position < end && *position == ']')
+                {
+                  position++;
+                  return true;
+                }
+              else
+                return false;
+            }
+
+        case '"':
+          value.type = json_value::JSON_STRING;
+          return json_parse_string(position,end,value.text);
+
+        case 't':
+        case 'f':
+        case 'n':
+          if (end - position >= 4 && strncmp(position,"true",4) == 0)
+            {
+              value.type = json_value::JSON_BOOL;
+              value.number = 1;
+              position += 4;
+            }
+          else if (end - position >= 5 && strncmp(position,"false",5) == 0)
+            {
+              value.type = json_value::JSON_BOOL;
+              value.number = 0;
+              position += 5;
+            }
+          else if (end - position >= 4 && strncmp(position,"null",4) == 0)
+            {
+              value.type = json_value::JSON_NULL;
+              position += 4;
+            }
+          else
+            return false;
+
+          return true;
+
+        default:
+          {
+            const char *start = position;
+            char *number_end;
+
+            while (position < end && (strchr("+-.eE",*position) != NULL || (*position >= '0' && *position <= '9')))
+              position++;
+
+            string number(start,position - start);
+
+            value.type = json_value::JSON_NUMBER;
+            value.number = strtod(number.c_str(),&number_end);
+
+            return number.size() != 0 && *number_end == 0;
+          }
+      }
+  }
+
+typedef struct         /**< view of glTF accessor data in the binary chunk */
+  {
+    const unsigned char *data;     /**< first element */
+    size_t count;
+    unsigned int stride;
+    unsigned int components;
+    unsigned int component_type;
+    bool normalized;
+  } gltf_accessor;
+
+static unsigned int gltf_component_size(unsigned int component_type)
+  {
+    switch (component_type)
+      {
+        case 5120: case 5121: return 1;   // (unsigned) byte
+        case 5122: case 5123: return 2;   // (unsigned) short
+        case 5125: case 5126: return 4;   // unsigned int, float
+        default: return 0;
+      }
+  }
+
+static bool gltf_get_size(const json_value &value, size_t default_value, size_t &result)
+
+  /**<
+    Gets a byte offset, length, stride or count, i.e. a non-negative
+    integer, or the default value if it is missing. Other numbers
+    (negative, fractional or too big to be exact) would wrap when cast
+    to size_t, false is returned for them.
+   */
+
+  {
+    double number;
+
+    if (value.is_null())
+      {
+        result = default_value;
+        return true;
+      }
+
+    number = value.get_number(-1);
+
+    if (!(number >= 0) || number != floor(number) || number >= GLTF_MAX_SIZE)
+      return false;
+
+    result = (size_t) number;
+    return true;
+  }
+
+static bool gltf_get_view(const json_value &view, size_t binary_size, size_t &offset, size_t &length)
+
+  /**<
+    Gets the range of buffer view in the binary chunk, false if it
+    isn't valid or doesn't lie in the chunk.
+   */
+
+  {
+    if (!gltf_get_size(view.get("byteOffset"),0,offset) || !gltf_get_size(view.get("byteLength"),0,length))
+      return false;
+
+    return offset <= binary_size && length <= binary_size - offset;   // no sum that could overflow
+  }
+
+static bool gltf_get_accessor(const json_value &root, const unsigned char *binary, size_t binary_size,
+  const json_value &index, unsigned int components, gltf_accessor &accessor)
+
+  /**<
+    Gets the view of accessor data of given index, checks that it has
+    the expected number of components and lies in its buffer view,
+    which lies in the binary chunk.
+   */
+
+  {
+    const json_value &accessor_json = root.get("accessors").at(index.get_number(-1));
+    string type;
+    size_t view_offset, view_length, view_stride, accessor_offset, element_size, available;
+
+    if (accessor_json.is_null() || !accessor_json.get("sparse").is_null())
+      return false;
+
+    const json_value &view = root.get("bufferViews").at(accessor_json.get("bufferView").get_number(-1));
+
+    if (view.is_null() || view.get("buffer").get_number(0) != 0 || binary == 0)
+      return false;
+
+    type = accessor_json.get("type").text;
+    accessor.components = type == "SCALAR" ? 1 : type == "VEC2" ? 2 : type == "VEC3" ? 3 : type == "VEC4" ? 4 : 0;
+    accessor.component_type = accessor_json.get("componentType").get_number(0);
+    accessor.normalized = accessor_json.get("normalized").get_number(0) != 0;
+
+    element_size = accessor.components * gltf_component_size(accessor.component_type);
+
+    if (accessor.components != components || element_size == 0 ||
+        !gltf_get_size(accessor_json.get("count"),0,accessor.count) ||
+        !gltf_get_size(accessor_json.get("byteOffset"),0,accessor_offset) ||
+        !gltf_get_size(view.get("byteStride"),element_size,view_stride) ||
+        !gltf_get_view(view,binary_size,view_offset,view_length))
+      return false;
+
+    if (view_stride < element_size || view_stride > GLTF_MAX_STRIDE || accessor_offset > view_length)
+      return false;
+
+    available = view_length - accessor_offset;
+
+    // the last element has to end in the view, (count - 1) * stride + element_size <= available:
+
+    if (accessor.count != 0 &&
+        (element_size > available || accessor.count - 1 > (available - element_size) / view_stride))
+      return false;
+
+    accessor.stride = view_stride;
+    accessor.data = binary + view_offset + accessor_offset;
+    return true;
+  }
+
+static inline double gltf_accessor_value(const gltf_accessor &accessor, size_t element, unsigned int component)
+  {
+    const unsigned char *item;
+    double result;
+
+    item = accessor.data + element * accessor.stride + component * gltf_component_size(accessor.component_type);
+
+    switch (accessor.component_type)
+      {
+        case 5120: { int8_t v; memcpy(&v,item,1); result = accessor.normalized ? (v / 127.0 < -1 ? -1 : v / 127.0) : v; break; }
+        case 5121: { uint8_t v; memcpy(&v,item,1); result = accessor.normalized ? v / 255.0 : v; break; }
+        case 5122: { int16_t v; memcpy(&v,item,2); result = accessor.normalized ? (v / 32767.0 < -1 ? -1 : v / 32767.0) : v; break; }
+        case 5123: { uint16_t v; memcpy(&v,item,2); result = accessor.normalized ? v / 65535.0 : v; break; }
+        case 5125: { uint32_t v; memcpy(&v,item,4); result = v; break; }
+        case 5126: { float v; memcpy(&v,item,4); result = v; break; }
+        default: result = 0; break;
+      }
+
+    return result;
+  }
+
+static void matrix_identity(double matrix[16])
+  {
+    unsigned int i;
+
+    for (i = 0; i < 16; i++)
+      matrix[i] = (i % 5 == 0) ? 1 : 0;
+  }
+
+static void matrix_multiply(const double matrix1[16], const double matrix2[16], double result[16])
+
+  /**<
+    Multiplies two column-major 4x4 matrices (result = matrix1 * matrix2).
+   */
+
+  {
+    unsigned int row, column, i;
+
+    for (column = 0; column < 4; column++)
+      for (row = 0; row < 4; row++)
+        {
+          result[column * 4 + row] = 0;
+
+          for (i = 0; i < 4; i++)
+            result[column * 4 + row] += matrix1[i * 4 + row] * matrix2[column * 4 + i];
+        }
+  }
+
+static void gltf_node_matrix(const json_value &node, double matrix[16])
+  {
+    const json_value &node_matrix = node.get("matrix");
+    unsigned int i, row, column;
+
+    if (node_matrix.size() == 16)
+      {
+        for (i = 0; i < 16; i++)
+          matrix[i] = node_matrix.at(i).get_number(0);
+
+        return;
+      }
+
+    const json_value &translation = node.get("translation");
+    const json_value &rotation = node.get("rotation");
+    const json_value &scale = node.get("scale");
+
+    double x = rotation.at(0).get_number(0);
+    double y = rotation.at(1).get_number(0);
+    double z = rotation.at(2).get_number(0);
+    double w = rotation.at(3).get_number(1);
+
+    double r[3][3] =
+      {
+        {1 - 2 * (y * y + z * z), 2 * (x * y - z * w), 2 * (x * z + y * w)},
+        {2 * (x * y + z * w), 1 - 2 * (x * x + z * z), 2 * (y * z - x * w)},
+        {2 * (x * z - y * w), 2 * (y * z + x * w), 1 - 2 * (x * x + y * y)}
+      };
+
+    matrix_identity(matrix);   // T * R * S
+
+    for (column = 0; column < 3; column++)
+      {
+        for (row = 0; row < 3; row++)
+          matrix[column * 4 + row] = r[row][column] * scale.at(column).get_number(1);
+
+        matrix[12 + column] = translation.at(column).get_number(0);
+      }
+  }
+
+static void gltf_normal_matrix(const double matrix[16], double normal_matrix[3][3])
+
+  /**<
+    Computes the inverse transpose of the matrix upper 3x3 part, which
+    transforms the normals.
+   */
+
+  {
+    #define A(r,c) matrix[(c) * 4 + (r)]
+    double determinant;
+    unsigned int i, j;
+
+    normal_matrix[0][0] = A(1,1) * A(2,2) - A(1,2) * A(2,1);
+    normal_matrix[0][1] = -(A(1,0) * A(2,2) - A(1,2) * A(2,0));
+    normal_matrix[0][2] = A(1,0) * A(2,1) - A(1,1) * A(2,0);
+    normal_matrix[1][0] = -(A(0,1) * A(2,2) - A(0,2) * A(2,1));
+    normal_matrix[1][1] = A(0,0) * A(2,2) - A(0,2) * A(2,0);
+    normal_matrix[1][2] = -(A(0,0) * A(2,1) - A(0,1) * A(2,0));
+    normal_matrix[2][0] = A(0,1) * A(1,2) - A(0,2) * A(1,1);
+    normal_matrix[2][1] = -(A(0,0) * A(1,2) - A(0,2) * A(1,0));
+    normal_matrix[2][2] = A(0,0) * A(1,1) - A(0,1) * A(1,0);
+
+    determinant = A(0,0) * normal_matrix[0][0] + A(0,1) * normal_matrix[0][1] + A(0,2) * normal_matrix[0][2];
+    #undef A
+
+    if (determinant == 0)
+      determinant = 1;
+
+    for (i = 0; i < 3; i++)
+      for (j = 0; j < 3; j++)
+        normal_matrix[i][j] /= determinant;
+  }
+
+class gltf_loader      /**< state of loading one glb file */
+  {
+    public:
+      gltf_model *model;
+      json_value root;
+      const unsigned char *binary;
+      size_t binary_size;
+      string directory;
+      vector<t_color_buffer *> images;   /**< decoded images by index, 0 = not decoded (yet) */
+      vector<bool> images_tried;
+
+      t_color_buffer *get_image(double index)
+        {
+          const json_value &image = this->root.get("images").at(index);
+          t_color_buffer *buffer;
+          int result;
+
+          if (image.is_null())
+            return 0;
+
+          if (this->images_tried[(size_t) index])
+            return this->images[(size_t) index];
+
+          this->images_tried[(size_t) index] = true;
+
+          buffer = new t_color_buffer;
+          buffer->data = NULL;
+          result = 0;
+
+          if (!image.get("bufferView").is_null())
+            {
+              const json_value &view = this->root.get("bufferViews").at(image.get("bufferView").get_number(-1));
+              size_t offset, length;
+
+              if (this->binary != 0 && !view.is_null() && gltf_get_view(view,this->binary_size,offset,length) &&
+                  image.get("mimeType").text == "image/png")
+                result = color_buffer_load_from_png_data(buffer,this->binary + offset,length);
+            }
+          else if (image.get("uri").type == json_value::JSON_STRING &&
+                   image.get("uri").text.compare(0,5,"data:") != 0)
+            {
+              string path = this->directory + image.get("uri").text;
+              result = color_buffer_load_from_png(buffer,(char *) path.c_str());
+            }
+
+          if (!result)
+            {
+              delete buffer;
+              return 0;
+            }
+
+          this->model->textures.push_back(buffer);
+          this->images[(size_t) index] = buffer;
+          return buffer;
+        }
+
+      void apply_material(const json_value &material_json, mesh_3D *mesh)
+        {
+          const json_value &pbr = material_json.get("pbrMetallicRoughness");
+          const json_value &base_color = pbr.get("baseColorFactor");
+          double metallic, roughness, alpha;
+
+          mesh->mat.surface_color.red = saturate_int(base_color.at(0).get_number(1) * 255,0,255);
+          mesh->mat.surface_color.green = saturate_int(base_color.at(1).get_number(1) * 255,0,255);
+          mesh->mat.surface_color.blue = saturate_int(base_color.at(2).get_number(1) * 255,0,255);
+
+          if (material_json.get("alphaMode").text == "BLEND")
+            mesh->mat.transparency = 1.0 - base_color.at(3).get_number(1);
+
+          metallic = pbr.get("metallicFactor").get_number(1);
+          roughness = pbr.get("roughnessFactor").get_number(1);
+
+          // rough approximation of the metallic-roughness model by the Phong-like material:
+          mesh->mat.reflection = metallic * (1.0 - roughness);
+          mesh->mat.specular_intensity = 1.0 - roughness;
+          alpha = roughness * roughness;
+          mesh->mat.specular_exponent = alpha < 0.045 ? 1000 : 2.0 / (alpha * alpha) - 2.0;
+
+          if (mesh->mat.specular_exponent < 1)
+            mesh->mat.specular_exponent = 1;
+
+          mesh->mat.refractive_index = material_json.get("extensions").get("KHR_materials_ior").get("ior").get_number(mesh->mat.refractive_index);
+
+          const json_value &texture = this->root.get("textures").at(pbr.get("baseColorTexture").get("index").get_number(-1));
+
+          if (!texture.is_null())
+            mesh->set_texture(this->get_image(texture.get("source").get_number(-1)));
+        }
+
+      bool load_primitive(const json_value &primitive, const double matrix[16])
+        {
+          const json_value &attributes = primitive.get("attributes");
+          gltf_accessor positions, normals, texture_coords, indices;
+          bool has_normals, has_texture_coords;
+          double normal_matrix[3][3];
+          size_t i;
+          mesh_3D *mesh;
+
+          if (primitive.get("mode").get_number(4) != 4)   // only triangle lists
+            return true;
+
+          if (!gltf_get_accessor(this->root,this->binary,this->binary_size,attributes.get("POSITION"),3,positions))
+            return false;
+
+          has_normals = gltf_get_accessor(this->root,this->binary,this->binary_size,attributes.get("NORMAL"),3,normals) &&
+            normals.count == positions.count;
+          has_texture_coords = gltf_get_accessor(this->root,this->binary,this->binary_size,attributes.get("TEXCOORD_0"),2,texture_coords) &&
+            texture_coords.count == positions.count;
+
+          gltf_normal_matrix(matrix,normal_matrix);
+
+          mesh = new mesh_3D();
+          this->model->meshes.push_back(mesh);
+          mesh->vertices.resize(positions.count);
+
+          for (i = 0; i < positions.count; i++)
+            {
+              vertex_3D &vertex = mesh->vertices[i];
+              double x = gltf_accessor_value(positions,i,0);
+              double y = gltf_accessor_value(positions,i,1);
+              double z = gltf_accessor_value(positions,i,2);
+
+              vertex.position.x = matrix[0] * x + matrix[4] * y + matrix[8] * z + matrix[12];
+              vertex.position.y = matrix[1] * x + matrix[5] * y + matrix[9] * z + matrix[13];
+              vertex.position.z = matrix[2] * x + matrix[6] * y + matrix[10] * z + matrix[14];
+
+              vertex.texture_coords[0] = has_texture_coords ? gltf_accessor_value(texture_coords,i,0) : 0;
+              vertex.texture_coords[1] = has_texture_coords ? gltf_accessor_value(texture_coords,i,1) : 0;
+              vertex.texture_coords[2] = 0;
+
+              vertex.normal.x = 0;
+              vertex.normal.y = 0;
+              vertex.normal.z = 0;
+
+              if (has_normals)
+                {
+                  x = gltf_accessor_value(normals,i,0);
+                  y = gltf_accessor_value(normals,i,1);
+                  z = gltf_accessor_value(normals,i,2);
+
+                  vertex.normal.x = normal_matrix[0][0] * x + normal_matrix[0][1] * y + normal_matrix[0][2] * z;
+                  vertex.normal.y = normal_matrix[1][0] * x + normal_matrix[1][1] * y + normal_matrix[1][2] * z;
+                  vertex.normal.z = normal_matrix[2][0] * x + normal_matrix[2][1] * y + normal_matrix[2][2] * z;
+
+                  if (vector_length(vertex.normal) != 0)
+                    normalize(vertex.normal);
+                }
+            }
+
+          if (!primitive.get("indices").is_null())
+            {
+              if (!gltf_get_accessor(this->root,this->binary,this->binary_size,primitive.get("indices"),1,indices))
+                return false;
+
+              mesh->triangle_indices.resize(indices.count - indices.count % 3);
+
+              for (i = 0; i < mesh->triangle_indices.size(); i++)
+                {
+                  double index = gltf_accessor_value(indices,i,0);
+
+                  if (index >= positions.count)
+                    return false;
+
+                  mesh->triangle_indices[i] = index;
+                }
+            }
+          else
+            {
+              mesh->triangle_indices.resize(positions.count - positions.count % 3);
+
+              for (i = 0; i < mesh->triangle_indices.size(); i++)
+                mesh->triangle_indices[i] = i;
+            }
+
+          if (!has_normals)
+            compute_vertex_normals(mesh);
+
+          this->apply_material(this->root.get("materials").at(primitive.get("material").get_number(-1)),mesh);
+
+          if (mesh->vertices.size() != 0)
+            mesh->update_bounding_sphere();
+
+          return true;
+        }
+
+      bool load_node(double index, const double parent_matrix[16], unsigned int depth)
+        {
+          const json_value &node = this->root.get("nodes").at(index);
+          double local_matrix[16], matrix[16];
+          unsigned int i;
+
+          if (node.is_null() || depth > GLTF_MAX_NODE_DEPTH)
+            return false;
+
+          gltf_node_matrix(node,local_matrix);
+          matrix_multiply(parent_matrix,local_matrix,matrix);
+
+          const json_value &primitives = this->root.get("meshes").at(node.get("mesh").get_number(-1)).get("primitives");
+
+          for (i = 0; i < primitives.size(); i++)
+            if (!this->load_primitive(primitives.at(i),matrix))
+              return false;
+
+          const json_value &children = node.get("children");
+
+          for (i = 0; i < children.size(); i++)
+            if (!this->load_node(children.at(i).get_number(-1),matrix,depth + 1))
+              return false;
+
+          return true;
+        }
+  };
+
+gltf_model::gltf_model()
+  {
+  }
+
+gltf_model::~gltf_model()
+  {
+    this->clear();
+  }
+
+void gltf_model::clear()
+  {
+    unsigned int i;
+
+    for (i = 0; i < this->meshes.size(); i++)
+      delete this->meshes[i];
+
+    for (i = 0; i < this->textures.size(); i++)
+      {
+        color_buffer_destroy(this->textures[i]);
+        delete this->textures[i];
+      }
+
+    this->meshes.clear();
+    this->textures.clear();
+  }
+
+void gltf_model::add_to_scene(scene_3D *scene)
+  {
+    unsigned int i;
+
+    for (i = 0; i < this->meshes.size(); i++)
+      scene->add_mesh(this->meshes[i]);
+  }
+
+bool gltf_model::load_glb(string filename)
+  {
+    TRACE_ZONE("load glb","load");
+
+    mapped_file file;
+    gltf_loader loader;
+    const unsigned char *data;
+    const char *json_position;
+    uint32_t header[3], chunk_length, chunk_type;
+    size_t position, separator;
+    double identity[16];
+    unsigned int i;
+
+    this->clear();
+
+    if (!file.map(filename) || file.get_size() < sizeof(header))
+      return false;
+
+    data = (const unsigned char *) file.get_data();
+    memcpy(header,data,sizeof(header));
+
+    if (header[0] != GLB_MAGIC || header[1] != 2 || header[2] > file.get_size())
+      return false;
+
+    loader.model = this;
+    loader.binary = 0;
+    loader.binary_size = 0;
+    json_position = 0;
+    position = sizeof(header);
+
+    while (position + 8 <= header[2])
+      {
+        memcpy(&chunk_length,data + position,4);
+        memcpy(&chunk_type,data + position + 4,4);
+        position += 8;
+
+        if (position + chunk_length > header[2])
+          return false;
+
+        if (chunk_type == GLB_CHUNK_JSON && json_position == 0)
+          {
+            json_position = (const char *) data + position;
+
+            if (!json_parse(json_position,json_position + chunk_length,loader.root,0))
+              return false;
+          }
+        else if (chunk_type == GLB_CHUNK_BIN && loader.binary == 0)
+          {
+            loader.binary = data + position;
+            loader.binary_size = chunk_length;
+          }
+
+        position += (chunk_length + 3) / 4 * 4;   // chunks are 4 byte aligned
+      }
+
+    if (json_position == 0)
+      return false;
+
+    separator = filename.find_last_of("/\\");
+    loader.directory = separator == string::npos ? "" : filename.substr(0,separator + 1);
+    loader.images.resize(loader.root.get("images").size(),0);
+    loader.images_tried.resize(loader.root.get("images").size(),false);
+
+    matrix_identity(identity);
+
+    const json_value &scenes = loader.root.get("scenes");
+    const json_value &nodes = loader.root.get("nodes");
+
+    if (scenes.size() != 0)
+      {
+        const json_value &scene_nodes = scenes.at(loader.root.get("scene").get_number(0)).get("nodes");
+
+        for (i = 0; i < scene_nodes.size(); i++)
+          if (!loader.load_node(scene_nodes.at(i).get_number(-1),identity,0))
+            {
+              this->clear();
+              return false;
+            }
+      }
+    else   // no scene, load all root nodes
+      {
+        vector<bool> is_child(nodes.size(),false);
+        unsigned int j;
+
+        for (i = 0; i < nodes.size(); i++)
+          for (j = 0; j < nodes.at(i).get("children").size(); j++)
+            {
+              double child = nodes.at(i).get("children").at(j).get_number(-1);
+
+              if (child >= 0 && child < nodes.size())
+                is_child[(size_t) child] = true;
+            }
+
+        for (i = 0; i < nodes.size(); i++)
+          if (!is_child[i] && !loader.load_node(i,identity,0))
+            {
+              this->clear();
+              return false;
+            }
+      }
+
+    return this->meshes.size() != 0;
+  }
@@ -0,0 +1,160 @@
+#include "raytracer.hpp"
+#include <string.h>
+
+#ifdef __linux__
+  #include <unistd.h>
+  #include <sys/ioctl.h>
+  #include <sys/syscall.h>
+  #include <linux/perf_event.h>
+#endif
+
+/*
+ Render phase counters: one perf_event_open group per thread is read at
+ every phase switch and the difference is added to the phase that was
+ current. The group leader is the software task clock so that at least
+ the time can be attributed where the hardware counters aren't
+ available (virtual machines, containers).
+ */
+
+#define PHASE_COUNTER_COUNT 5     // task clock, cycles, instructions, cache misses, branch misses
+
+thread_local bool phase_counters_active = false;
+
+typedef struct
+  {
+    int descriptors[PHASE_COUNTER_COUNT];  // -1 for counters that couldn't be opened
+    int positions[PHASE_COUNTER_COUNT];    // position of the counter in the group read, -1 if not opened
+    unsigned int opened;
+    render_phase phase;
+    unsigned long long last[PHASE_COUNTER_COUNT];
+    unsigned long long sums[PHASE_COUNT][PHASE_COUNTER_COUNT];
+  } phase_counter_state;
+
+static thread_local phase_counter_state phase_state;
+
+static bool read_phase_counters(unsigned long long values[PHASE_COUNTER_COUNT])
+  {
+#ifdef __linux__
+    unsigned long long buffer[PHASE_COUNTER_COUNT + 1];   // count followed by the values
+    unsigned int i;
+
+    if (read(phase_state.descriptors[0],buffer,sizeof(unsigned long long) * (phase_state.opened + 1)) <= 0)
+      return false;
+
+    for (i = 0; i < PHASE_COUNTER_COUNT; i++)
+      values[i] = phase_state.positions[i] < 0 ? 0 : buffer[1 + phase_state.positions[i]];
+
+    return true;
+#else
+    (void) values;
+    return false;
+#endif
+  }
+
+bool phase_counters_start()
+  {
+#ifdef __linux__
+    static const unsigned int types[PHASE_COUNTER_COUNT] =
+      {PERF_TYPE_SOFTWARE,PERF_TYPE_HARDWARE,PERF_TYPE_HARDWARE,PERF_TYPE_HARDWARE,PERF_TYPE_HARDWARE};
+    static const unsigned long long configs[PHASE_COUNTER_COUNT] =
+      {PERF_COUNT_SW_TASK_CLOCK,PERF_COUNT_HW_CPU_CYCLES,PERF_COUNT_HW_INSTRUCTIONS,
+       PERF_COUNT_HW_CACHE_MISSES,PERF_COUNT_HW_BRANCH_MISSES};
+    struct perf_event_attr attributes;
+    unsigned int i;
+
+    memset(&phase_state,0,sizeof(phase_state));
+
+    for (i = 0; i < PHASE_COUNTER_COUNT; i++)
+      {
+        phase_state.descriptors[i] = -1;
+        phase_state.positions[i] = -1;
+
+        memset(&attributes,0,sizeof(attributes));
+        attributes.size = sizeof(attributes);
+        attributes.type = types[i];
+        attributes.config = configs[i];
+        attributes.disabled = i == 0;           // the group is enabled through the leader
+        attributes.exclude_kernel = 1;          // allowed without privileges
+        attributes.exclude_hv = 1;
+        attributes.read_format = PERF_FORMAT_GROUP;
+
+        if (i != 0 && phase_state.descriptors[0] < 0)
+          break;
+
+        phase_state.descriptors[i] = syscall(SYS_perf_event_open,&attributes,0,-1,
+          i == 0 ? -1 : phase_state.descriptors[0],0);
+
+        if (phase_state.descriptors[i] >= 0)
+          {
+            phase_state.positions[i] = phase_state.opened;
+            phase_state.opened++;
+          }
+      }
+
+    if (phase_state.opened == 0)
+      return false;
+
+    ioctl(phase_state.descriptors[0],PERF_EVENT_IOC_RESET,PERF_IOC_FLAG_GROUP);
+    ioctl(phase_state.descriptors[0],PERF_EVENT_IOC_ENABLE,PERF_IOC_FLAG_GROUP);
+
+    if (!read_phase_counters(phase_state.last))
+      {
+        phase_counters_stop(NULL);
+        return false;
+      }
+
+    phase_state.phase = PHASE_OTHER;
+    phase_counters_active = true;
+    return true;
+#else
+    return false;
+#endif
+  }
+
+render_phase phase_counters_switch(render_phase phase)
+  {
+    unsigned long long values[PHASE_COUNTER_COUNT];
+    render_phase previous;
+    unsigned int i;
+
+    previous = phase_state.phase;
+
+    if (read_phase_counters(values))
+      for (i = 0; i < PHASE_COUNTER_COUNT; i++)
+        {
+          phase_state.sums[previous][i] += values[i] - phase_state.last[i];
+          phase_state.last[i] = values[i];
+        }
+
+    phase_state.phase = phase;
+    return previous;
+  }
+
+void phase_counters_stop(phase_counters result[PHASE_COUNT])
+  {
+    unsigned int i;
+
+    if (phase_counters_active)
+      phase_counters_switch(PHASE_OTHER);
+
+    phase_counters_active = false;
+
+    if (result != NULL)
+      for (i = 0; i < PHASE_COUNT; i++)
+        {
+          result[i].task_clock_ns = phase_state.positions[0] < 0 ? -1 : phase_state.sums[i][0];
+          result[i].cycles = phase_state.positions[1] < 0 ? -1 : phase_state.sums[i][1];
+          result[i].instructions = phase_state.positions[2] < 0 ? -1 : phase_state.sums[i][2];
+          result[i].cache_misses = phase_state.positions[3] < 0 ? -1 : phase_state.sums[i][3];
+          result[i].branch_misses = phase_state.positions[4] < 0 ? -1 : phase_state.sums[i][4];
+        }
+
+#ifdef __linux__
+    for (i = PHASE_COUNTER_COUNT; i > 0; i--)   // members before the leader
+      if (phase_state.descriptors[i - 1] >= 0)
+        {
+          close(phase_state.descriptors[i - 1]);
+          phase_state.descriptors[i - 1] = -1;
+        }
+#endif
+  }
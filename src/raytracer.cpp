@@ -1,4 +1,25 @@
 #include "raytracer.hpp"
+#include <stdio.h>
+#include <string.h>
+#include <sstream>
+#include <sys/stat.h>
+#include <chrono>
+#include <iomanip>
+#include <algorithm>
+#include <limits>
+
+#if RENDER_STATISTICS
+  thread_local render_statistics thread_render_statistics;
+#endif
+
+static thread_local vector<shadow_occluder> shadow_occluders;   // cache of the last occluder of each light, reset by render
+
+#ifndef _WIN32
+  #include <sys/resource.h>
+  #include <sys/mman.h>
+  #include <fcntl.h>
+  #include <unistd.h>
+#endif
 
 void light_3D::set_position(double x, double y, double z)
   {
@@ -26,6 +47,7 @@ bool line_3D::intersects_sphere(point_3D center, double radius)
 mesh_3D::mesh_3D()
   {
     this->texture = 0;
+    this->paged = 0;
     this->tex_3D = 0;
     this->use_3D_texture = false;
     this->mat.surface_color.red = 255;
@@ -40,6 +62,7 @@ mesh_3D::mesh_3D()
     this->mat.refractive_index = 1.2;
     this->mat.transparency = 0;
     this->mat.glitter = 0;
+    this->mat.defined = 0;
     this->bounding_sphere_center.x = 0;
     this->bounding_sphere_center.y = 0;
     this->bounding_sphere_center.z = 0;
@@ -105,6 +128,8 @@ color texture_3D_checkers::get_color(double x, double y, double z)
 
 void mesh_3D::update_bounding_sphere()
   {
+    TRACE_ZONE("update bounding sphere","accel");
+
     unsigned int i;
     double distance;
 
@@ -339,12 +364,125 @@ double random_double()
     return ((rand() % 1000) / 1000.0);
   }
 
+void scene_3D::add_light_contribution(point_3D position, material &surface_material, point_3D surface_normal,
+  point_3D vector_to_camera, unsigned int light_index, double weight, int color_sum[3])
+  {
+    unsigned int j, sum;
+    point_3D vector_to_light, reflection_vector;
+    color light_color;
+    double diffuse, specular, intensity, distance_penalty;
+    light_3D *light = this->lights[light_index];
+    shadow_occluder *occluder = light_index < shadow_occluders.size() ? &shadow_occluders[light_index] : 0;
+    bool hard_shadow = light->get_shape() == LIGHT_POINT && (this->shadow_rays <= 1 || this->shadow_range <= 0);
+
+    // the terms that don't depend on the shadow are computed first so that useless shadow rays aren't cast
+
+    distance_penalty = 1.0 - point_distance(position,light->get_position()) / light->distance_factor;
+
+    if (distance_penalty <= 0 || light->get_intensity() == 0)   // out of range
+      {
+        COUNT_STATISTIC(culled_lights);
+        return;
+      }
+
+    distance_penalty = pow(distance_penalty,0.25);
+
+    substract_vectors(light->get_position(),position,vector_to_light);
+    normalize(vector_to_light);
+
+    diffuse = -1 * dot_product(vector_to_light,surface_normal);
+    diffuse = diffuse < 0 ? 0 : diffuse;
+
+    reflection_vector = make_reflection_vector(surface_normal,vector_to_light);
+    specular = pow(dot_product(reflection_vector,vector_to_camera),surface_material.specular_exponent);
+    specular = specular < 0 ? 0 : specular;
+
+    if ((diffuse == 0 || surface_material.diffuse_intensity == 0) &&
+      (specular == 0 || surface_material.specular_intensity == 0))   // facing away and no highlight
+      {
+        COUNT_STATISTIC(culled_lights);
+        return;
+      }
+
+    double shadow_ratio;    // how much shadow the point is in, 0.0 = full shadow, 1.0 = no shadow
+
+    if (this->shadow_map_resolution != 0 && light_index < this->shadow_maps.size())   // approximate
+      {
+        shadow_ratio = this->shadow_map_visibility(light_index,position,surface_normal,
+          hard_shadow ? 0 : (light->get_shape() == LIGHT_POINT ? this->shadow_range / 2 : light->get_size()));
+
+        if (shadow_ratio == 0)
+          return;
+      }
+    else if (hard_shadow)
+      {
+        if (!this->cast_shadow_ray(position,light->get_position(),ERROR_OFFSET,occluder))
+          return;
+
+        shadow_ratio = 1;
+      }
+    else
+      {
+        light_3D area_light = *light;
+        double sample_weight, sum_weights;
+
+        if (light->get_shape() == LIGHT_POINT)
+          area_light.set_sphere(this->shadow_range / 2);
+
+        sum = 0;
+        shadow_ratio = 0;
+        sum_weights = 0;
+
+        for (j = 0; j < this->shadow_rays; j++)
+          {
+            point_3D light_position;
+
+            if (this->adaptive_probes != 0 && j == this->adaptive_probes && (sum == 0 || sum == j))   // the probes agree, not in penumbra
+              {
+                COUNT_STATISTIC_ADD(adaptive_skipped_rays,this->shadow_rays - j);
+                break;
+              }
+
+            sample_weight = area_light.sample_point(position,light_position);
+            sum_weights += sample_weight;
+
+            if (this->cast_shadow_ray(position,light_position,ERROR_OFFSET,occluder))
+              {
+                shadow_ratio += sample_weight;
+                sum++;
+              }
+          }
+
+        if (sum == 0)  // no shadow ray hit the light
+          return;
+
+        shadow_ratio = sum_weights > 0 ? shadow_ratio / sum_weights : sum / ((double) j);
+      }
+
+    intensity = light->get_intensity() * distance_penalty * shadow_ratio * weight;
+
+    // add diffuse part:
+    color_sum[0] += intensity * surface_material.surface_color.red * surface_material.diffuse_intensity * diffuse;
+    color_sum[1] += intensity * surface_material.surface_color.green * surface_material.diffuse_intensity * diffuse;
+    color_sum[2] += intensity * surface_material.surface_color.blue * surface_material.diffuse_intensity * diffuse;
+
+    // add specular part:
+    light_color = light->get_color();
+
+    color_sum[0] += intensity * surface_material.specular_intensity * specular * light_color.red;
+    color_sum[1] += intensity * surface_material.specular_intensity * specular * light_color.green;
+    color_sum[2] += intensity * surface_material.specular_intensity * specular * light_color.blue;
+  }
+
 color scene_3D::compute_lighting(point_3D position, material surface_material, point_3D surface_normal)
   {
-    unsigned int i, j;
-    point_3D vector_to_light, vector_to_camera, reflection_vector;
-    color final_color, light_color;
-    double helper, intensity, distance_penalty;
+    PHASE_SCOPE(PHASE_SHADING);
+
+    unsigned int i;
+    int light;
+    point_3D vector_to_camera;
+    color final_color;
+    double pdf;
     int helper_color[3];
 
     helper_color[0] = surface_material.ambient_intensity * surface_material.surface_color.red;
@@ -357,62 +495,543 @@ color scene_3D::compute_lighting(point_3D position, material surface_material, p
 
     normalize(vector_to_camera);
 
+    if (this->light_samples == 0 || this->light_samples >= this->lights.size() || this->light_tree.size() == 0)
+      {
+        for (i = 0; i < this->lights.size(); i++)
+          this->add_light_contribution(position,surface_material,surface_normal,vector_to_camera,i,1.0,helper_color);
+      }
+    else
+      {
+        for (i = 0; i < this->light_samples; i++)
+          {
+            light = this->sample_light_tree(position,surface_normal,pdf);
+
+            if (light >= 0)
+              this->add_light_contribution(position,surface_material,surface_normal,vector_to_camera,light,
+                1.0 / (pdf * this->light_samples),helper_color);
+          }
+      }
+
+    final_color.red = saturate_int(helper_color[0],0,255);
+    final_color.green = saturate_int(helper_color[1],0,255);
+    final_color.blue = saturate_int(helper_color[2],0,255);
+
+    return final_color;
+  }
+
+unsigned int scene_3D::build_light_tree_node(vector<unsigned int> &indices, unsigned int begin, unsigned int end)
+  {
+    unsigned int i, result, axis, middle, left, right;
+    light_tree_node node;
+    point_3D position;
+    double extent[3];
+
+    for (i = begin; i < end; i++)
+      {
+        position = this->lights[indices[i]]->get_position();
+
+        if (i == begin)
+          {
+            node.box_min = position;
+            node.box_max = position;
+            node.intensity = 0;
+            node.distance_factor = 0;
+          }
+
+        node.box_min.x = min(node.box_min.x,position.x);
+        node.box_min.y = min(node.box_min.y,position.y);
+        node.box_min.z = min(node.box_min.z,position.z);
+        node.box_max.x = max(node.box_max.x,position.x);
+        node.box_max.y = max(node.box_max.y,position.y);
+        node.box_max.z = max(node.box_max.z,position.z);
+        node.intensity += this->lights[indices[i]]->get_intensity();
+        node.distance_factor = max(node.distance_factor,this->lights[indices[i]]->distance_factor);
+      }
+
+    result = this->light_tree.size();
+    node.light = end - begin == 1 ? indices[begin] : -1;
+    node.children[0] = 0;
+    node.children[1] = 0;
+    this->light_tree.push_back(node);
+
+    if (end - begin == 1)
+      return result;
+
+    extent[0] = node.box_max.x - node.box_min.x;
+    extent[1] = node.box_max.y - node.box_min.y;
+    extent[2] = node.box_max.z - node.box_min.z;
+    axis = extent[0] >= extent[1] && extent[0] >= extent[2] ? 0 : (extent[1] >= extent[2] ? 1 : 2);
+    middle = (begin + end) / 2;
+
+    nth_element(indices.begin() + begin,indices.begin() + middle,indices.begin() + end,
+      [this,axis](unsigned int a, unsigned int b)
+        {
+          point_3D position_a = this->lights[a]->get_position();
+          point_3D position_b = this->lights[b]->get_position();
+
+          return axis == 0 ? position_a.x < position_b.x : (axis == 1 ? position_a.y < position_b.y : position_a.z < position_b.z);
+        });
+
+    left = this->build_light_tree_node(indices,begin,middle);
+    right = this->build_light_tree_node(indices,middle,end);
+
+    this->light_tree[result].children[0] = left;    // push_back may have moved the nodes
+    this->light_tree[result].children[1] = right;
+
+    return result;
+  }
+
+void scene_3D::build_light_tree()
+  {
+    TRACE_ZONE("build light tree","accel");
+
+    unsigned int i;
+    vector<unsigned int> indices;
+
+    this->light_tree.clear();
+
+    if (this->lights.size() == 0)
+      return;
+
     for (i = 0; i < this->lights.size(); i++)
+      indices.push_back(i);
+
+    this->light_tree.reserve(2 * this->lights.size() - 1);
+    this->build_light_tree_node(indices,0,indices.size());
+  }
+
+#define LIGHT_BEHIND_IMPORTANCE 0.05   // weight of lights behind the surface, they can only add specular light
+
+static double light_node_importance(const light_tree_node &node, point_3D position, point_3D normal)
+
+  /**<
+    Estimate of the light of the node reaching the position: the
+    intensity with the scene falloff at the nearest point of the
+    bounding box, reduced if the whole box is behind the surface.
+   */
+
+  {
+    double dx, dy, dz, falloff, facing;
+
+    dx = max(0.0,max(node.box_min.x - position.x,position.x - node.box_max.x));
+    dy = max(0.0,max(node.box_min.y - position.y,position.y - node.box_max.y));
+    dz = max(0.0,max(node.box_min.z - position.z,position.z - node.box_max.z));
+
+    falloff = 1.0 - sqrt(dx * dx + dy * dy + dz * dz) / node.distance_factor;
+
+    if (falloff <= 0)
+      return 0;
+
+    // maximum of dot(light - position,normal) over the box corners, positive if some light can be in front of the surface
+
+    facing =
+      max(normal.x * (node.box_min.x - position.x),normal.x * (node.box_max.x - position.x)) +
+      max(normal.y * (node.box_min.y - position.y),normal.y * (node.box_max.y - position.y)) +
+      max(normal.z * (node.box_min.z - position.z),normal.z * (node.box_max.z - position.z));
+
+    return node.intensity * pow(falloff,0.25) * (facing > 0 ? 1.0 : LIGHT_BEHIND_IMPORTANCE);
+  }
+
+int scene_3D::sample_light_tree(point_3D position, point_3D normal, double &pdf)
+  {
+    unsigned int node;
+    double importance_left, importance_right, probability;
+
+    node = 0;
+    pdf = 1;
+
+    while (this->light_tree[node].light < 0)
+      {
+        importance_left = light_node_importance(this->light_tree[this->light_tree[node].children[0]],position,normal);
+        importance_right = light_node_importance(this->light_tree[this->light_tree[node].children[1]],position,normal);
+
+        if (importance_left + importance_right <= 0)
+          return -1;
+
+        probability = importance_left / (importance_left + importance_right);
+
+        if (random_double() < probability)
+          {
+            node = this->light_tree[node].children[0];
+            pdf *= probability;
+          }
+        else
+          {
+            node = this->light_tree[node].children[1];
+            pdf *= 1 - probability;
+          }
+      }
+
+    return this->light_tree[node].light;
+  }
+
+static const unsigned int cube_face_axes[6][3] =   // depth, u and v axis of each cube face
+  {
+    {0, 1, 2}, {0, 1, 2}, {1, 0, 2}, {1, 0, 2}, {2, 0, 1}, {2, 0, 1}
+  };
+
+static double vector_component(point_3D vector, unsigned int axis)
+  {
+    return axis == 0 ? vector.x : (axis == 1 ? vector.y : vector.z);
+  }
+
+static void cube_map_coordinates(point_3D direction, unsigned int &face, double &u, double &v, double &depth)
+
+  /**<
+    Finds the cube map face given direction (from the cube center) goes
+    through, the face coordinates (u and v in <-1,1>) and the depth along
+    the face axis.
+   */
+
+  {
+    double absolute[3] = {fabs(direction.x), fabs(direction.y), fabs(direction.z)};
+    unsigned int axis;
+
+    axis = absolute[0] >= absolute[1] && absolute[0] >= absolute[2] ? 0 : (absolute[1] >= absolute[2] ? 1 : 2);
+    face = 2 * axis + (vector_component(direction,axis) > 0 ? 0 : 1);
+    depth = absolute[axis];
+
+    if (depth <= 0)
       {
-        unsigned int sum;
+        u = 0;
+        v = 0;
+        return;
+      }
+
+    u = vector_component(direction,cube_face_axes[face][1]) / depth;
+    v = vector_component(direction,cube_face_axes[face][2]) / depth;
+  }
 
-        sum = this->cast_shadow_ray(position,*this->lights[i],ERROR_OFFSET,0.0) ? 1 : 0; // main shadow ray
+template <typename T>
+static void rasterize_triangle(const double triangle[3][3], const double projection[4], int width, int height,
+  double near, double tolerance, T &visit)
+
+  /**<
+    Rasterizes a triangle given in the view coordinates (u, v, depth),
+    the parts closer than near are clipped. The pixels are at
+    (projection[0] * u / depth + projection[1], projection[2] * v /
+    depth + projection[3]) and each pixel whose center the triangle
+    covers is visited as visit(x,y,depth), with the depth perspective
+    correct. Pixels up to tolerance pixels outside the triangle are
+    visited too.
+   */
+
+  {
+    double polygon[4][3], projected[4][3], length[3], edge[3];
+    unsigned int i, j, count, k;
+    int x, y, x0, x1, y0, y1;
+    double area, inverse_depth;
+
+    count = 0;
+
+    for (i = 0; i < 3; i++)      // clip by the near plane
+      {
+        const double *a = triangle[i];
+        const double *b = triangle[(i + 1) % 3];
 
-        for (j = 1; j < this->shadow_rays; j++) // additional shadow rays
-          sum += this->cast_shadow_ray(position,*this->lights[i],ERROR_OFFSET,this->shadow_range) ? 1 : 0;
+        if (a[2] >= near)
+          {
+            polygon[count][0] = a[0]; polygon[count][1] = a[1]; polygon[count][2] = a[2];
+            count++;
+          }
 
-        if (sum != 0)  // at least one shadow ray hit the light
+        if ((a[2] >= near) != (b[2] >= near))
           {
-            double shadow_ratio;    // how much shadow the point is in, 0.0 = full shadow, 1.0 = no shadow
-            shadow_ratio = sum / ((double) this->shadow_rays);
+            double t = (near - a[2]) / (b[2] - a[2]);
+
+            for (j = 0; j < 2; j++)
+              polygon[count][j] = a[j] + t * (b[j] - a[j]);
+
+            polygon[count][2] = near;
+            count++;
+          }
+      }
+
+    for (i = 0; i < count; i++)  // to pixels, 1 / depth is linear in the screen space
+      {
+        projected[i][0] = projection[0] * polygon[i][0] / polygon[i][2] + projection[1];
+        projected[i][1] = projection[2] * polygon[i][1] / polygon[i][2] + projection[3];
+        projected[i][2] = 1.0 / polygon[i][2];
+      }
+
+    for (k = 1; k + 1 < count; k++)
+      {
+        const double *vertices[3] = {projected[0], projected[k], projected[k + 1]};
+
+        area = (vertices[1][0] - vertices[0][0]) * (vertices[2][1] - vertices[0][1]) -
+          (vertices[1][1] - vertices[0][1]) * (vertices[2][0] - vertices[0][0]);
+
+        if (fabs(area) < 1e-12)
+          continue;
+
+        for (i = 0; i < 3; i++)  // edge opposite to vertex i
+          length[i] = sqrt(
+            (vertices[(i + 2) % 3][0] - vertices[(i + 1) % 3][0]) * (vertices[(i + 2) % 3][0] - vertices[(i + 1) % 3][0]) +
+            (vertices[(i + 2) % 3][1] - vertices[(i + 1) % 3][1]) * (vertices[(i + 2) % 3][1] - vertices[(i + 1) % 3][1]));
+
+        x0 = max(0.0,floor(min(vertices[0][0],min(vertices[1][0],vertices[2][0])) - tolerance));
+        x1 = min(width - 1.0,ceil(max(vertices[0][0],max(vertices[1][0],vertices[2][0])) + tolerance));
+        y0 = max(0.0,floor(min(vertices[0][1],min(vertices[1][1],vertices[2][1])) - tolerance));
+        y1 = min(height - 1.0,ceil(max(vertices[0][1],max(vertices[1][1],vertices[2][1])) + tolerance));
 
-            distance_penalty = 1.0 - point_distance(position,this->lights[i]->get_position()) / this->lights[i]->distance_factor;
-            distance_penalty = distance_penalty < 0 ? 0 : pow(distance_penalty,0.25);
-            intensity = this->lights[i]->get_intensity() * distance_penalty * shadow_ratio;
+        for (y = y0; y <= y1; y++)
+          for (x = x0; x <= x1; x++)
+            {
+              double px = x + 0.5, py = y + 0.5;
+              bool inside = true;
 
-            substract_vectors(this->lights[i]->get_position(),position,vector_to_light);
-            normalize(vector_to_light);
+              for (i = 0; i < 3; i++)   // barycentric coordinates
+                {
+                  const double *b = vertices[(i + 1) % 3];
+                  const double *c = vertices[(i + 2) % 3];
+
+                  edge[i] = ((b[0] - px) * (c[1] - py) - (b[1] - py) * (c[0] - px)) / area;
+
+                  if (edge[i] * fabs(area) < -tolerance * length[i])    // distance from the edge in pixels
+                    inside = false;
+                }
+
+              if (!inside)
+                continue;
+
+              inverse_depth = edge[0] * vertices[0][2] + edge[1] * vertices[1][2] + edge[2] * vertices[2][2];
+
+              if (inverse_depth > 0)
+                visit(x,y,1.0 / inverse_depth);
+            }
+      }
+  }
+
+void scene_3D::build_shadow_maps()
+  {
+    unsigned int i, j, k, face, vertex;
+    double triangle[3][3];
+    point_3D light_position, direction;
+
+    if (this->shadow_map_resolution == 0)
+      {
+        this->shadow_maps.clear();
+        return;
+      }
+
+    TRACE_ZONE("build shadow maps","accel");
 
-            helper = -1 * dot_product(vector_to_light,surface_normal);
-            helper = helper < 0 ? 0 : helper;
+    unsigned int resolution = this->shadow_map_resolution;
+    double projection[4] = {resolution / 2.0, resolution / 2.0, resolution / 2.0, resolution / 2.0};   // face <-1,1> to texels
 
-            // add diffuse part:
-            helper_color[0] += intensity * surface_material.surface_color.red * surface_material.diffuse_intensity * helper;
-            helper_color[1] += intensity * surface_material.surface_color.green * surface_material.diffuse_intensity * helper;
-            helper_color[2] += intensity * surface_material.surface_color.blue * surface_material.diffuse_intensity * helper;
+    this->shadow_maps.resize(this->lights.size());
 
-            // add specular part:
-            reflection_vector = make_reflection_vector(surface_normal,vector_to_light);
-            helper = pow(dot_product(reflection_vector,vector_to_camera),surface_material.specular_exponent);
-            helper = helper < 0 ? 0 : helper;
-            light_color = this->lights[i]->get_color();
+    for (i = 0; i < this->lights.size(); i++)
+      {
+        shadow_map &map = this->shadow_maps[i];
+
+        map.resolution = resolution;
+        map.depth.assign(6 * resolution * resolution,numeric_limits<float>::infinity());
+        light_position = this->lights[i]->get_position();
+
+        for (j = 0; j < this->meshes.size(); j++)
+          {
+            mesh_3D *mesh = this->meshes[j];
+
+            for (k = 0; k < mesh->triangle_indices.size(); k += 3)
+              for (face = 0; face < 6; face++)
+                {
+                  double sign = face % 2 == 0 ? 1 : -1;
+                  float *face_depth = &map.depth[face * resolution * resolution];
+
+                  auto keep_nearest = [face_depth,resolution](int x, int y, double depth)
+                    {
+                      float &texel = face_depth[y * resolution + x];
+                      texel = min(texel,(float) depth);
+                    };
 
-            helper_color[0] += intensity * surface_material.specular_intensity * helper * light_color.red;
-            helper_color[1] += intensity * surface_material.specular_intensity * helper * light_color.green;
-            helper_color[2] += intensity * surface_material.specular_intensity * helper * light_color.blue;
+                  for (vertex = 0; vertex < 3; vertex++)
+                    {
+                      substract_vectors(light_position,mesh->vertices[mesh->triangle_indices[k + vertex]].position,direction);
+
+                      triangle[vertex][0] = vector_component(direction,cube_face_axes[face][1]);
+                      triangle[vertex][1] = vector_component(direction,cube_face_axes[face][2]);
+                      triangle[vertex][2] = sign * vector_component(direction,cube_face_axes[face][0]);
+                    }
+
+                  rasterize_triangle(triangle,projection,resolution,resolution,SHADOW_MAP_NEAR,0,keep_nearest);
+                }
           }
       }
 
-    final_color.red = saturate_int(helper_color[0],0,255);
-    final_color.green = saturate_int(helper_color[1],0,255);
-    final_color.blue = saturate_int(helper_color[2],0,255);
+    this->update_peak_memory(0);
+  }
 
-    return final_color;
+void scene_3D::build_visibility_buffer()
+  {
+    unsigned int k, l, vertex, width, height;
+    double triangle[3][3];
+    vector<double> depth, second_depth;
+
+    if (!this->rasterize_primary)
+      {
+        this->visibility_buffer.clear();
+        return;
+      }
+
+    TRACE_ZONE("rasterize visibility","render");
+
+    width = this->resolution[0];
+    height = this->resolution[1];
+
+    /* The central primary ray of pixel (i,j) goes from (0,-focal_distance,0)
+       through (i / width - 0.5,0,-aspect_ratio * (j / height - 0.5)), i.e.
+       through the center of the raster pixel (i,j) with this projection of
+       the view coordinates (x, z, depth along y from the camera): */
+
+    double projection[4] = {width * this->focal_distance, width / 2.0 + 0.5, -1.0 * width * this->focal_distance,
+      height / 2.0 + 0.5};
+
+    visibility_sample no_triangle;
+    no_triangle.mesh = -1;
+    no_triangle.triangle = 0;
+
+    this->visibility_buffer.assign(width * height,no_triangle);
+    depth.assign(width * height,numeric_limits<double>::infinity());
+    second_depth.assign(width * height,numeric_limits<double>::infinity());
+
+    for (k = 0; k < this->meshes.size(); k++)
+      {
+        mesh_3D *mesh = this->meshes[k];
+
+        for (l = 0; l < mesh->triangle_indices.size(); l += 3)
+          {
+            for (vertex = 0; vertex < 3; vertex++)
+              {
+                point_3D position = mesh->vertices[mesh->triangle_indices[l + vertex]].position;
+
+                triangle[vertex][0] = position.x;
+                triangle[vertex][1] = position.z;
+                triangle[vertex][2] = position.y + this->focal_distance;
+              }
+
+            auto keep_nearest = [this,&depth,&second_depth,width,k,l](int x, int y, double pixel_depth)
+              {
+                unsigned int index = y * width + x;
+
+                if (pixel_depth < depth[index])
+                  {
+                    second_depth[index] = depth[index];
+                    depth[index] = pixel_depth;
+                    this->visibility_buffer[index].mesh = k;
+                    this->visibility_buffer[index].triangle = l;
+                  }
+                else if (pixel_depth < second_depth[index])
+                  second_depth[index] = pixel_depth;
+              };
+
+            rasterize_triangle(triangle,projection,width,height,VISIBILITY_NEAR,VISIBILITY_TOLERANCE,keep_nearest);
+          }
+      }
+
+    /* The rasterized depths differ from the traced distances by rounding,
+       so near ties are left to the tracing, which also decides which of
+       equally distant triangles is hit. */
+
+    for (k = 0; k < depth.size(); k++)
+      if (this->visibility_buffer[k].mesh >= 0 && second_depth[k] - depth[k] <= VISIBILITY_TIE * depth[k])
+        this->visibility_buffer[k].mesh = VISIBILITY_AMBIGUOUS;
+
+    this->update_peak_memory((depth.capacity() + second_depth.capacity()) * sizeof(double));
+  }
+
+double scene_3D::shadow_map_visibility(unsigned int light_index, point_3D position, point_3D normal, double light_size)
+  {
+    const shadow_map &map = this->shadow_maps[light_index];
+    point_3D light_position, direction;
+    unsigned int face, blockers, lit, total;
+    int x, y, center_x, center_y, radius, limit;
+    double u, v, depth, texel_size, offset, bias, blocker_depth, penumbra;
+
+    COUNT_STATISTIC(shadow_map_lookups);
+
+    light_position = this->lights[light_index]->get_position();
+    substract_vectors(light_position,position,direction);
+    cube_map_coordinates(direction,face,u,v,depth);
+
+    if (depth <= 0)
+      return 1;
+
+    offset = 2 * depth / map.resolution * SHADOW_MAP_BIAS;   // texel size at the point times the bias
+
+    if (dot_product(normal,direction) > 0)       // towards the light
+      offset *= -1;
+
+    position.x += normal.x * offset;
+    position.y += normal.y * offset;
+    position.z += normal.z * offset;
+
+    substract_vectors(light_position,position,direction);
+    cube_map_coordinates(direction,face,u,v,depth);
+
+    if (depth <= 0)
+      return 1;
+
+    texel_size = 2 * depth / map.resolution;
+    bias = texel_size * SHADOW_MAP_BIAS;
+    limit = map.resolution - 1;
+    center_x = saturate_int((int) ((u + 1) / 2 * map.resolution),0,limit);
+    center_y = saturate_int((int) ((v + 1) / 2 * map.resolution),0,limit);
+
+    const float *face_depth = &map.depth[face * map.resolution * map.resolution];
+
+    if (light_size <= 0)                       // hard shadow
+      return face_depth[center_y * map.resolution + center_x] < depth - bias ? 0 : 1;
+
+    // blocker search in the area the light covers as seen from the point
+
+    radius = max(1,(int) ceil(min(light_size / texel_size,(double) SHADOW_MAP_MAX_FILTER)));
+    blockers = 0;
+    blocker_depth = 0;
+
+    for (y = max(0,center_y - radius); y <= min(limit,center_y + radius); y++)
+      for (x = max(0,center_x - radius); x <= min(limit,center_x + radius); x++)
+        if (face_depth[y * map.resolution + x] < depth - bias)
+          {
+            blocker_depth += face_depth[y * map.resolution + x];
+            blockers++;
+          }
+
+    if (blockers == 0)
+      return 1;
+
+    blocker_depth /= blockers;
+
+    // penumbra half width on the receiver from similar triangles, the PCF radius
+
+    penumbra = light_size * (depth - blocker_depth) / max(blocker_depth,SHADOW_MAP_NEAR);
+    radius = (int) floor(min(penumbra / texel_size,(double) SHADOW_MAP_MAX_FILTER) + 0.5);
+    lit = 0;
+    total = 0;
+
+    for (y = max(0,center_y - radius); y <= min(limit,center_y + radius); y++)
+      for (x = max(0,center_x - radius); x <= min(limit,center_x + radius); x++)
+        {
+          if (face_depth[y * map.resolution + x] >= depth - bias)
+            lit++;
+
+          total++;
+        }
+
+    return lit / ((double) total);
   }
 
 void scene_3D::set_resolution(unsigned int width, unsigned int height)
   {
     this->resolution[0] = width;
     this->resolution[1] = height;
+    this->hit_cache_valid = false;
   }
 
 void mesh_3D::translate(double x, double y, double z)
   {
+    TRACE_ZONE("translate","transform");
+
     unsigned int i;
 
     for (i = 0; i < this->vertices.size(); i++)
@@ -476,6 +1095,8 @@ void rotate_point(point_3D &point, double angle, rotation_type type)
 
 void mesh_3D::rotate(double angle, rotation_type type)
   {
+    TRACE_ZONE("rotate","transform");
+
     unsigned int i;
 
     for (i = 0; i < this->vertices.size(); i++)
@@ -489,6 +1110,8 @@ void mesh_3D::rotate(double angle, rotation_type type)
 
 void mesh_3D::scale(double x, double y, double z)
   {
+    TRACE_ZONE("scale","transform");
+
     unsigned int i;
 
     for (i = 0; i < this->vertices.size(); i++)
@@ -504,6 +1127,19 @@ void mesh_3D::scale(double x, double y, double z)
 void mesh_3D::set_texture(t_color_buffer *texture)
   {
     this->texture = texture;
+    this->texture_handle.reset();
+
+    if (texture != 0 && texture->tiled == NULL)
+      {
+        TRACE_ZONE("build tiled texture","decode");
+        color_buffer_build_tiled(texture);
+      }
+  }
+
+void mesh_3D::set_texture(shared_ptr<t_color_buffer> texture)
+  {
+    this->set_texture(texture.get());
+    this->texture_handle = texture;
   }
 
 t_color_buffer *mesh_3D::get_texture()
@@ -511,6 +1147,16 @@ t_color_buffer *mesh_3D::get_texture()
     return this->texture;
   }
 
+void mesh_3D::set_paged_texture(paged_texture *texture)
+  {
+    this->paged = texture;
+  }
+
+paged_texture *mesh_3D::get_paged_texture()
+  {
+    return this->paged;
+  }
+
 scene_3D::scene_3D(unsigned int width, unsigned int height)
   {
     this->resolution[0] = width;
@@ -531,6 +1177,22 @@ scene_3D::scene_3D(unsigned int width, unsigned int height)
     this->reflection_rays = 1;
     this->refraction_rays = 1;
     this->refraction_range = 0.1;
+    this->texture_filtering = true;
+    this->cost_map_metric = COST_NONE;
+    this->count_phases = false;
+    this->report_memory = false;
+    this->record_aux = false;
+    this->cache_hits = false;
+    this->light_samples = 0;
+    this->adaptive_probes = 0;
+    this->adaptive_threshold = 0;
+    this->shadow_map_resolution = 0;
+    this->rasterize_primary = false;
+    this->hit_cache_valid = false;
+    this->aux.width = 0;
+    this->aux.height = 0;
+    this->peak_memory = 0;
+    this->mesh_memory_total = 0;
   }
 
 void scene_3D::set_background_color(unsigned char r, unsigned char g, unsigned char b)
@@ -546,6 +1208,8 @@ void scene_3D::camera_translate(double x, double y, double z)
 
     for (i = 0; i < this->meshes.size(); i++)
       this->meshes[i]->translate(-x, -y, -z);
+
+    this->hit_cache_valid = false;
   }
 
 void scene_3D::camera_rotate(double angle, rotation_type type)
@@ -554,11 +1218,357 @@ void scene_3D::camera_rotate(double angle, rotation_type type)
 
     for (i = 0; i < this->meshes.size(); i++)
       this->meshes[i]->rotate(angle,type);
+
+    this->hit_cache_valid = false;
   }
 
 void scene_3D::set_focal_distance(float distance)
   {
     this->focal_distance = distance;
+    this->hit_cache_valid = false;
+  }
+
+void scene_3D::set_texture_filtering(bool enabled)
+  {
+    this->texture_filtering = enabled;
+    this->hit_cache_valid = false;
+  }
+
+void scene_3D::set_cost_map(cost_metric metric)
+  {
+    this->cost_map_metric = metric;
+
+#if !RENDER_STATISTICS
+    if (metric != COST_NONE)
+      this->cost_map_metric = COST_TIME;
+#endif
+  }
+
+void scene_3D::set_phase_counters(bool enabled)
+  {
+    this->count_phases = enabled;
+  }
+
+void scene_3D::set_aux_buffers(bool enabled)
+  {
+    this->record_aux = enabled;
+  }
+
+const aux_buffers &scene_3D::get_aux_buffers()
+  {
+    return this->aux;
+  }
+
+void scene_3D::set_adaptive_sampling(unsigned int probes, unsigned int threshold)
+  {
+    this->adaptive_probes = probes < 2 ? 0 : probes;
+    this->adaptive_threshold = threshold;
+  }
+
+void scene_3D::set_primary_rasterization(bool enabled)
+  {
+    this->rasterize_primary = enabled;
+  }
+
+void scene_3D::set_shadow_maps(unsigned int resolution)
+  {
+    this->shadow_map_resolution = resolution;
+  }
+
+void scene_3D::set_light_samples(unsigned int count)
+  {
+    this->light_samples = count;
+  }
+
+void scene_3D::set_hit_cache(bool enabled)
+  {
+    this->cache_hits = enabled;
+
+    if (!enabled)
+      {
+        this->hit_cache_valid = false;
+        vector<ray_hit>().swap(this->hit_cache);
+      }
+  }
+
+void scene_3D::invalidate_hit_cache()
+  {
+    this->hit_cache_valid = false;
+  }
+
+void scene_3D::set_memory_report(bool enabled)
+  {
+    this->report_memory = enabled;
+  }
+
+static size_t tiled_texture_bytes(t_tiled_texture *tiled)
+  {
+    size_t result;
+    unsigned int i, tiles_y;
+
+    if (tiled == NULL)
+      return 0;
+
+    result = sizeof(t_tiled_texture) + tiled->level_count * sizeof(t_tiled_level);
+
+    for (i = 0; i < tiled->level_count; i++)
+      {
+        tiles_y = (tiled->levels[i].height + COLOR_BUFFER_TILE_SIZE - 1) / COLOR_BUFFER_TILE_SIZE;
+        result += (tiled->levels[i].tiles_x * tiles_y + 1) *                // + 1 for the alignment
+          COLOR_BUFFER_TILE_SIZE * COLOR_BUFFER_TILE_SIZE * sizeof(unsigned int);
+      }
+
+    return result;
+  }
+
+static mesh_memory get_mesh_memory(mesh_3D *mesh)
+  {
+    mesh_memory result;
+
+    result.vertex_count = mesh->vertices.size();
+    result.vertices = mesh->vertices.size() * sizeof(vertex_3D);
+    result.indices = mesh->triangle_indices.size() * sizeof(unsigned int);
+    result.materials = mesh->materials.size() * sizeof(material) +
+      mesh->triangle_materials.size() * sizeof(unsigned short);
+    result.acceleration = sizeof(mesh->bounding_sphere_center) + sizeof(mesh->bounding_sphere_radius);
+    result.mapped =
+      (mesh->vertices.is_external() ? result.vertices : 0) +
+      (mesh->triangle_indices.is_external() ? result.indices : 0) +
+      (mesh->materials.is_external() ? mesh->materials.size() * sizeof(material) : 0) +
+      (mesh->triangle_materials.is_external() ? mesh->triangle_materials.size() * sizeof(unsigned short) : 0);
+
+    return result;
+  }
+
+static texture_memory get_texture_memory(t_color_buffer *texture)
+  {
+    texture_memory result;
+    unsigned int i;
+
+    result.width = texture->width;
+    result.height = texture->height;
+    result.image = texture->width * texture->height * 3;
+    result.mipmaps = 0;
+
+    if (texture->mipmaps != NULL)
+      for (i = 0; i < texture->mipmap_count; i++)
+        result.mipmaps += texture->mipmaps[i].width * texture->mipmaps[i].height * 3;
+
+    result.tiled = tiled_texture_bytes(texture->tiled);
+    result.users = 1;
+
+    return result;
+  }
+
+static t_color_buffer *get_memory_texture(mesh_3D *mesh)
+  {
+    // paged textures are in the texture cache, not in the scene memory
+    return mesh->get_paged_texture() != 0 ? NULL : mesh->get_texture();
+  }
+
+size_t scene_3D::get_buffer_memory() const
+  {
+    size_t result;
+    unsigned int i;
+
+    result = this->resolution[0] * this->resolution[1] * 3 +
+      this->cost_map.capacity() * sizeof(double) +
+      (this->aux.albedo.capacity() + this->aux.normal.capacity() + this->aux.depth.capacity()) * sizeof(float) +
+      this->hit_cache.capacity() * sizeof(ray_hit) +
+      this->visibility_buffer.capacity() * sizeof(visibility_sample);
+
+    for (i = 0; i < this->shadow_maps.size(); i++)
+      result += this->shadow_maps[i].depth.capacity() * sizeof(float);
+
+    return result;
+  }
+
+memory_report scene_3D::get_memory_report() const
+  {
+    memory_report report;
+    unsigned int i, j;
+    vector<t_color_buffer *> textures;   // in the same order as report.textures
+
+    report.shadow_maps = 0;
+
+    for (i = 0; i < this->shadow_maps.size(); i++)
+      report.shadow_maps += this->shadow_maps[i].depth.capacity() * sizeof(float);
+
+    report.framebuffers = this->get_buffer_memory() - report.shadow_maps;
+    report.total = report.framebuffers + report.shadow_maps;
+
+    for (i = 0; i < this->meshes.size(); i++)
+      {
+        mesh_memory item = get_mesh_memory(this->meshes[i]);
+
+        report.meshes.push_back(item);
+        report.total += item.vertices + item.indices + item.materials + item.acceleration;
+
+        t_color_buffer *texture = get_memory_texture(this->meshes[i]);
+
+        if (texture == NULL)
+          continue;
+
+        for (j = 0; j < textures.size(); j++)
+          if (textures[j] == texture)
+            break;
+
+        if (j < textures.size())
+          {
+            report.textures[j].users++;
+            continue;
+          }
+
+        texture_memory texture_item = get_texture_memory(texture);
+
+        textures.push_back(texture);
+        report.textures.push_back(texture_item);
+        report.total += texture_item.image + texture_item.mipmaps + texture_item.tiled;
+      }
+
+    report.scene_peak = max(this->peak_memory,report.total);
+    report.process_peak = process_peak_memory();
+
+    return report;
+  }
+
+void scene_3D::update_peak_memory(size_t temporary)
+  {
+    this->peak_memory = max(this->peak_memory,this->mesh_memory_total + this->get_buffer_memory() + temporary);
+  }
+
+size_t process_peak_memory()
+  {
+#ifndef _WIN32
+    struct rusage usage;
+
+    if (getrusage(RUSAGE_SELF,&usage) != 0)
+      return 0;
+
+  #ifdef __APPLE__
+    return usage.ru_maxrss;          // bytes on macOS
+  #else
+    return usage.ru_maxrss * 1024;   // KiB on Linux
+  #endif
+#else
+    return 0;
+#endif
+  }
+
+static string format_bytes(size_t bytes)
+  {
+    char text[32];
+
+    if (bytes < 1024)
+      snprintf(text,sizeof(text),"%u B",(unsigned int) bytes);
+    else if (bytes < 1024 * 1024)
+      snprintf(text,sizeof(text),"%.1f KiB",bytes / 1024.0);
+    else
+      snprintf(text,sizeof(text),"%.1f MiB",bytes / (1024.0 * 1024.0));
+
+    return text;
+  }
+
+void print_memory_report(const memory_report &report, ostream &output)
+  {
+    unsigned int i;
+
+    output << "memory: " << format_bytes(report.total) << " total (scene peak " << format_bytes(report.scene_peak);
+
+    if (report.process_peak != 0)
+      output << ", process peak " << format_bytes(report.process_peak);
+
+    output << ")" << endl;
+
+    for (i = 0; i < report.meshes.size(); i++)
+      {
+        const mesh_memory &item = report.meshes[i];
+
+        output << "  mesh " << i << ": " << format_bytes(item.vertices + item.indices + item.materials + item.acceleration) <<
+          " (" << item.vertex_count << " vertices " << format_bytes(item.vertices) << ", indices " << format_bytes(item.indices) <<
+          ", materials " << format_bytes(item.materials) << ", acceleration " << format_bytes(item.acceleration);
+
+        if (item.mapped != 0)
+          output << ", " << format_bytes(item.mapped) << " mapped";
+
+        output << ")" << endl;
+      }
+
+    for (i = 0; i < report.textures.size(); i++)
+      {
+        const texture_memory &item = report.textures[i];
+
+        output << "  texture " << i << " (" << item.width << "x" << item.height << ", " << item.users <<
+          (item.users == 1 ? " mesh" : " meshes") << "): " << format_bytes(item.image + item.mipmaps + item.tiled) <<
+          " (image " << format_bytes(item.image) << ", mipmaps " << format_bytes(item.mipmaps) <<
+          ", tiled " << format_bytes(item.tiled) << ")" << endl;
+      }
+
+    output << "  framebuffers: " << format_bytes(report.framebuffers) << endl;
+
+    if (report.shadow_maps != 0)
+      output << "  shadow maps: " << format_bytes(report.shadow_maps) << endl;
+  }
+
+const vector<double> &scene_3D::get_cost_map()
+  {
+    return this->cost_map;
+  }
+
+static void heat_color(double value, unsigned char *red, unsigned char *green, unsigned char *blue)
+
+  /**<
+    Maps value in <0,1> to black - blue - red - yellow - white ramp.
+   */
+
+  {
+    static const unsigned char ramp[5][3] =
+      {{0,0,0},{40,30,200},{220,30,40},{250,220,30},{255,255,255}};
+    unsigned int index;
+    double ratio;
+
+    value = value < 0 ? 0 : (value > 1 ? 1 : value);
+    index = value >= 1 ? 3 : (unsigned int) (value * 4);
+    ratio = value * 4 - index;
+
+    *red = ramp[index][0] + ratio * (ramp[index + 1][0] - ramp[index][0]);
+    *green = ramp[index][1] + ratio * (ramp[index + 1][1] - ramp[index][1]);
+    *blue = ramp[index][2] + ratio * (ramp[index + 1][2] - ramp[index][2]);
+  }
+
+bool scene_3D::save_cost_heatmap(string filename)
+  {
+    t_color_buffer heatmap;
+    double minimum, maximum, value;
+    unsigned int i;
+    unsigned char r, g, b;
+    bool result;
+
+    if (this->cost_map.size() != this->resolution[0] * this->resolution[1] || this->cost_map.size() == 0)
+      return false;
+
+    minimum = log(this->cost_map[0] + 1);
+    maximum = minimum;
+
+    for (i = 1; i < this->cost_map.size(); i++)
+      {
+        value = log(this->cost_map[i] + 1);
+        minimum = value < minimum ? value : minimum;
+        maximum = value > maximum ? value : maximum;
+      }
+
+    color_buffer_init(&heatmap,this->resolution[0],this->resolution[1]);
+
+    for (i = 0; i < this->cost_map.size(); i++)
+      {
+        value = maximum > minimum ? (log(this->cost_map[i] + 1) - minimum) / (maximum - minimum) : 0;
+        heat_color(value,&r,&g,&b);
+        color_buffer_set_pixel(&heatmap,i % this->resolution[0],i / this->resolution[0],r,g,b);
+      }
+
+    result = color_buffer_save_to_png(&heatmap,(char *) filename.c_str());
+    color_buffer_destroy(&heatmap);
+    return result;
   }
 
 double string_to_double(string what, size_t *end_position)
@@ -689,12 +1699,43 @@ void parse_obj_line(string line,float data[4][3])
       }
 }
 
+static string obj_statement_argument(string line)
+
+  /**<
+    Gets the argument of obj/mtl statement (e.g. the file name in
+    "mtllib file.mtl"), i.e. the rest of the line after the keyword
+    without the surrounding whitespace.
+   */
+
+  {
+    size_t start, end;
+
+    start = line.find_first_of(" \t");
+
+    if (start == string::npos)
+      return "";
+
+    start = line.find_first_not_of(" \t",start);
+    end = line.find_last_not_of(" \t\r\n");
+
+    if (start == string::npos || end == string::npos || end < start)
+      return "";
+
+    return line.substr(start,end - start + 1);
+  }
+
 bool mesh_3D::load_obj(string filename)
   {
+    TRACE_ZONE("load obj","load");
+
     ifstream obj_file(filename.c_str());
-    string line;
+    string line, directory, name;
     float obj_line_data[4][3];
     point_3D helper_point;
+    unsigned short current_material;
+    bool uses_materials;
+    size_t separator;
+    unsigned int n;
 
     vector<point_3D> normals;
     vector<point_3D> texture_vertices;
@@ -704,11 +1745,47 @@ bool mesh_3D::load_obj(string filename)
 
     this->vertices.clear();
     this->triangle_indices.clear();
+    this->materials.clear();
+    this->triangle_materials.clear();
+    this->material_names.clear();
+    this->material_files.clear();
+    this->mapping.reset();
+
+    separator = filename.find_last_of("/\\");
+    directory = separator == string::npos ? "" : filename.substr(0,separator + 1);
+    current_material = MESH_DEFAULT_MATERIAL;
+    uses_materials = false;
 
     while (getline(obj_file,line))
       {
         switch (line[0])
           {
+            case 'm':
+              if (line.compare(0,7,"mtllib ") == 0)
+                {
+                  this->material_files.push_back(directory + obj_statement_argument(line));
+                  this->load_mtl(this->material_files.back());
+                }
+
+              break;
+
+            case 'u':
+              if (line.compare(0,7,"usemtl ") == 0)
+                {
+                  name = obj_statement_argument(line);
+                  current_material = MESH_DEFAULT_MATERIAL;
+
+                  for (n = 0; n < this->material_names.size(); n++)
+                    if (this->material_names[n] == name)
+                      {
+                        current_material = n;
+                        uses_materials = true;
+                        break;
+                      }
+                }
+
+              break;
+
             case 'v':
               if (line[1] == 'n')        // normal vertex
                 {
@@ -759,6 +1836,8 @@ bool mesh_3D::load_obj(string filename)
                   this->triangle_indices.push_back(indices[1]);
                   this->triangle_indices.push_back(indices[2]);
 
+                  this->triangle_materials.push_back(current_material);
+
                   faces = 3;     // 3 vertex face
                 }
               else
@@ -771,6 +1850,9 @@ bool mesh_3D::load_obj(string filename)
                   this->triangle_indices.push_back(indices[2]);
                   this->triangle_indices.push_back(indices[3]);
 
+                  this->triangle_materials.push_back(current_material);
+                  this->triangle_materials.push_back(current_material);
+
                   faces = 4;     // 4 vertex face
                 }
 
@@ -803,90 +1885,617 @@ bool mesh_3D::load_obj(string filename)
       }
 
     obj_file.close();
+
+    if (!uses_materials)      // all triangles use mat, don't waste memory
+      this->triangle_materials.clear();
+
     this->update_bounding_sphere();
     return true;
   }
 
-void light_3D::set_intensity(double intensity)
+bool mesh_3D::load_mtl(string filename)
   {
-    this->intensity = intensity;
-  }
+    TRACE_ZONE("load mtl","load");
 
-void mesh_3D::print()
-  {
-    unsigned int i, counter;
+    ifstream mtl_file(filename.c_str());
+    string line, keyword;
+    material *current;
+    double values[3];
+    double diffuse_average;
+    unsigned int i;
 
-    cout << "vertices: " << endl;
+    if (!mtl_file.is_open())
+      return false;
 
-    for (i = 0; i < this->vertices.size(); i++)
-      cout << "  " << i << ": (" << this->vertices[i].position.x << ", "
-        << this->vertices[i].position.y << ", " << this->vertices[i].position.z << ") ("
-        << this->vertices[i].texture_coords[0] << ", " << this->vertices[i].texture_coords[1]
-        << ") (" << this->vertices[i].normal.x << ", " << this->vertices[i].normal.y << ", "
-        << this->vertices[i].normal.z << ")" << endl;
+    current = 0;
 
-    counter = 0;
+    while (getline(mtl_file,line))
+      {
+        istringstream words(line);
 
-    cout << "triangles: " << endl;
+        if (!(words >> keyword))
+          continue;
 
-    for (i = 0; i < this->triangle_indices.size(); i++)
-      {
-        counter++;
+        if (keyword == "newmtl")
+          {
+            if (this->materials.size() >= MESH_DEFAULT_MATERIAL)
+              break;
 
-        cout << "  " << this->triangle_indices[i] << " ";
+            this->materials.push_back(this->mat);
+            this->material_names.push_back(obj_statement_argument(line));
+            current = &this->materials[this->materials.size() - 1];
+            current->defined = 0;
+            continue;
+          }
 
-        if (counter >= 3)
+        if (current == 0)
+          continue;
+
+        for (i = 0; i < 3; i++)
+          if (!(words >> values[i]))
+            values[i] = i == 0 ? 0 : values[0];   // single value means gray
+
+        if (keyword == "Kd")
           {
-            cout << endl;
-            counter = 0;
+            current->surface_color.red = saturate_int(values[0] * 255,0,255);
+            current->surface_color.green = saturate_int(values[1] * 255,0,255);
+            current->surface_color.blue = saturate_int(values[2] * 255,0,255);
+            current->defined |= MATERIAL_SURFACE_COLOR;
+          }
+        else if (keyword == "Ka")
+          {
+            // the ambient color is relative to the diffuse one here
+            diffuse_average = (current->surface_color.red + current->surface_color.green + current->surface_color.blue) / (3 * 255.0);
+
+            if (diffuse_average > 0)
+              current->ambient_intensity = (values[0] + values[1] + values[2]) / 3.0 / diffuse_average;
+
+            current->ambient_intensity = current->ambient_intensity > 1 ? 1 : current->ambient_intensity;
+            current->defined |= MATERIAL_AMBIENT;
+          }
+        else if (keyword == "Ks")
+          {
+            current->specular_intensity = (values[0] + values[1] + values[2]) / 3.0;
+            current->defined |= MATERIAL_SPECULAR;
+          }
+        else if (keyword == "Ns")
+          {
+            current->specular_exponent = values[0];
+            current->defined |= MATERIAL_SPECULAR_EXPONENT;
+          }
+        else if (keyword == "d" || keyword == "Tr")
+          {
+            current->transparency = keyword == "d" ? 1.0 - values[0] : values[0];
+            current->defined |= MATERIAL_TRANSPARENCY;
+          }
+        else if (keyword == "Ni")
+          {
+            current->refractive_index = values[0];
+            current->defined |= MATERIAL_REFRACTIVE_INDEX;
+          }
+        else if (keyword == "illum")
+          {
+            if (values[0] == 3 || values[0] == 5 || values[0] == 7)   // reflective models
+              {
+                current->reflection = current->specular_intensity;
+                current->defined |= MATERIAL_REFLECTION;
+              }
           }
       }
+
+    mtl_file.close();
+    return true;
   }
 
-color multiply_colors(color color1, color color2)
+material mesh_3D::get_triangle_material(unsigned int triangle)
   {
-    color final_color;
+    unsigned short id;
+    material result;
 
-    final_color.red = (color1.red / 255.0 * color2.red / 255.0) * 255;
-    final_color.green = (color1.green / 255.0 * color2.green / 255.0) * 255;
-    final_color.blue = (color1.blue / 255.0 * color2.blue / 255.0) * 255;
+    if (triangle >= this->triangle_materials.size())
+      return this->mat;
 
-    return final_color;
+    id = this->triangle_materials[triangle];
+
+    if (id >= this->materials.size())
+      return this->mat;
+
+    const material &entry = this->materials[id];
+
+    result = this->mat;
+
+    if (entry.defined & MATERIAL_SURFACE_COLOR)
+      result.surface_color = entry.surface_color;
+
+    if (entry.defined & MATERIAL_AMBIENT)
+      result.ambient_intensity = entry.ambient_intensity;
+
+    if (entry.defined & MATERIAL_SPECULAR)
+      result.specular_intensity = entry.specular_intensity;
+
+    if (entry.defined & MATERIAL_SPECULAR_EXPONENT)
+      result.specular_exponent = entry.specular_exponent;
+
+    if (entry.defined & MATERIAL_REFLECTION)
+      result.reflection = entry.reflection;
+
+    if (entry.defined & MATERIAL_TRANSPARENCY)
+      result.transparency = entry.transparency;
+
+    if (entry.defined & MATERIAL_REFRACTIVE_INDEX)
+      result.refractive_index = entry.refractive_index;
+
+    return result;
+  }
+
+mapped_file::mapped_file()
+  {
+    this->data = 0;
+    this->size = 0;
+  }
+
+mapped_file::~mapped_file()
+  {
+    this->unmap();
+  }
+
+bool mapped_file::map(string filename)
+  {
+    this->unmap();
+
+#ifndef _WIN32
+    int file_descriptor;
+    struct stat file_info;
+    void *address;
+
+    file_descriptor = open(filename.c_str(),O_RDONLY);
+
+    if (file_descriptor < 0)
+      return false;
+
+    if (fstat(file_descriptor,&file_info) != 0 || file_info.st_size <= 0)
+      {
+        close(file_descriptor);
+        return false;
+      }
+
+    // private mapping: writes (e.g. mesh transformations) only copy the touched pages
+    address = mmap(0,file_info.st_size,PROT_READ | PROT_WRITE,MAP_PRIVATE,file_descriptor,0);
+    close(file_descriptor);
+
+    if (address == MAP_FAILED)
+      return false;
+
+    this->data = address;
+    this->size = file_info.st_size;
+#else
+    FILE *file;
+    long length;
+
+    file = fopen(filename.c_str(),"rb");
+
+    if (file == NULL)
+      return false;
+
+    fseek(file,0,SEEK_END);
+    length = ftell(file);
+    fseek(file,0,SEEK_SET);
+
+    if (length <= 0)
+      {
+        fclose(file);
+        return false;
+      }
+
+    this->data = malloc(length);
+
+    if (this->data == NULL || fread(this->data,1,length,file) != (size_t) length)
+      {
+        fclose(file);
+        free(this->data);
+        this->data = 0;
+        return false;
+      }
+
+    fclose(file);
+    this->size = length;
+#endif
+
+    return true;
+  }
+
+void mapped_file::unmap()
+  {
+    if (this->data == 0)
+      return;
+
+#ifndef _WIN32
+    munmap(this->data,this->size);
+#else
+    free(this->data);
+#endif
+
+    this->data = 0;
+    this->size = 0;
+  }
+
+void *mapped_file::get_data()
+  {
+    return this->data;
+  }
+
+size_t mapped_file::get_size()
+  {
+    return this->size;
+  }
+
+long long file_modification_time(string filename)
+  {
+    struct stat file_info;
+
+    if (stat(filename.c_str(),&file_info) != 0)
+      return -1;
+
+#if defined(__APPLE__)
+    return file_info.st_mtimespec.tv_sec * 1000000000LL + file_info.st_mtimespec.tv_nsec;
+#elif defined(__linux__)
+    return file_info.st_mtim.tv_sec * 1000000000LL + file_info.st_mtim.tv_nsec;
+#else
+    return file_info.st_mtime * 1000000000LL;
+#endif
+  }
+
+static mesh_cache_source make_cache_source(string filename)
+  {
+    struct stat file_info;
+    mesh_cache_source result;
+
+    result.modification_time = file_modification_time(filename);
+    result.size = stat(filename.c_str(),&file_info) == 0 ? (int64_t) file_info.st_size : -1;
+    result.name_length = filename.size();
+
+    return result;
+  }
+
+static uint64_t align_offset(uint64_t offset)
+  {
+    return (offset + MESH_CACHE_ALIGNMENT - 1) / MESH_CACHE_ALIGNMENT * MESH_CACHE_ALIGNMENT;
+  }
+
+static bool cache_range_fits(uint64_t offset, uint64_t count, size_t element_size, size_t file_size)
+  {
+    // written so that no sum or product can wrap on a corrupt header
+
+    return offset <= file_size && offset % MESH_CACHE_ALIGNMENT == 0 &&
+      count <= (file_size - offset) / element_size;
+  }
+
+bool mesh_3D::save_binary(string filename, bool store_bounding_sphere, string source_filename)
+  {
+    TRACE_ZONE("save mesh cache","load");
+
+    mesh_cache_header header;
+    uint64_t position;
+    char padding[MESH_CACHE_ALIGNMENT];
+    unsigned int i;
+    vector<string> sources;
+    mesh_cache_source source;
+
+    if (source_filename.length() != 0)
+      sources.push_back(source_filename);
+
+    sources.insert(sources.end(),this->material_files.begin(),this->material_files.end());
+
+    if (this->triangle_materials.size() != 0 && this->triangle_materials.size() != this->triangle_indices.size() / 3)
+      return false;
+
+    ofstream file(filename.c_str(),ios::out | ios::binary | ios::trunc);
+
+    if (!file.is_open())
+      return false;
+
+    memset(&header,0,sizeof(header));
+    memset(padding,0,sizeof(padding));
+    memcpy(header.magic,MESH_CACHE_MAGIC,sizeof(MESH_CACHE_MAGIC));
+
+    header.version = MESH_CACHE_VERSION;
+    header.flags = (store_bounding_sphere ? MESH_CACHE_BOUNDING_SPHERE : 0) |
+      (source_filename.length() != 0 ? MESH_CACHE_OBJ_SOURCE : 0);
+    header.vertex_size = sizeof(vertex_3D);
+    header.index_size = sizeof(unsigned int);
+    header.vertex_count = this->vertices.size();
+    header.vertex_offset = align_offset(sizeof(header));
+    header.index_count = this->triangle_indices.size();
+    header.index_offset = align_offset(header.vertex_offset + header.vertex_count * sizeof(vertex_3D));
+    header.material_count = this->materials.size();
+    header.material_offset = align_offset(header.index_offset + header.index_count * sizeof(unsigned int));
+    header.triangle_material_count = this->triangle_materials.size();
+    header.triangle_material_offset = align_offset(header.material_offset + header.material_count * sizeof(material));
+    header.source_count = sources.size();
+    header.source_offset = header.triangle_material_offset + header.triangle_material_count * sizeof(unsigned short);
+
+    for (i = 0; i < this->material_names.size(); i++)   // the names are before the source records
+      header.source_offset += this->material_names[i].size() + 1;
+    header.bounding_sphere_center[0] = this->bounding_sphere_center.x;
+    header.bounding_sphere_center[1] = this->bounding_sphere_center.y;
+    header.bounding_sphere_center[2] = this->bounding_sphere_center.z;
+    header.bounding_sphere_radius = this->bounding_sphere_radius;
+
+    file.write((char *) &header,sizeof(header));
+    position = sizeof(header);
+
+    file.write(padding,header.vertex_offset - position);
+    file.write((char *) this->vertices.data(),header.vertex_count * sizeof(vertex_3D));
+    position = header.vertex_offset + header.vertex_count * sizeof(vertex_3D);
+
+    file.write(padding,header.index_offset - position);
+    file.write((char *) this->triangle_indices.data(),header.index_count * sizeof(unsigned int));
+    position = header.index_offset + header.index_count * sizeof(unsigned int);
+
+    file.write(padding,header.material_offset - position);
+    file.write((char *) this->materials.data(),header.material_count * sizeof(material));
+    position = header.material_offset + header.material_count * sizeof(material);
+
+    file.write(padding,header.triangle_material_offset - position);
+    file.write((char *) this->triangle_materials.data(),header.triangle_material_count * sizeof(unsigned short));
+
+    // names are not needed for rendering, they are stored as text at the end
+    for (i = 0; i < this->material_names.size(); i++)
+      file.write(this->material_names[i].c_str(),this->material_names[i].size() + 1);
+
+    for (i = 0; i < sources.size(); i++)
+      {
+        source = make_cache_source(sources[i]);
+        file.write((char *) &source,sizeof(source));
+        file.write(sources[i].c_str(),sources[i].size());
+      }
+
+    file.close();
+    return !file.fail();
   }
 
-bool scene_3D::cast_shadow_ray(point_3D position, light_3D light, double threshold, double range)
+bool mesh_3D::load_binary(string filename, string source_filename)
+  {
+    TRACE_ZONE("load mesh cache","load");
+
+    shared_ptr<mapped_file> file(new mapped_file());
+    mesh_cache_header *header;
+    char *data, *name;
+    uint64_t names_offset, position, j;
+    unsigned int i;
+    vector<string> sources;
+    mesh_cache_source source, current;
+
+    if (!file->map(filename) || file->get_size() < sizeof(mesh_cache_header))
+      return false;
+
+    data = (char *) file->get_data();
+    header = (mesh_cache_header *) data;
+
+    if (memcmp(header->magic,MESH_CACHE_MAGIC,sizeof(MESH_CACHE_MAGIC)) != 0 ||
+        header->version != MESH_CACHE_VERSION ||
+        header->vertex_size != sizeof(vertex_3D) ||
+        header->index_size != sizeof(unsigned int))
+      return false;
+
+    if (!cache_range_fits(header->vertex_offset,header->vertex_count,sizeof(vertex_3D),file->get_size()) ||
+        !cache_range_fits(header->index_offset,header->index_count,sizeof(unsigned int),file->get_size()) ||
+        header->index_count % 3 != 0)
+      return false;
+
+    if ((header->triangle_material_count != 0 && header->triangle_material_count != header->index_count / 3) ||
+        header->material_count >= MESH_DEFAULT_MATERIAL ||
+        !cache_range_fits(header->material_offset,header->material_count,sizeof(material),file->get_size()) ||
+        !cache_range_fits(header->triangle_material_offset,header->triangle_material_count,sizeof(unsigned short),
+          file->get_size()))
+      return false;
+
+    names_offset = header->triangle_material_offset + header->triangle_material_count * sizeof(unsigned short);
+
+    for (j = 0; j < header->index_count; j++)   // a stale or corrupt cache must not index outside the mesh
+      if (((unsigned int *) (data + header->index_offset))[j] >= header->vertex_count)
+        return false;
+
+    for (j = 0; j < header->triangle_material_count; j++)
+      {
+        unsigned short material_id = ((unsigned short *) (data + header->triangle_material_offset))[j];
+
+        if (material_id >= header->material_count && material_id != MESH_DEFAULT_MATERIAL)
+          return false;
+      }
+
+    position = header->source_offset;
+
+    for (i = 0; i < header->source_count; i++)   // the records are unaligned, they are copied
+      {
+        if (position > file->get_size() || sizeof(source) > file->get_size() - position)
+          return false;
+
+        memcpy(&source,data + position,sizeof(source));
+        position += sizeof(source);
+
+        if (source.name_length > file->get_size() - position)
+          return false;
+
+        sources.push_back(string(data + position,source.name_length));
+        position += source.name_length;
+
+        if (source_filename.length() != 0)
+          {
+            current = make_cache_source(sources.back());
+
+            if (current.modification_time != source.modification_time || current.size != source.size)
+              return false;
+          }
+      }
+
+    if (source_filename.length() != 0 &&
+        (!(header->flags & MESH_CACHE_OBJ_SOURCE) || sources.size() == 0 || sources[0] != source_filename))
+      return false;
+
+    this->vertices.set_external((vertex_3D *) (data + header->vertex_offset),header->vertex_count);
+    this->triangle_indices.set_external((unsigned int *) (data + header->index_offset),header->index_count);
+    this->materials.set_external((material *) (data + header->material_offset),header->material_count);
+    this->triangle_materials.set_external((unsigned short *) (data + header->triangle_material_offset),
+      header->triangle_material_count);
+    this->mapping = file;
+
+    this->material_files.assign(sources.begin() + ((header->flags & MESH_CACHE_OBJ_SOURCE) && sources.size() != 0 ? 1 : 0),
+      sources.end());
+
+    this->material_names.clear();
+    name = data + names_offset;
+
+    for (i = 0; i < header->material_count; i++)
+      {
+        size_t length = strnlen(name,data + file->get_size() - name);
+        this->material_names.push_back(string(name,length));
+        name += length + (name + length < data + file->get_size() ? 1 : 0);
+      }
+
+    if (header->flags & MESH_CACHE_BOUNDING_SPHERE)
+      {
+        this->bounding_sphere_center.x = header->bounding_sphere_center[0];
+        this->bounding_sphere_center.y = header->bounding_sphere_center[1];
+        this->bounding_sphere_center.z = header->bounding_sphere_center[2];
+        this->bounding_sphere_radius = header->bounding_sphere_radius;
+      }
+    else
+      this->update_bounding_sphere();
+
+    return true;
+  }
+
+bool mesh_3D::load_obj_cached(string filename)
+  {
+    string cache_filename = filename + MESH_CACHE_EXTENSION;
+
+    if (this->load_binary(cache_filename,filename))
+      return true;
+
+    if (!this->load_obj(filename))
+      return false;
+
+    this->save_binary(cache_filename,true,filename);   // not being able to write the cache is not an error
+    return true;
+  }
+
+void light_3D::set_intensity(double intensity)
+  {
+    this->intensity = intensity;
+  }
+
+void mesh_3D::print()
+  {
+    unsigned int i, counter;
+
+    cout << "vertices: " << endl;
+
+    for (i = 0; i < this->vertices.size(); i++)
+      cout << "  " << i << ": (" << this->vertices[i].position.x << ", "
+        << this->vertices[i].position.y << ", " << this->vertices[i].position.z << ") ("
+        << this->vertices[i].texture_coords[0] << ", " << this->vertices[i].texture_coords[1]
+        << ") (" << this->vertices[i].normal.x << ", " << this->vertices[i].normal.y << ", "
+        << this->vertices[i].normal.z << ")" << endl;
+
+    counter = 0;
+
+    cout << "triangles: " << endl;
+
+    for (i = 0; i < this->triangle_indices.size(); i++)
+      {
+        counter++;
+
+        cout << "  " << this->triangle_indices[i] << " ";
+
+        if (counter >= 3)
+          {
+            cout << endl;
+            counter = 0;
+          }
+      }
+  }
+
+color multiply_colors(color color1, color color2)
+  {
+    color final_color;
+
+    final_color.red = (color1.red / 255.0 * color2.red / 255.0) * 255;
+    final_color.green = (color1.green / 255.0 * color2.green / 255.0) * 255;
+    final_color.blue = (color1.blue / 255.0 * color2.blue / 255.0) * 255;
+
+    return final_color;
+  }
+
+bool scene_3D::cast_shadow_ray(point_3D position, point_3D light_position, double threshold,
+  shadow_occluder *occluder)
   {
     unsigned int i, j;
     triangle_3D triangle;
     double a,b,c,t,distance;
     point_3D intersection;
-    point_3D light_position;
-    light_position = light.get_position();
 
-    light_position.x += random_double() * range;
-    light_position.y += random_double() * range;
-    light_position.z += random_double() * range;
+    PHASE_SCOPE(PHASE_TRAVERSAL);
 
     line_3D line(position,light_position);
 
+    COUNT_STATISTIC(shadow_rays);
+
+    if (occluder != 0 && occluder->mesh >= 0)
+      {
+        mesh_3D *mesh = this->meshes[occluder->mesh];
+
+        triangle.a = mesh->vertices[mesh->triangle_indices[occluder->triangle]].position;
+        triangle.b = mesh->vertices[mesh->triangle_indices[occluder->triangle + 1]].position;
+        triangle.c = mesh->vertices[mesh->triangle_indices[occluder->triangle + 2]].position;
+
+        COUNT_STATISTIC(shadow_cache_tests);
+        COUNT_STATISTIC(triangle_tests);
+
+        if (line.intersects_triangle(triangle,a,b,c,t))
+          {
+            COUNT_STATISTIC(triangle_hits);
+            line.get_point(t,intersection);
+
+            if (point_distance(position,intersection) > threshold)
+              {
+                COUNT_STATISTIC(shadow_cache_hits);
+                return false;
+              }
+          }
+      }
+
     for (i = 0; i < this->meshes.size(); i++)
       {
+        COUNT_STATISTIC(bounding_sphere_tests);
+
         if (!line.intersects_sphere(this->meshes[i]->bounding_sphere_center,this->meshes[i]->bounding_sphere_radius))
           continue;
 
+        COUNT_STATISTIC(bounding_sphere_passes);
+
         for (j = 0; j < this->meshes[i]->triangle_indices.size(); j += 3)
           {
             triangle.a = this->meshes[i]->vertices[this->meshes[i]->triangle_indices[j]].position;
             triangle.b = this->meshes[i]->vertices[this->meshes[i]->triangle_indices[j + 1]].position;
             triangle.c = this->meshes[i]->vertices[this->meshes[i]->triangle_indices[j + 2]].position;
 
+            COUNT_STATISTIC(triangle_tests);
+
             if (line.intersects_triangle(triangle,a,b,c,t))
               {
+                COUNT_STATISTIC(triangle_hits);
                 line.get_point(t,intersection);
                 distance = point_distance(position,intersection);
 
                 if (distance > threshold)
                   {
+                    if (occluder != 0)
+                      {
+                        occluder->mesh = i;
+                        occluder->triangle = j;
+                      }
+
                     return false;
                   }
               }
@@ -904,185 +2513,412 @@ point_3D line_3D::get_vector_to_origin()
     this->get_point(1,b);
     substract_vectors(b,a,result);
 
-    normalize(result);
-    return result;
+    normalize(result);
+    return result;
+  }
+
+void alter_vector(point_3D &what, double range)
+  {
+    what.x += (random_double() * 2 - 1) * range;
+    what.y += (random_double() * 2 - 1) * range;
+    what.z += (random_double() * 2 - 1) * range;
+    normalize(what);
+  }
+
+static double texture_mip_level(unsigned int width, unsigned int height, triangle_3D triangle, double *texture_coords_a,
+  double *texture_coords_b, double *texture_coords_c, double footprint_width, point_3D normal, point_3D direction)
+
+  /**<
+    Computes the mipmap level for given ray footprint width at the
+    intersection with given triangle, from the ratio of the triangle
+    area in texels and in the scene.
+   */
+
+  {
+    double texel_area, world_area, cosine;
+    point_3D edge1, edge2, cross;
+
+    substract_vectors(triangle.a,triangle.b,edge1);
+    substract_vectors(triangle.a,triangle.c,edge2);
+    cross_product(edge1,edge2,cross);
+    world_area = vector_length(cross);   // both areas are doubled, it cancels out
+
+    texel_area = fabs((texture_coords_b[0] - texture_coords_a[0]) * (texture_coords_c[1] - texture_coords_a[1]) -
+      (texture_coords_c[0] - texture_coords_a[0]) * (texture_coords_b[1] - texture_coords_a[1])) *
+      width * height;
+
+    cosine = fabs(dot_product(normal,direction));
+
+    if (world_area <= 0 || texel_area <= 0 || footprint_width <= 0)
+      return 0;
+
+    if (cosine < 0.01)
+      cosine = 0.01;
+
+    return 0.5 * log2(texel_area / world_area) + log2(footprint_width / cosine);
+  }
+
+bool scene_3D::find_nearest_hit(line_3D line, double threshold, ray_cone cone, ray_hit &hit)
+  {
+    unsigned int k, l, nearest_mesh, nearest_triangle;
+    triangle_3D triangle;
+    double depth, t;
+    double barycentric_a, barycentric_b, barycentric_c;
+    point_3D starting_point;
+
+    PHASE_SCOPE(PHASE_TRAVERSAL);
+
+    line.get_point(0,starting_point);
+
+    depth = 99999999;
+    hit.found = false;
+    nearest_mesh = 0;
+    nearest_triangle = 0;
+
+    for (k = 0; k < this->meshes.size(); k++)
+      {
+        COUNT_STATISTIC(bounding_sphere_tests);
+
+        if (!line.intersects_sphere(this->meshes[k]->bounding_sphere_center,this->meshes[k]->bounding_sphere_radius))
+          continue;
+
+        COUNT_STATISTIC(bounding_sphere_passes);
+
+        for (l = 0; l < this->meshes[k]->triangle_indices.size(); l += 3)
+          {
+            triangle.a = this->meshes[k]->vertices[this->meshes[k]->triangle_indices[l]].position;
+            triangle.b = this->meshes[k]->vertices[this->meshes[k]->triangle_indices[l + 1]].position;
+            triangle.c = this->meshes[k]->vertices[this->meshes[k]->triangle_indices[l + 2]].position;
+
+            COUNT_STATISTIC(triangle_tests);
+
+            if (line.intersects_triangle(triangle,barycentric_a,barycentric_b,barycentric_c,t))
+              {
+                COUNT_STATISTIC(triangle_hits);
+
+                point_3D intersection;
+                line.get_point(t,intersection);
+                double distance = point_distance(starting_point,intersection);
+
+                if (distance < depth && distance > threshold)  // depth test
+                  {
+                    depth = distance;
+                    nearest_mesh = k;
+                    nearest_triangle = l;
+
+                    hit.found = true;
+                    hit.distance = distance;
+                    hit.position = intersection;
+                    hit.barycentric[0] = barycentric_a;
+                    hit.barycentric[1] = barycentric_b;
+                    hit.barycentric[2] = barycentric_c;
+                  }
+              }
+          }
+      }
+
+    if (!hit.found)
+      return false;
+
+    // surface attributes are only interpolated for the nearest hit
+
+    this->complete_hit(line,cone,nearest_mesh,nearest_triangle,hit);
+    return true;
+  }
+
+bool scene_3D::resolve_visible_hit(line_3D line, double threshold, ray_cone cone, visibility_sample sample, ray_hit &hit)
+  {
+    triangle_3D triangle;
+    double t;
+    point_3D starting_point;
+    mesh_3D *mesh;
+
+    PHASE_SCOPE(PHASE_TRAVERSAL);
+
+    hit.found = false;
+
+    if (sample.mesh == VISIBILITY_AMBIGUOUS)
+      return false;
+
+    if (sample.mesh < 0)
+      return true;
+
+    mesh = this->meshes[sample.mesh];
+
+    triangle.a = mesh->vertices[mesh->triangle_indices[sample.triangle]].position;
+    triangle.b = mesh->vertices[mesh->triangle_indices[sample.triangle + 1]].position;
+    triangle.c = mesh->vertices[mesh->triangle_indices[sample.triangle + 2]].position;
+
+    COUNT_STATISTIC(triangle_tests);
+
+    if (!line.intersects_triangle(triangle,hit.barycentric[0],hit.barycentric[1],hit.barycentric[2],t))
+      return false;
+
+    COUNT_STATISTIC(triangle_hits);
+
+    line.get_point(0,starting_point);
+    line.get_point(t,hit.position);
+    hit.distance = point_distance(starting_point,hit.position);
+
+    if (hit.distance <= threshold)
+      return false;
+
+    hit.found = true;
+    this->complete_hit(line,cone,sample.mesh,sample.triangle,hit);
+    return true;
+  }
+
+void scene_3D::complete_hit(line_3D &line, ray_cone cone, unsigned int mesh_index, unsigned int triangle_index, ray_hit &hit)
+  {
+    unsigned int l;
+    triangle_3D triangle;
+    double *texture_coords_a, *texture_coords_b, *texture_coords_c;
+    double barycentric_a, barycentric_b, barycentric_c;
+    point_3D normal_a, normal_b, normal_c;
+    mesh_3D *mesh;
+
+    PHASE_SCOPE(PHASE_SHADING);
+
+    mesh = this->meshes[mesh_index];
+    l = triangle_index;
+    barycentric_a = hit.barycentric[0];
+    barycentric_b = hit.barycentric[1];
+    barycentric_c = hit.barycentric[2];
+
+    hit.mesh = mesh_index;
+    hit.triangle = l / 3;
+    hit.incoming = line.get_vector_to_origin();
+
+    triangle.a = mesh->vertices[mesh->triangle_indices[l]].position;
+    triangle.b = mesh->vertices[mesh->triangle_indices[l + 1]].position;
+    triangle.c = mesh->vertices[mesh->triangle_indices[l + 2]].position;
+
+    texture_coords_a = mesh->vertices[mesh->triangle_indices[l]].texture_coords;
+    texture_coords_b = mesh->vertices[mesh->triangle_indices[l + 1]].texture_coords;
+    texture_coords_c = mesh->vertices[mesh->triangle_indices[l + 2]].texture_coords;
+
+    normal_a = mesh->vertices[mesh->triangle_indices[l]].normal;
+    normal_b = mesh->vertices[mesh->triangle_indices[l + 1]].normal;
+    normal_c = mesh->vertices[mesh->triangle_indices[l + 2]].normal;
+
+    hit.normal.x = barycentric_a * normal_a.x + barycentric_b * normal_b.x + barycentric_c * normal_c.x;
+    hit.normal.y = barycentric_a * normal_a.y + barycentric_b * normal_b.y + barycentric_c * normal_c.y;
+    hit.normal.z = barycentric_a * normal_a.z + barycentric_b * normal_b.z + barycentric_c * normal_c.z;
+    normalize(hit.normal);  // interpolation breaks normalization
+
+    if (!mesh->use_3D_texture && mesh->get_paged_texture() != 0)            // out-of-core 2d texture
+      {
+        PHASE_SCOPE(PHASE_TEXTURE);
+        paged_texture *texture = mesh->get_paged_texture();
+        double u, v, level;
+
+        u = barycentric_a * texture_coords_a[0] + barycentric_b * texture_coords_b[0] + barycentric_c * texture_coords_c[0];
+        v = barycentric_a * texture_coords_a[1] + barycentric_b * texture_coords_b[1] + barycentric_c * texture_coords_c[1];
+
+        level = this->texture_filtering ? texture_mip_level(texture->get_width(),texture->get_height(),triangle,
+          texture_coords_a,texture_coords_b,texture_coords_c,cone.width + cone.spread_angle * hit.distance,hit.normal,
+          hit.incoming) : 0;
+
+        texture->sample(u,v,level,&hit.texture_color.red,&hit.texture_color.green,&hit.texture_color.blue);
+      }
+    else if (!mesh->use_3D_texture && mesh->get_texture() != 0)             // 2d texture
+      {
+        PHASE_SCOPE(PHASE_TEXTURE);
+        double u,v;
+
+        u = barycentric_a * texture_coords_a[0] + barycentric_b * texture_coords_b[0] + barycentric_c * texture_coords_c[0];
+        v = barycentric_a * texture_coords_a[1] + barycentric_b * texture_coords_b[1] + barycentric_c * texture_coords_c[1];
+
+        t_color_buffer *texture = mesh->get_texture();
+
+        if (this->texture_filtering)
+          {
+            double level = texture_mip_level(texture->width,texture->height,triangle,texture_coords_a,texture_coords_b,texture_coords_c,
+              cone.width + cone.spread_angle * hit.distance,hit.normal,hit.incoming);
+
+            if (texture->tiled != NULL)
+              color_buffer_sample_tiled(texture,u,v,level,&hit.texture_color.red,&hit.texture_color.green,&hit.texture_color.blue);
+            else
+              color_buffer_sample_trilinear(texture,u,v,level,&hit.texture_color.red,&hit.texture_color.green,&hit.texture_color.blue);
+          }
+        else if (texture->tiled != NULL)
+          color_buffer_get_tiled_pixel(texture,u * texture->width,v * texture->height,&hit.texture_color.red,&hit.texture_color.green,&hit.texture_color.blue);
+        else
+          color_buffer_get_pixel(texture,u * texture->width,v * texture->height,&hit.texture_color.red,&hit.texture_color.green,&hit.texture_color.blue);
+      }
+    else if (mesh->use_3D_texture && mesh->get_texture_3D() != 0)          // 3d texture
+      {
+        PHASE_SCOPE(PHASE_TEXTURE);
+        hit.texture_color = mesh->get_texture_3D()->get_color(hit.position.x,hit.position.y,hit.position.z);
+      }
+    else                                                                    // mesh color
+      {
+        hit.texture_color.red = 255;
+        hit.texture_color.green = 255;
+        hit.texture_color.blue = 255;
+      }
+  }
+
+static void update_color_range(color sample, unsigned int index, color &minimum, color &maximum)
+
+  /**<
+    Extends the range of the probe colors by the sample, the range is
+    reset by the first sample (index 0).
+   */
+
+  {
+    if (index == 0)
+      {
+        minimum = sample;
+        maximum = sample;
+        return;
+      }
+
+    minimum.red = min(minimum.red,sample.red);
+    minimum.green = min(minimum.green,sample.green);
+    minimum.blue = min(minimum.blue,sample.blue);
+    maximum.red = max(maximum.red,sample.red);
+    maximum.green = max(maximum.green,sample.green);
+    maximum.blue = max(maximum.blue,sample.blue);
   }
 
-void alter_vector(point_3D &what, double range)
+static bool colors_agree(color minimum, color maximum, unsigned int threshold)
   {
-    what.x += (random_double() * 2 - 1) * range;
-    what.y += (random_double() * 2 - 1) * range;
-    what.z += (random_double() * 2 - 1) * range;
-    normalize(what);
+    return maximum.red - minimum.red <= (int) threshold && maximum.green - minimum.green <= (int) threshold &&
+      maximum.blue - minimum.blue <= (int) threshold;
   }
 
-color scene_3D::cast_ray(line_3D line, double threshold, unsigned int recursion_depth)
+color scene_3D::shade_hit(const ray_hit &hit, unsigned int recursion_depth, ray_cone cone)
   {
-    unsigned int k, l, m;
-    triangle_3D triangle;
-    color final_color, helper_color, add_color;
-    double depth, t;
-    double *texture_coords_a, *texture_coords_b, *texture_coords_c;
-    double barycentric_a, barycentric_b, barycentric_c;
-    point_3D starting_point;
-    point_3D normal,normal_a,normal_b,normal_c;
-    point_3D reflection_vector, incoming_vector_reverse;
+    unsigned int m;
+    color final_color, helper_color, add_color, probe_min, probe_max;
+    point_3D reflection_vector;
     material mat;
     int color_sum[3];
 
-    line.get_point(0,starting_point);
+    PHASE_SCOPE(PHASE_SHADING);
 
-    depth = 99999999;
+    mat = this->meshes[hit.mesh]->get_triangle_material(hit.triangle);
 
-    final_color.red = this->background_color.red;
-    final_color.green = this->background_color.green;
-    final_color.blue = this->background_color.blue;
+    COUNT_STATISTIC(shading_points);
+    helper_color = compute_lighting(hit.position,mat,hit.normal);
+    final_color = multiply_colors(helper_color,hit.texture_color);
 
-    for (k = 0; k < this->meshes.size(); k++)
+    if (recursion_depth != 0)
       {
-        if (!line.intersects_sphere(this->meshes[k]->bounding_sphere_center,this->meshes[k]->bounding_sphere_radius))
-          continue;
+        ray_cone secondary_cone;   // surfaces are treated as flat, only the width is carried on
 
-        for (l = 0; l < this->meshes[k]->triangle_indices.size(); l += 3)
-          {
-            triangle.a = this->meshes[k]->vertices[this->meshes[k]->triangle_indices[l]].position;
-            triangle.b = this->meshes[k]->vertices[this->meshes[k]->triangle_indices[l + 1]].position;
-            triangle.c = this->meshes[k]->vertices[this->meshes[k]->triangle_indices[l + 2]].position;
+        secondary_cone.width = cone.width + cone.spread_angle * hit.distance;
+        secondary_cone.spread_angle = cone.spread_angle;
 
-            texture_coords_a = this->meshes[k]->vertices[this->meshes[k]->triangle_indices[l]].texture_coords;
-            texture_coords_b = this->meshes[k]->vertices[this->meshes[k]->triangle_indices[l + 1]].texture_coords;
-            texture_coords_c = this->meshes[k]->vertices[this->meshes[k]->triangle_indices[l + 2]].texture_coords;
+        if (mat.reflection > 0)                         // reflection
+          {
+            color_sum[0] = 0;
+            color_sum[1] = 0;
+            color_sum[2] = 0;
 
-            if (line.intersects_triangle(triangle,barycentric_a,barycentric_b,barycentric_c,t))
+            for (m = 0; m < this->reflection_rays; m++)
               {
-                point_3D intersection;
-                line.get_point(t,intersection);
-                double distance = point_distance(starting_point,intersection);
-
-                mat = this->meshes[k]->get_material();
-
-                if (distance < depth && distance > threshold)  // depth test
+                if (this->adaptive_probes != 0 && m == this->adaptive_probes && colors_agree(probe_min,probe_max,this->adaptive_threshold))
                   {
-                    depth = distance;
-
-                    normal_a = this->meshes[k]->vertices[this->meshes[k]->triangle_indices[l]].normal;
-                    normal_b = this->meshes[k]->vertices[this->meshes[k]->triangle_indices[l + 1]].normal;
-                    normal_c = this->meshes[k]->vertices[this->meshes[k]->triangle_indices[l + 2]].normal;
-
-                    normal.x = 0;
-                    normal.y = 0;
-                    normal.z = 0;
-
-                    normal.x = barycentric_a * normal_a.x + barycentric_b * normal_b.x + barycentric_c * normal_c.x;
-                    normal.y = barycentric_a * normal_a.y + barycentric_b * normal_b.y + barycentric_c * normal_c.y;
-                    normal.z = barycentric_a * normal_a.z + barycentric_b * normal_b.z + barycentric_c * normal_c.z;
-                    normalize(normal);  // interpolation breaks normalization
+                    COUNT_STATISTIC_ADD(adaptive_skipped_rays,this->reflection_rays - m);
+                    break;
+                  }
 
-                    if (!this->meshes[k]->use_3D_texture && this->meshes[k]->get_texture() != 0)        // 2d texture
-                      {
-                        double u,v;
+                point_3D helper_point;
+                reflection_vector = make_reflection_vector(hit.normal,hit.incoming);
 
-                        u = barycentric_a * texture_coords_a[0] + barycentric_b * texture_coords_b[0] + barycentric_c * texture_coords_c[0];
-                        v = barycentric_a * texture_coords_a[1] + barycentric_b * texture_coords_b[1] + barycentric_c * texture_coords_c[1];
+                reflection_vector.x *= -1;
+                reflection_vector.y *= -1;
+                reflection_vector.z *= -1;
 
-                        color_buffer_get_pixel(this->meshes[k]->get_texture(),u * this->meshes[k]->get_texture()->width,v * this->meshes[k]->get_texture()->height,&final_color.red,&final_color.green,&final_color.blue);
-                      }
-                    else if (this->meshes[k]->use_3D_texture && this->meshes[k]->get_texture_3D() != 0) // 3d texture
-                      {
-                        final_color = this->meshes[k]->get_texture_3D()->get_color(intersection.x,intersection.y,intersection.z);
-                      }
-                    else                                                                                // mesh color
-                      {
-                        final_color.red = 255;
-                        final_color.green = 255;
-                        final_color.blue = 255;
-                      }
+                if (m > 0) // alter the ray slightly
+                  alter_vector(reflection_vector,this->reflection_range);
 
-                    helper_color = compute_lighting(intersection,mat,normal);
-                    final_color = multiply_colors(helper_color,final_color);
+                helper_point.x = hit.position.x + reflection_vector.x;
+                helper_point.y = hit.position.y + reflection_vector.y;
+                helper_point.z = hit.position.z + reflection_vector.z;
 
-                    if (recursion_depth != 0)
-                      {
-                        incoming_vector_reverse = line.get_vector_to_origin();
+                line_3D reflection_line(hit.position,helper_point);
 
-                        if (mat.reflection > 0)                         // reflection
-                          {
-                            color_sum[0] = 0;
-                            color_sum[1] = 0;
-                            color_sum[2] = 0;
+                COUNT_STATISTIC(reflection_rays);
+                add_color = cast_ray(reflection_line,ERROR_OFFSET,recursion_depth - 1,secondary_cone);
+                update_color_range(add_color,m,probe_min,probe_max);
 
-                            for (m = 0; m < this->reflection_rays; m++)
-                              {
-                                point_3D helper_point;
-                                reflection_vector = make_reflection_vector(normal,incoming_vector_reverse);
+                color_sum[0] += add_color.red;
+                color_sum[1] += add_color.green;
+                color_sum[2] += add_color.blue;
+              }
 
-                                reflection_vector.x *= -1;
-                                reflection_vector.y *= -1;
-                                reflection_vector.z *= -1;
+            add_color.red = color_sum[0] / m;
+            add_color.green = color_sum[1] / m;
+            add_color.blue = color_sum[2] / m;
 
-                                if (m > 0) // alter the ray slightly
-                                  alter_vector(reflection_vector,this->reflection_range);
+            final_color = interpolate_colors(final_color,add_color,mat.reflection);
+          }
 
-                                helper_point.x = intersection.x + reflection_vector.x;
-                                helper_point.y = intersection.y + reflection_vector.y;
-                                helper_point.z = intersection.z + reflection_vector.z;
+        if (mat.transparency > 0)                       // refraction
+          {
+            color_sum[0] = 0;
+            color_sum[1] = 0;
+            color_sum[2] = 0;
 
-                                line_3D reflection_line(intersection,helper_point);
+            for (m = 0; m < this->refraction_rays; m++)
+              {
+                if (this->adaptive_probes != 0 && m == this->adaptive_probes && colors_agree(probe_min,probe_max,this->adaptive_threshold))
+                  {
+                    COUNT_STATISTIC_ADD(adaptive_skipped_rays,this->refraction_rays - m);
+                    break;
+                  }
 
-                                add_color = cast_ray(reflection_line,ERROR_OFFSET,recursion_depth - 1);
+                point_3D helper_point;
+                point_3D refraction_vector;
+                refraction_vector = make_refraction_vector(hit.normal,hit.incoming,mat.refractive_index);
 
-                                color_sum[0] += add_color.red;
-                                color_sum[1] += add_color.green;
-                                color_sum[2] += add_color.blue;
-                              }
+                if (m > 0) // alter the ray slightly
+                  alter_vector(refraction_vector,this->refraction_range);
 
-                            add_color.red = color_sum[0] / this->reflection_rays;
-                            add_color.green = color_sum[1] / this->reflection_rays;
-                            add_color.blue = color_sum[2] / this->reflection_rays;
+                helper_point.x = hit.position.x + refraction_vector.x;
+                helper_point.y = hit.position.y + refraction_vector.y;
+                helper_point.z = hit.position.z + refraction_vector.z;
 
-                            final_color = interpolate_colors(final_color,add_color,mat.reflection);
-                          }
+                line_3D refraction_line(hit.position,helper_point);
+                COUNT_STATISTIC(refraction_rays);
+                add_color = cast_ray(refraction_line,ERROR_OFFSET,recursion_depth - 1,secondary_cone);
+                update_color_range(add_color,m,probe_min,probe_max);
 
-                        if (mat.transparency > 0)                       // refraction
-                          {
-                            color_sum[0] = 0;
-                            color_sum[1] = 0;
-                            color_sum[2] = 0;
+                color_sum[0] += add_color.red;
+                color_sum[1] += add_color.green;
+                color_sum[2] += add_color.blue;
+              }
 
-                            for (m = 0; m < this->refraction_rays; m++)
-                              {
-                                point_3D helper_point;
-                                point_3D refraction_vector;
-                                refraction_vector = make_refraction_vector(normal,incoming_vector_reverse,mat.refractive_index);
+            add_color.red = color_sum[0] / m;
+            add_color.green = color_sum[1] / m;
+            add_color.blue = color_sum[2] / m;
 
-                                if (m > 0) // alter the ray slightly
-                                  alter_vector(refraction_vector,this->refraction_range);
+            final_color = interpolate_colors(final_color,add_color,mat.transparency);
+          }
+      }
 
-                                helper_point.x = intersection.x + refraction_vector.x;
-                                helper_point.y = intersection.y + refraction_vector.y;
-                                helper_point.z = intersection.z + refraction_vector.z;
+    return final_color;
+  }
 
-                                line_3D refraction_line(intersection,helper_point);
-                                add_color = cast_ray(refraction_line,ERROR_OFFSET,recursion_depth - 1);
+color scene_3D::cast_ray(line_3D line, double threshold, unsigned int recursion_depth, ray_cone cone, ray_hit *primary_hit)
+  {
+    ray_hit hit;
 
-                                color_sum[0] += add_color.red;
-                                color_sum[1] += add_color.green;
-                                color_sum[2] += add_color.blue;
-                              }
+    if (!this->find_nearest_hit(line,threshold,cone,hit))
+      {
+        if (primary_hit != 0)
+          primary_hit->found = false;
 
-                            add_color.red = color_sum[0] / this->refraction_rays;
-                            add_color.green = color_sum[1] / this->refraction_rays;
-                            add_color.blue = color_sum[2] / this->refraction_rays;
+        return this->background_color;
+      }
 
-                            final_color = interpolate_colors(final_color,add_color,mat.transparency);
-                          }
-                      }
-                  }
-                }
-              }
-            }
+    if (primary_hit != 0)
+      *primary_hit = hit;
 
-    return final_color;
+    return this->shade_hit(hit,recursion_depth,cone);
   }
 
 color interpolate_colors(color color1, color color2, double ratio)
@@ -1120,8 +2956,69 @@ void scene_3D::set_recursion_depth(unsigned int depth)
     this->recursion_depth = depth;
   }
 
-void scene_3D::render(t_color_buffer *buffer, void (* progress_callback)(int))
+progress_reporter::progress_reporter(void (* callback)(render_progress), unsigned int total_units, double interval)
   {
+    this->callback = callback;
+    this->interval = interval;
+    this->start = chrono::steady_clock::now();
+    this->last_report = -1;
+    this->unit_cost = 0;
+    this->last_unit_end = 0;
+
+    this->progress.completed_units = 0;
+    this->progress.total_units = total_units;
+    this->progress.elapsed_seconds = 0;
+    this->progress.rays_per_second = 0;
+    this->progress.eta_seconds = -1;
+  }
+
+void progress_reporter::unit_done(unsigned long long rays)
+  {
+    lock_guard<mutex> guard(this->lock);
+    double now, seconds;
+
+    now = chrono::duration<double>(chrono::steady_clock::now() - this->start).count();
+    seconds = now - this->last_unit_end;   // with more threads this is the time between units, i.e. cost divided by the threads
+    this->last_unit_end = now;
+
+    if (this->progress.completed_units == 0)
+      {
+        this->unit_cost = seconds;
+        this->progress.rays_per_second = seconds > 0 ? rays / seconds : 0;
+      }
+    else
+      {
+        this->unit_cost += PROGRESS_SMOOTHING * (seconds - this->unit_cost);
+
+        if (seconds > 0)
+          this->progress.rays_per_second += PROGRESS_SMOOTHING * (rays / seconds - this->progress.rays_per_second);
+      }
+
+    this->progress.completed_units++;
+    this->progress.elapsed_seconds = now;
+    this->progress.eta_seconds = (this->progress.total_units - this->progress.completed_units) * this->unit_cost;
+
+    if (this->callback == NULL)
+      return;
+
+    if (this->progress.completed_units == this->progress.total_units || this->last_report < 0 ||
+      now - this->last_report >= this->interval)
+      {
+        this->last_report = now;
+        this->callback(this->progress);
+      }
+  }
+
+render_progress progress_reporter::get_progress()
+  {
+    lock_guard<mutex> guard(this->lock);
+    return this->progress;
+  }
+
+render_statistics scene_3D::render(t_color_buffer *buffer, void (* progress_callback)(render_progress))
+  {
+    TRACE_ZONE("render","render");
+
     color_buffer_init(buffer,this->resolution[0],this->resolution[1]);
 
     unsigned int i, j, k;
@@ -1129,16 +3026,112 @@ void scene_3D::render(t_color_buffer *buffer, void (* progress_callback)(int))
     double aspect_ratio, angle, distance;
     color ray_color, helper_color;
     unsigned int color_sum[3];
+    ray_cone cone;
+    render_statistics statistics;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    chrono::steady_clock::time_point pixel_start;
+    double pixel_start_cost = 0;
+    cost_metric metric = this->cost_map_metric;
+    progress_reporter progress(progress_callback,this->resolution[1],PROGRESS_INTERVAL);
+    unsigned long long row_start_rays = 0;
+
+    auto rays_cast = []() -> unsigned long long
+      {
+#if RENDER_STATISTICS
+        return thread_render_statistics.primary_rays + thread_render_statistics.shadow_rays +
+          thread_render_statistics.reflection_rays + thread_render_statistics.refraction_rays;
+#else
+        return 0;
+#endif
+      };
+
+    auto pixel_work = [metric,rays_cast]() -> double    // current count of the cost map metric
+      {
+#if RENDER_STATISTICS
+        if (metric == COST_RAYS)
+          return rays_cast();
+        else if (metric == COST_TRIANGLE_TESTS)
+          return thread_render_statistics.triangle_tests;
+#else
+        (void) metric;
+#endif
+        return 0;
+      };
+
+    memset(&statistics,0,sizeof(statistics));
+
+#if RENDER_STATISTICS
+    memset(&thread_render_statistics,0,sizeof(thread_render_statistics));
+#endif
+
+    shadow_occluder no_occluder;
+    no_occluder.mesh = -1;
+    no_occluder.triangle = 0;
+    shadow_occluders.assign(this->lights.size(),no_occluder);
+
+    this->cost_map.clear();
+
+    if (this->cost_map_metric != COST_NONE)
+      this->cost_map.resize(this->resolution[0] * this->resolution[1]);
+
+    this->aux.width = 0;
+    this->aux.height = 0;
+    this->aux.albedo.clear();
+    this->aux.normal.clear();
+    this->aux.depth.clear();
+
+    if (this->record_aux)
+      {
+        this->aux.width = this->resolution[0];
+        this->aux.height = this->resolution[1];
+        this->aux.albedo.resize(this->resolution[0] * this->resolution[1] * 3);
+        this->aux.normal.resize(this->resolution[0] * this->resolution[1] * 3);
+        this->aux.depth.resize(this->resolution[0] * this->resolution[1]);
+      }
+
+#if RENDER_STATISTICS
+    if (this->count_phases)
+      statistics.phase_counters_available = phase_counters_start();
+#endif
+
+    this->build_light_tree();    // the lights may have moved since the last render
+    this->build_shadow_maps();
+
+    bool use_hit_cache = this->cache_hits && this->hit_cache_valid &&
+      this->hit_cache.size() == this->resolution[0] * this->resolution[1];
+
+    if (!use_hit_cache)
+      this->build_visibility_buffer();
+
+    this->update_peak_memory(0);   // all the render buffers are allocated now
+
+    if (this->report_memory)
+      print_memory_report(this->get_memory_report(),cout);
+
+    bool use_visibility = !use_hit_cache && this->visibility_buffer.size() != 0;
+
+    if (this->cache_hits && !use_hit_cache)
+      this->hit_cache.resize(this->resolution[0] * this->resolution[1]);
 
     aspect_ratio = this->resolution[1] / ((double) this->resolution[0]);
 
+    cone.width = 0;                                                  // pinhole
+    cone.spread_angle = 1.0 / this->resolution[0] / this->focal_distance;   // one pixel seen from the camera
+
     for (j = 0; j < this->resolution[1]; j++)
       {
-        if (progress_callback != NULL)
-          progress_callback(j);
+        trace_zone row_zone("render row","render",j);
+
+        row_start_rays = rays_cast();
 
         for (i = 0; i < this->resolution[0]; i++)
           {
+            if (this->cost_map_metric != COST_NONE)
+              {
+                pixel_start = chrono::steady_clock::now();
+                pixel_start_cost = pixel_work();
+              }
+
             point1.x = 0;
             point1.y = -this->focal_distance;
             point1.z = 0;
@@ -1149,7 +3142,51 @@ void scene_3D::render(t_color_buffer *buffer, void (* progress_callback)(int))
 
             line_3D line(point1,point2);
 
-            ray_color = this->cast_ray(line,ERROR_OFFSET,this->recursion_depth); // main ray
+            unsigned int index = j * this->resolution[0] + i;
+            ray_hit hit;
+
+            if (use_hit_cache)
+              {
+                COUNT_STATISTIC(cached_primary_hits);
+                hit = this->hit_cache[index];
+                ray_color = hit.found ? this->shade_hit(hit,this->recursion_depth,cone) : this->background_color;
+              }
+            else if (use_visibility && this->resolve_visible_hit(line,ERROR_OFFSET,cone,this->visibility_buffer[index],hit))
+              {
+                COUNT_STATISTIC(rasterized_primary_hits);
+                ray_color = hit.found ? this->shade_hit(hit,this->recursion_depth,cone) : this->background_color;
+
+                if (this->cache_hits)
+                  this->hit_cache[index] = hit;
+              }
+            else
+              {
+                COUNT_STATISTIC(primary_rays);
+
+                if (use_visibility)
+                  COUNT_STATISTIC(visibility_fallbacks);
+
+                ray_color = this->cast_ray(line,ERROR_OFFSET,this->recursion_depth,cone,&hit); // main ray
+
+                if (this->cache_hits)
+                  this->hit_cache[index] = hit;
+              }
+
+            if (this->record_aux)
+              {
+                color albedo = this->background_color;
+
+                if (hit.found)
+                  albedo = multiply_colors(hit.texture_color,this->meshes[hit.mesh]->get_triangle_material(hit.triangle).surface_color);
+
+                this->aux.albedo[3 * index] = albedo.red / 255.0;
+                this->aux.albedo[3 * index + 1] = albedo.green / 255.0;
+                this->aux.albedo[3 * index + 2] = albedo.blue / 255.0;
+                this->aux.normal[3 * index] = hit.found ? hit.normal.x : 0;
+                this->aux.normal[3 * index + 1] = hit.found ? hit.normal.y : 0;
+                this->aux.normal[3 * index + 2] = hit.found ? hit.normal.z : 0;
+                this->aux.depth[index] = hit.found ? hit.distance : -1;
+              }
 
             if (this->depth_of_field_rays != 1)
               {
@@ -1171,7 +3208,8 @@ void scene_3D::render(t_color_buffer *buffer, void (* progress_callback)(int))
 
                     line_3D line2(point1,point2);
 
-                    helper_color = this->cast_ray(line2,ERROR_OFFSET,1);
+                    COUNT_STATISTIC(primary_rays);
+                    helper_color = this->cast_ray(line2,ERROR_OFFSET,1,cone);
 
                     color_sum[0] += helper_color.red;
                     color_sum[1] += helper_color.green;
@@ -1188,8 +3226,170 @@ void scene_3D::render(t_color_buffer *buffer, void (* progress_callback)(int))
               }
 
             color_buffer_set_pixel(buffer,i,j,ray_color.red,ray_color.green,ray_color.blue);
+
+            if (this->cost_map_metric == COST_TIME)
+              this->cost_map[j * this->resolution[0] + i] =
+                chrono::duration<double,nano>(chrono::steady_clock::now() - pixel_start).count();
+            else if (this->cost_map_metric != COST_NONE)
+              this->cost_map[j * this->resolution[0] + i] = pixel_work() - pixel_start_cost;
+          }
+
+        progress.unit_done(rays_cast() - row_start_rays);
+      }
+
+#if RENDER_STATISTICS
+    if (statistics.phase_counters_available)
+      phase_counters_stop(thread_render_statistics.phases);
+
+    thread_render_statistics.phase_counters_available = statistics.phase_counters_available;
+    statistics.phase_counters_available = false;   // set again by the merge
+    add_render_statistics(statistics,thread_render_statistics);
+#endif
+
+    this->hit_cache_valid = this->cache_hits;
+
+    statistics.render_seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    return statistics;
+  }
+
+static void add_phase_count(long long &total, long long part)
+  {
+    total = (total < 0 || part < 0) ? -1 : total + part;   // unavailable in one part means unavailable in the sum
+  }
+
+static void print_phase_count(ostream &output, long long count)
+  {
+    if (count < 0)
+      output << "null";
+    else
+      output << count;
+  }
+
+void add_render_statistics(render_statistics &total, render_statistics part)
+  {
+    total.primary_rays += part.primary_rays;
+    total.shadow_rays += part.shadow_rays;
+    total.reflection_rays += part.reflection_rays;
+    total.refraction_rays += part.refraction_rays;
+    total.bounding_sphere_tests += part.bounding_sphere_tests;
+    total.bounding_sphere_passes += part.bounding_sphere_passes;
+    total.triangle_tests += part.triangle_tests;
+    total.triangle_hits += part.triangle_hits;
+    total.shading_points += part.shading_points;
+    total.cached_primary_hits += part.cached_primary_hits;
+    total.rasterized_primary_hits += part.rasterized_primary_hits;
+    total.visibility_fallbacks += part.visibility_fallbacks;
+    total.culled_lights += part.culled_lights;
+    total.adaptive_skipped_rays += part.adaptive_skipped_rays;
+    total.shadow_cache_tests += part.shadow_cache_tests;
+    total.shadow_cache_hits += part.shadow_cache_hits;
+    total.shadow_map_lookups += part.shadow_map_lookups;
+    total.render_seconds += part.render_seconds;
+
+    if (part.phase_counters_available)
+      {
+        unsigned int i;
+
+        for (i = 0; i < PHASE_COUNT; i++)
+          {
+            if (!total.phase_counters_available)
+              total.phases[i] = part.phases[i];
+            else
+              {
+                add_phase_count(total.phases[i].task_clock_ns,part.phases[i].task_clock_ns);
+                add_phase_count(total.phases[i].cycles,part.phases[i].cycles);
+                add_phase_count(total.phases[i].instructions,part.phases[i].instructions);
+                add_phase_count(total.phases[i].cache_misses,part.phases[i].cache_misses);
+                add_phase_count(total.phases[i].branch_misses,part.phases[i].branch_misses);
+              }
+          }
+
+        total.phase_counters_available = true;
+      }
+  }
+
+void print_render_statistics(render_statistics statistics, ostream &output)
+  {
+    unsigned long long rays;
+    double seconds;
+
+    rays = statistics.primary_rays + statistics.shadow_rays + statistics.reflection_rays + statistics.refraction_rays;
+    seconds = statistics.render_seconds > 0 ? statistics.render_seconds : 1;
+
+    ios::fmtflags flags = output.flags();
+    streamsize precision = output.precision(6);
+
+    output << "{\"render_seconds\": " << statistics.render_seconds <<
+      ", \"primary_rays\": " << statistics.primary_rays <<
+      ", \"shadow_rays\": " << statistics.shadow_rays <<
+      ", \"reflection_rays\": " << statistics.reflection_rays <<
+      ", \"refraction_rays\": " << statistics.refraction_rays <<
+      ", \"rays_per_second\": {\"total\": " << rays / seconds <<
+      ", \"primary\": " << statistics.primary_rays / seconds <<
+      ", \"shadow\": " << statistics.shadow_rays / seconds <<
+      ", \"reflection\": " << statistics.reflection_rays / seconds <<
+      ", \"refraction\": " << statistics.refraction_rays / seconds << "}" <<
+      ", \"bounding_sphere_tests\": " << statistics.bounding_sphere_tests <<
+      ", \"bounding_sphere_passes\": " << statistics.bounding_sphere_passes <<
+      ", \"triangle_tests\": " << statistics.triangle_tests <<
+      ", \"triangle_hits\": " << statistics.triangle_hits <<
+      ", \"shading_points\": " << statistics.shading_points <<
+      ", \"cached_primary_hits\": " << statistics.cached_primary_hits <<
+      ", \"rasterized_primary_hits\": " << statistics.rasterized_primary_hits <<
+      ", \"visibility_fallbacks\": " << statistics.visibility_fallbacks <<
+      ", \"culled_lights\": " << statistics.culled_lights <<
+      ", \"adaptive_skipped_rays\": " << statistics.adaptive_skipped_rays <<
+      ", \"shadow_cache_tests\": " << statistics.shadow_cache_tests <<
+      ", \"shadow_cache_hits\": " << statistics.shadow_cache_hits <<
+      ", \"shadow_cache_hit_rate\": " <<
+        (statistics.shadow_cache_tests > 0 ? statistics.shadow_cache_hits / ((double) statistics.shadow_cache_tests) : 0) <<
+      ", \"shadow_map_lookups\": " << statistics.shadow_map_lookups <<
+      ", \"triangle_tests_per_ray\": " << (rays == 0 ? 0.0 : statistics.triangle_tests / ((double) rays)) <<
+      ", \"bounding_sphere_passes_per_ray\": " << (rays == 0 ? 0.0 : statistics.bounding_sphere_passes / ((double) rays));
+
+    if (statistics.phase_counters_available)
+      {
+        const char *phase_names[PHASE_COUNT] = {"other", "traversal", "shading", "texture"};
+        unsigned int i;
+
+        output << ", \"phases\": {";
+
+        for (i = 0; i < PHASE_COUNT; i++)
+          {
+            phase_counters counters = statistics.phases[i];
+
+            output << (i == 0 ? "" : ", ") << "\"" << phase_names[i] << "\": {\"task_clock_ms\": ";
+
+            if (counters.task_clock_ns < 0)
+              output << "null";
+            else
+              output << counters.task_clock_ns / 1000000.0;
+
+            output << ", \"cycles\": ";
+            print_phase_count(output,counters.cycles);
+            output << ", \"instructions\": ";
+            print_phase_count(output,counters.instructions);
+            output << ", \"ipc\": ";
+
+            if (counters.cycles <= 0 || counters.instructions < 0)
+              output << "null";
+            else
+              output << counters.instructions / ((double) counters.cycles);
+
+            output << ", \"cache_misses\": ";
+            print_phase_count(output,counters.cache_misses);
+            output << ", \"branch_misses\": ";
+            print_phase_count(output,counters.branch_misses);
+            output << "}";
           }
+
+        output << "}";
       }
+
+    output << "}";
+
+    output.flags(flags);
+    output.precision(precision);
   }
 
 
@@ -1198,10 +3398,51 @@ double light_3D::get_intensity()
     return this->intensity;
   }
 
+double light_3D::get_size()
+  {
+    point_3D diagonal1, diagonal2;
+
+    switch (this->shape)
+      {
+        case LIGHT_SPHERE:
+        case LIGHT_DISK:
+          return this->radius;
+
+        case LIGHT_RECTANGLE:
+          diagonal1.x = this->edges[0].x + this->edges[1].x;
+          diagonal1.y = this->edges[0].y + this->edges[1].y;
+          diagonal1.z = this->edges[0].z + this->edges[1].z;
+          diagonal2.x = this->edges[0].x - this->edges[1].x;
+          diagonal2.y = this->edges[0].y - this->edges[1].y;
+          diagonal2.z = this->edges[0].z - this->edges[1].z;
+          return max(vector_length(diagonal1),vector_length(diagonal2)) / 2;
+
+        default:
+          return 0;
+      }
+  }
+
 void scene_3D::add_mesh(mesh_3D *mesh)
 
   {
     this->meshes.push_back(mesh);
+    this->hit_cache_valid = false;
+
+    mesh_memory item = get_mesh_memory(mesh);
+    t_color_buffer *texture = get_memory_texture(mesh);
+
+    this->mesh_memory_total += item.vertices + item.indices + item.materials + item.acceleration;
+
+    if (texture != NULL && find(this->memory_textures.begin(),this->memory_textures.end(),texture) ==
+        this->memory_textures.end())
+      {
+        texture_memory texture_item = get_texture_memory(texture);
+
+        this->memory_textures.push_back(texture);
+        this->mesh_memory_total += texture_item.image + texture_item.mipmaps + texture_item.tiled;
+      }
+
+    this->update_peak_memory(0);
   }
 
 void scene_3D::add_light(light_3D *light)
@@ -1384,6 +3625,247 @@ light_3D::light_3D()
     this->light_color.blue = 255;
     this->light_color.alpha = 255;
     this->distance_factor = 20;
+    this->shape = LIGHT_POINT;
+    this->radius = 0;
+    this->normal.x = 0;
+    this->normal.y = 0;
+    this->normal.z = 1;
+    this->edges[0] = this->normal;
+    this->edges[1] = this->normal;
+  }
+
+light_shape light_3D::get_shape()
+  {
+    return this->shape;
+  }
+
+void light_3D::set_point()
+  {
+    this->shape = LIGHT_POINT;
+  }
+
+void light_3D::set_sphere(double radius)
+  {
+    this->shape = LIGHT_SPHERE;
+    this->radius = radius;
+  }
+
+void light_3D::set_disk(double radius, point_3D normal)
+  {
+    this->shape = LIGHT_DISK;
+    this->radius = radius;
+    this->normal = normal;
+    normalize(this->normal);
+  }
+
+void light_3D::set_rectangle(point_3D edge1, point_3D edge2)
+  {
+    double length_squared = dot_product(edge1,edge1);
+
+    if (length_squared > 0)    // orthogonalize edge2
+      {
+        double projection = dot_product(edge1,edge2) / length_squared;
+
+        edge2.x -= projection * edge1.x;
+        edge2.y -= projection * edge1.y;
+        edge2.z -= projection * edge1.z;
+      }
+
+    this->shape = LIGHT_RECTANGLE;
+    this->edges[0] = edge1;
+    this->edges[1] = edge2;
+  }
+
+static void make_basis(point_3D w, point_3D &u, point_3D &v)
+
+  /**<
+    Makes two unit vectors perpendicular to unit vector w and to each
+    other.
+   */
+
+  {
+    point_3D helper;
+
+    helper.x = fabs(w.x) > 0.9 ? 0 : 1;
+    helper.y = fabs(w.x) > 0.9 ? 1 : 0;
+    helper.z = 0;
+
+    cross_product(w,helper,u);
+    normalize(u);
+    cross_product(w,u,v);
+    normalize(v);
+  }
+
+static bool sample_spherical_rectangle(point_3D from, point_3D corner, point_3D edge1, point_3D edge2, point_3D &sample)
+
+  /**<
+    Samples the rectangle uniformly by solid angle as seen from given
+    point (Urena et al. 2013, An Area-Preserving Parametrization for
+    Spherical Rectangles).
+
+    @return false if the solid angle is too small to be sampled
+   */
+
+  {
+    point_3D x, y, z, d, v00, v01, v10, v11, n0, n1, n2, n3;
+    double length_x, length_y, x0, y0, z0, x1, y1, g0, g1, g2, g3, b0, b1, k, solid_angle;
+    double au, fu, cu, xu, distance, h0, h1, hv, yv;
+
+    length_x = sqrt(dot_product(edge1,edge1));
+    length_y = sqrt(dot_product(edge2,edge2));
+
+    if (length_x == 0 || length_y == 0)
+      return false;
+
+    x.x = edge1.x / length_x; x.y = edge1.y / length_x; x.z = edge1.z / length_x;
+    y.x = edge2.x / length_y; y.y = edge2.y / length_y; y.z = edge2.z / length_y;
+    cross_product(x,y,z);
+
+    d.x = corner.x - from.x;
+    d.y = corner.y - from.y;
+    d.z = corner.z - from.z;
+
+    x0 = dot_product(d,x);
+    y0 = dot_product(d,y);
+    z0 = dot_product(d,z);
+
+    if (z0 > 0)                 // local frame with the rectangle below the point
+      {
+        z0 *= -1;
+        z.x *= -1; z.y *= -1; z.z *= -1;
+      }
+
+    if (z0 > -1e-9)             // point in the rectangle plane
+      return false;
+
+    x1 = x0 + length_x;
+    y1 = y0 + length_y;
+
+    v00.x = x0; v00.y = y0; v00.z = z0;
+    v01.x = x0; v01.y = y1; v01.z = z0;
+    v10.x = x1; v10.y = y0; v10.z = z0;
+    v11.x = x1; v11.y = y1; v11.z = z0;
+
+    cross_product(v00,v10,n0); normalize(n0);    // normals of the spherical rectangle edges
+    cross_product(v10,v11,n1); normalize(n1);
+    cross_product(v11,v01,n2); normalize(n2);
+    cross_product(v01,v00,n3); normalize(n3);
+
+    g0 = acos(max(-1.0,min(1.0,-dot_product(n0,n1))));   // internal angles
+    g1 = acos(max(-1.0,min(1.0,-dot_product(n1,n2))));
+    g2 = acos(max(-1.0,min(1.0,-dot_product(n2,n3))));
+    g3 = acos(max(-1.0,min(1.0,-dot_product(n3,n0))));
+
+    b0 = n0.z;
+    b1 = n2.z;
+    k = 2 * PI - g2 - g3;
+    solid_angle = g0 + g1 - k;
+
+    if (solid_angle < 1e-9)
+      return false;
+
+    au = random_double() * solid_angle + k;
+    fu = (cos(au) * b0 - b1) / sin(au);
+    cu = (fu > 0 ? 1 : -1) / sqrt(fu * fu + b0 * b0);
+    cu = max(-1.0,min(1.0,cu));
+
+    xu = -(cu * z0) / max(sqrt(1 - cu * cu),1e-9);
+    xu = max(x0,min(x1,xu));
+
+    distance = sqrt(xu * xu + z0 * z0);
+    h0 = y0 / sqrt(distance * distance + y0 * y0);
+    h1 = y1 / sqrt(distance * distance + y1 * y1);
+    hv = h0 + random_double() * (h1 - h0);
+    yv = hv * hv < 1 - 1e-9 ? (hv * distance) / sqrt(1 - hv * hv) : y1;
+
+    sample.x = from.x + xu * x.x + yv * y.x + z0 * z.x;
+    sample.y = from.y + xu * x.y + yv * y.y + z0 * z.y;
+    sample.z = from.z + xu * x.z + yv * y.z + z0 * z.z;
+
+    return true;
+  }
+
+double light_3D::sample_point(point_3D from, point_3D &sample)
+  {
+    point_3D w, u, v, direction;
+    double distance, cos_max, cos_theta, sin_theta, phi, t, r, weight;
+
+    sample = this->position;
+
+    switch (this->shape)
+      {
+        case LIGHT_SPHERE:                // uniform in the cone of directions the sphere covers
+          substract_vectors(from,this->position,w);
+          distance = sqrt(dot_product(w,w));
+
+          if (distance <= this->radius)   // inside, any direction hits the light
+            return 1;
+
+          w.x /= distance; w.y /= distance; w.z /= distance;
+          make_basis(w,u,v);
+
+          cos_max = sqrt(1 - this->radius * this->radius / (distance * distance));
+          cos_theta = 1 - random_double() * (1 - cos_max);
+          sin_theta = sqrt(max(0.0,1 - cos_theta * cos_theta));
+          phi = 2 * PI * random_double();
+
+          direction.x = cos_theta * w.x + sin_theta * (cos(phi) * u.x + sin(phi) * v.x);
+          direction.y = cos_theta * w.y + sin_theta * (cos(phi) * u.y + sin(phi) * v.y);
+          direction.z = cos_theta * w.z + sin_theta * (cos(phi) * u.z + sin(phi) * v.z);
+
+          // nearest intersection with the sphere
+
+          t = distance * cos_theta - sqrt(max(0.0,this->radius * this->radius - distance * distance * sin_theta * sin_theta));
+
+          sample.x = from.x + t * direction.x;
+          sample.y = from.y + t * direction.y;
+          sample.z = from.z + t * direction.z;
+          return 1;
+
+        case LIGHT_DISK:                  // uniform by area, weighted by the solid angle of the sample
+          make_basis(this->normal,u,v);
+
+          r = this->radius * sqrt(random_double());
+          phi = 2 * PI * random_double();
+
+          sample.x = this->position.x + r * (cos(phi) * u.x + sin(phi) * v.x);
+          sample.y = this->position.y + r * (cos(phi) * u.y + sin(phi) * v.y);
+          sample.z = this->position.z + r * (cos(phi) * u.z + sin(phi) * v.z);
+
+          substract_vectors(from,sample,direction);
+          distance = dot_product(direction,direction);
+
+          if (distance == 0)
+            return 0;
+
+          weight = fabs(dot_product(direction,this->normal)) / (distance * sqrt(distance));   // cos / distance^2
+          return weight;
+
+        case LIGHT_RECTANGLE:
+          {
+            point_3D corner;
+
+            corner.x = this->position.x - (this->edges[0].x + this->edges[1].x) / 2;
+            corner.y = this->position.y - (this->edges[0].y + this->edges[1].y) / 2;
+            corner.z = this->position.z - (this->edges[0].z + this->edges[1].z) / 2;
+
+            if (sample_spherical_rectangle(from,corner,this->edges[0],this->edges[1],sample))
+              return 1;
+
+            // seen edge-on, any point will do
+
+            t = random_double();
+            r = random_double();
+
+            sample.x = corner.x + t * this->edges[0].x + r * this->edges[1].x;
+            sample.y = corner.y + t * this->edges[0].y + r * this->edges[1].y;
+            sample.z = corner.z + t * this->edges[0].z + r * this->edges[1].z;
+            return 1;
+          }
+
+        default:
+          return 1;
+      }
   }
 
 
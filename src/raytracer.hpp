@@ -15,14 +15,59 @@
 #include <vector>
 #include <string>
 #include <fstream>
+#include <memory>
+#include <mutex>
+#include <list>
+#include <unordered_map>
+#include <deque>
+#include <thread>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
 #include <stdlib.h>
+#include <stdint.h>
 
 #define ERROR_OFFSET 0.01
 
+#define MESH_CACHE_MAGIC "DRTMESH"
+#define MESH_CACHE_VERSION 5
+#define MESH_CACHE_EXTENSION ".drtm"
+#define MESH_CACHE_ALIGNMENT 64
+#define MESH_CACHE_BOUNDING_SPHERE 0x01   /**< mesh cache flag, the bounding sphere is stored */
+#define MESH_CACHE_OBJ_SOURCE 0x02        /**< mesh cache flag, the first source record is the obj file */
+
+#define PAGED_TEXTURE_MAGIC "DRTTEX"
+#define PAGED_TEXTURE_VERSION 1
+#define PAGED_TEXTURE_EXTENSION ".drtt"
+#define PAGED_TEXTURE_TILE_SIZE 64        /**< default tile width and height in texels */
+
+#define MESH_DEFAULT_MATERIAL 0xffff      /**< triangle material id meaning the mesh material (mat) is used */
+
+#define MATERIAL_SURFACE_COLOR 0x01       /**< material member flags, see material::defined */
+#define MATERIAL_AMBIENT 0x02
+#define MATERIAL_SPECULAR 0x04
+#define MATERIAL_SPECULAR_EXPONENT 0x08
+#define MATERIAL_REFLECTION 0x10
+#define MATERIAL_TRANSPARENCY 0x20
+#define MATERIAL_REFRACTIVE_INDEX 0x40
+
+#ifndef RENDER_STATISTICS
+  #define RENDER_STATISTICS 1             /**< build with -DRENDER_STATISTICS=0 to compile the render statistics counters out */
+#endif
+
 using namespace std;
 
 #define PI 3.1415926535897932384626
 
+#define SHADOW_MAP_NEAR 0.001         /**< near plane of the shadow map faces, closer parts of the triangles are clipped */
+#define SHADOW_MAP_BIAS 1.5           /**< shadow map depth bias and normal offset of the looked up points, in texels */
+#define SHADOW_MAP_MAX_FILTER 8       /**< maximum radius of the shadow map blocker search and PCF in texels */
+#define VISIBILITY_NEAR 0.000001      /**< near plane of the primary visibility rasterization */
+#define VISIBILITY_TOLERANCE 0.01     /**< pixels outside the triangles still rasterized, so that no ray-traced hit is missed */
+#define VISIBILITY_TIE 0.0001         /**< relative depth difference of the two nearest triangles of a pixel under which the pixel is traced */
+#define VISIBILITY_AMBIGUOUS -2       /**< visibility_sample::mesh of pixels whose nearest triangle is uncertain */
+#define DEFAULT_ADAPTIVE_THRESHOLD 8  /**< default probe color difference (0 - 255) of scene_3D::set_adaptive_sampling, used by the demo and the scene benchmark */
+
 extern "C"
 {
 #include "colorbuffer.h"
@@ -35,6 +80,14 @@ typedef enum
     AROUND_Z
   } rotation_type;
 
+typedef enum           /**< what the per-pixel cost map records */
+  {
+    COST_NONE,             /**< no cost map */
+    COST_TIME,             /**< nanoseconds spent on the pixel */
+    COST_RAYS,             /**< rays of all types cast for the pixel, needs RENDER_STATISTICS */
+    COST_TRIANGLE_TESTS    /**< intersects_triangle calls for the pixel, needs RENDER_STATISTICS */
+  } cost_metric;
+
 typedef struct          /**< point, also a vector */
   {
     double x;
@@ -64,6 +117,12 @@ typedef struct
     unsigned char alpha;
   } color;
 
+typedef struct         /**< ray cone, isotropic approximation of the ray differentials used to filter textures */
+  {
+    double width;         /**< width of the ray footprint at the ray origin */
+    double spread_angle;  /**< how much the width grows per unit of distance */
+  } ray_cone;
+
 typedef struct
   {
     double ambient_intensity;
@@ -75,20 +134,674 @@ typedef struct
     double refractive_index;
     double glitter;
     color surface_color;
+    unsigned int defined;       /**< MATERIAL_* flags of the members set in a material table entry, the others are taken from mesh_3D::mat */
   } material;
 
+typedef struct         /**< header of the binary mesh cache file, the data follow in native (render-ready) layout */
+  {
+    char magic[8];            /**< MESH_CACHE_MAGIC */
+    uint32_t version;         /**< MESH_CACHE_VERSION */
+    uint32_t flags;           /**< MESH_CACHE_* flags */
+    uint32_t vertex_size;     /**< sizeof(vertex_3D) of the writer, used to detect incompatible layout */
+    uint32_t index_size;      /**< sizeof(unsigned int) of the writer */
+    uint64_t vertex_count;
+    uint64_t vertex_offset;   /**< offset of the vertex array from the file beginning */
+    uint64_t index_count;
+    uint64_t index_offset;    /**< offset of the triangle index array from the file beginning */
+    uint64_t material_count;
+    uint64_t material_offset; /**< offset of the material table */
+    uint64_t triangle_material_count;   /**< number of triangle material ids, 0 (all triangles use mat) or index_count / 3 */
+    uint64_t triangle_material_offset;  /**< offset of the triangle material ids */
+    uint64_t source_count;    /**< number of source file records (the obj and mtl files the mesh was loaded from) */
+    uint64_t source_offset;   /**< offset of the source file records */
+    double bounding_sphere_center[3];
+    double bounding_sphere_radius;
+  } mesh_cache_header;
+
+typedef struct         /**< source file record of the mesh cache, followed by the file name */
+  {
+    int64_t modification_time;  /**< see file_modification_time, -1 if the file didn't exist */
+    int64_t size;               /**< -1 if the file didn't exist */
+    uint64_t name_length;
+  } mesh_cache_source;
+
+typedef struct         /**< header of the pre-tiled (paged) texture file */
+  {
+    char magic[8];            /**< PAGED_TEXTURE_MAGIC */
+    uint32_t version;         /**< PAGED_TEXTURE_VERSION */
+    uint32_t tile_size;       /**< tile width and height in texels */
+    uint32_t level_count;     /**< number of mipmap levels, paged_texture_level records follow the header */
+    uint32_t reserved;
+  } paged_texture_header;
+
+typedef struct         /**< mipmap level record of the paged texture file */
+  {
+    uint32_t width;
+    uint32_t height;
+    uint32_t tiles_x;
+    uint32_t tiles_y;
+    uint64_t offset;          /**< offset of the first tile, the tiles follow by rows, each has tile_size^2 32bit texels (0x00BBGGRR) */
+  } paged_texture_level;
+
+typedef enum           /**< phase of the render the phase counters are attributed to */
+  {
+    PHASE_OTHER,           /**< camera ray generation, pixel output */
+    PHASE_TRAVERSAL,       /**< bounding sphere and triangle tests of all rays */
+    PHASE_SHADING,         /**< hit point shading, lighting and secondary ray setup */
+    PHASE_TEXTURE,         /**< texture sampling */
+    PHASE_COUNT
+  } render_phase;
+
+typedef struct         /**< perf_event_open counts of one render phase, a count is -1 if the counter isn't available */
+  {
+    long long task_clock_ns;
+    long long cycles;
+    long long instructions;
+    long long cache_misses;
+    long long branch_misses;
+  } phase_counters;
+
+typedef struct         /**< counts of the work done by a render, all zero except render_seconds when RENDER_STATISTICS is 0 */
+  {
+    unsigned long long primary_rays;            /**< camera rays, including depth of field rays */
+    unsigned long long shadow_rays;
+    unsigned long long reflection_rays;
+    unsigned long long refraction_rays;
+    unsigned long long bounding_sphere_tests;
+    unsigned long long bounding_sphere_passes;  /**< bounding sphere tests after which the mesh triangles were tested */
+    unsigned long long triangle_tests;          /**< line_3D::intersects_triangle calls */
+    unsigned long long triangle_hits;
+    unsigned long long shading_points;          /**< compute_lighting calls */
+    unsigned long long cached_primary_hits;     /**< primary hits taken from the hit cache instead of tracing */
+    unsigned long long rasterized_primary_hits; /**< primary hits (or misses) resolved from the visibility buffer instead of tracing */
+    unsigned long long visibility_fallbacks;    /**< primary rays traced because the visibility buffer sample was ambiguous or missed */
+    unsigned long long culled_lights;           /**< lights skipped before the shadow rays as they can't contribute */
+    unsigned long long adaptive_skipped_rays;   /**< shadow, reflection and refraction rays not cast because the probe rays agreed */
+    unsigned long long shadow_cache_tests;      /**< shadow rays tested against the cached occluder of their light */
+    unsigned long long shadow_cache_hits;       /**< shadow rays blocked by the cached occluder, i.e. without traversal */
+    unsigned long long shadow_map_lookups;      /**< shadows looked up in the shadow maps instead of casting shadow rays */
+    double render_seconds;
+    bool phase_counters_available;              /**< whether phases contains counts, see scene_3D::set_phase_counters */
+    phase_counters phases[PHASE_COUNT];
+  } render_statistics;
+
+extern atomic<bool> trace_enabled;  /**< whether trace zones are recorded, see trace_start */
+
+void trace_record(const char *name, const char *category, int index, chrono::steady_clock::time_point start,
+  chrono::steady_clock::time_point end);
+  /**<
+   Records finished trace zone, used by trace_zone.
+   */
+
+class trace_zone       /**< scoped trace zone, recorded as Chrome trace event from construction to destruction when tracing is enabled */
+  {
+    protected:
+      const char *name;
+      const char *category;
+      int index;
+      bool active;
+      chrono::steady_clock::time_point start;
+
+    public:
+      trace_zone(const char *name, const char *category, int index = -1)
+
+      /**<
+       Starts the zone, only a flag is checked when tracing is disabled.
+
+       @param name zone name, it must be a string literal (it is stored
+              as pointer)
+       @param category zone category (e.g. load, render), also a literal
+       @param index number shown as argument of the zone (e.g. row
+              number), -1 for none
+       */
+
+        {
+          this->active = trace_enabled.load(memory_order_relaxed);
+
+          if (this->active)
+            {
+              this->name = name;
+              this->category = category;
+              this->index = index;
+              this->start = chrono::steady_clock::now();
+            }
+        }
+
+      ~trace_zone()
+        {
+          if (this->active)
+            trace_record(this->name,this->category,this->index,this->start,chrono::steady_clock::now());
+        }
+  };
+
+#define TRACE_ZONE(name,category) trace_zone trace_zone_scope(name,category)
+
+void trace_start();
+  /**<
+   Clears the recorded events and enables recording of the trace zones.
+   */
+
+bool trace_stop(string filename);
+  /**<
+   Disables recording and writes the recorded zones to Chrome trace
+   event JSON file (chrome://tracing, Perfetto UI).
+
+   @param filename name of the file
+   @return true if the file was written, false otherwise
+   */
+
+bool phase_counters_start();
+  /**<
+   Opens the perf_event_open counters (task clock, cycles, instructions,
+   cache misses, branch misses) for the current thread and starts
+   attributing them to render phases, the counters that can't be opened
+   (e.g. hardware counters in containers) are reported as -1.
+
+   @return true if at least one counter could be opened (only on Linux)
+   */
+
+void phase_counters_stop(phase_counters result[PHASE_COUNT]);
+  /**<
+   Stops and closes the current thread counters, the counts per phase
+   are written to result.
+   */
+
+render_phase phase_counters_switch(render_phase phase);
+  /**<
+   Attributes the counts since the last switch to the current phase and
+   makes given phase current, used by phase_scope.
+
+   @return the previous phase
+   */
+
+extern thread_local bool phase_counters_active;   /**< whether the current thread counts phases */
+
+class phase_scope      /**< scope attributed to given render phase, the previous phase is restored at the end */
+  {
+    protected:
+      render_phase previous;
+
+    public:
+      phase_scope(render_phase phase)
+        {
+          this->previous = PHASE_OTHER;
+
+          if (phase_counters_active)
+            this->previous = phase_counters_switch(phase);
+        }
+
+      ~phase_scope()
+        {
+          if (phase_counters_active)
+            phase_counters_switch(this->previous);
+        }
+  };
+
+#if RENDER_STATISTICS
+  extern thread_local render_statistics thread_render_statistics;  /**< counters of the current thread, merged by render */
+  #define COUNT_STATISTIC(counter) (thread_render_statistics.counter++)
+  #define COUNT_STATISTIC_ADD(counter,value) (thread_render_statistics.counter += (value))
+  #define PHASE_SCOPE_NAME(line) phase_scope_instance_##line
+  #define PHASE_SCOPE_LINE(phase,line) phase_scope PHASE_SCOPE_NAME(line)(phase)
+  #define PHASE_SCOPE(phase) PHASE_SCOPE_LINE(phase,__LINE__)   // unique name so that a scope can be nested in the same block
+#else
+  #define COUNT_STATISTIC(counter) ((void) 0)
+  #define COUNT_STATISTIC_ADD(counter,value) ((void) 0)
+  #define PHASE_SCOPE(phase) ((void) 0)
+#endif
+
+#define PROGRESS_INTERVAL 0.5      /**< default minimum time between progress callbacks in seconds */
+#define PROGRESS_SMOOTHING 0.1     /**< weight of the newest work unit in the smoothed rays/s and unit cost */
+
+typedef struct         /**< render progress passed to the progress callback */
+  {
+    unsigned int completed_units;  /**< finished work units (rows) */
+    unsigned int total_units;
+    double elapsed_seconds;
+    double rays_per_second;        /**< smoothed ray throughput, 0 when RENDER_STATISTICS is 0 */
+    double eta_seconds;            /**< estimated remaining time, -1 before the first unit is finished */
+  } render_progress;
+
+class progress_reporter  /**< collects the completed work units of a render and reports the progress at limited rate, thread safe */
+  {
+    protected:
+      mutex lock;
+      void (* callback)(render_progress);
+      double interval;
+      chrono::steady_clock::time_point start;
+      double last_report;            /**< elapsed seconds at the last callback, negative if none yet */
+      double unit_cost;              /**< smoothed seconds of one unit */
+      double last_unit_end;          /**< elapsed seconds when the last unit was finished */
+      render_progress progress;
+
+    public:
+      progress_reporter(void (* callback)(render_progress), unsigned int total_units, double interval);
+
+      /**<
+       Class constructor, initialises new object and starts measuring the
+       elapsed time.
+
+       @param callback function called with the progress, NULL for none,
+              it is called under a lock so it doesn't have to be
+              thread safe
+       @param total_units number of work units of the render
+       @param interval minimum time between the callbacks in seconds
+              (the last unit is always reported)
+       */
+
+      void unit_done(unsigned long long rays);
+
+      /**<
+       Records a finished work unit and calls the callback if the
+       interval has passed since the last call. The ETA extrapolates the
+       smoothed cost of the recently finished units to the remaining
+       ones, as neighbouring units tend to cost about the same.
+
+       @param rays number of rays cast for the unit
+       */
+
+      render_progress get_progress();
+  };
+
+typedef struct         /**< texture cache statistics */
+  {
+    unsigned long long hits;
+    unsigned long long misses;
+    unsigned long long evictions;
+    size_t bytes_used;        /**< memory currently used by the cached tiles */
+    size_t peak_bytes_used;
+  } texture_cache_statistics;
+
+class paged_texture;
+
+class texture_cache                 /**< cache of texture tiles loaded on demand, with memory budget and LRU eviction, thread safe */
+  {
+    protected:
+      typedef struct
+        {
+          shared_ptr<const vector<unsigned int> > texels;
+          list<uint64_t>::iterator position;   /**< position in the LRU list */
+        } cache_entry;
+
+      mutex lock;
+      size_t budget;
+      unsigned int texture_count;
+      list<uint64_t> lru;           /**< tile keys, most recently used first */
+      unordered_map<uint64_t,cache_entry> tiles;
+      texture_cache_statistics statistics;
+
+    public:
+      texture_cache(size_t budget);
+
+      /**<
+       Class constructor, initialises new object.
+
+       @param budget maximum memory in bytes the cached tiles can take,
+              the tiles that are being sampled are always kept alive
+              even if the budget is exceeded
+       */
+
+      unsigned int register_texture();
+
+      /**<
+       Gets a new unique texture id, used by paged_texture.
+       */
+
+      shared_ptr<const vector<unsigned int> > get_tile(paged_texture *texture, unsigned int level, unsigned int tile_x, unsigned int tile_y);
+
+      /**<
+       Gets the texels of given texture tile, loading it from the disk
+       if it isn't cached.
+
+       @return the tile texels (by rows), empty pointer if the tile
+               couldn't be loaded
+       */
+
+      void set_budget(size_t budget);
+      texture_cache_statistics get_statistics();
+      void print_statistics(ostream &output);
+
+      /**<
+       Prints the lookups, hit rate, evictions and memory use of the
+       cache as one human readable line.
+       */
+
+      void clear();
+  };
+
+class paged_texture                 /**< texture stored in pre-tiled file, its tiles are paged in through texture_cache */
+  {
+    protected:
+      FILE *file;
+      mutex file_lock;
+      texture_cache *cache;
+      unsigned int id;
+      unsigned int tile_size;
+      vector<paged_texture_level> levels;
+
+      unsigned int get_texel(unsigned int level, int x, int y, shared_ptr<const vector<unsigned int> > &tile, int &tile_x, int &tile_y);
+      void sample_bilinear(unsigned int level, double u, double v, double result[3]);
+
+    public:
+      paged_texture();
+      ~paged_texture();
+      paged_texture(const paged_texture &) = delete;
+      paged_texture &operator=(const paged_texture &) = delete;
+
+      bool open(string filename, texture_cache *cache);
+
+      /**<
+       Opens the pre-tiled texture file, only the header is read, the
+       tiles are read when needed.
+
+       @param filename name of the file written by save_paged_texture
+       @param cache cache the tiles will be kept in, it must exist as
+              long as the texture is used
+       @return true if the file was opened, false otherwise
+       */
+
+      bool read_tile(unsigned int level, unsigned int tile_x, unsigned int tile_y, vector<unsigned int> &texels);
+
+      /**<
+       Reads given tile from the file (without the cache).
+       */
+
+      unsigned int get_width();
+      unsigned int get_height();
+      unsigned int get_id();
+      size_t get_tile_bytes();
+
+      void sample(double u, double v, double level, unsigned char *red, unsigned char *green, unsigned char *blue);
+
+      /**<
+       Samples the texture with trilinear filtering, like
+       color_buffer_sample_trilinear.
+       */
+  };
+
+bool save_paged_texture(t_color_buffer *buffer, string filename, unsigned int tile_size);
+  /**<
+   Writes the buffer with all its mipmap levels to pre-tiled texture
+   file that can be paged in by paged_texture.
+
+   @param buffer image to be written
+   @param filename name of the file
+   @param tile_size tile width and height in texels, e.g.
+          PAGED_TEXTURE_TILE_SIZE
+   @return true if the file was written, false otherwise
+   */
+
+class texture_registry              /**< decoded 2D textures shared by file name, each file is decoded once, in parallel on a thread pool */
+  {
+    protected:
+      typedef struct
+        {
+          shared_ptr<t_color_buffer> texture;   /**< empty if the file couldn't be decoded */
+          bool done;
+        } registry_entry;
+
+      mutex lock;
+      condition_variable work_available;
+      condition_variable work_done;
+      unordered_map<string,registry_entry> entries;
+      deque<string> queue;          /**< file names waiting for decoding */
+      vector<thread> workers;
+      unsigned int thread_count;
+      unsigned int decode_count;
+      bool stopping;
+
+      void worker_loop();
+      static shared_ptr<t_color_buffer> decode(string filename);
+
+    public:
+      texture_registry(unsigned int threads);
+
+      /**<
+       Class constructor, initialises new object, the worker threads are
+       started with the first request.
+
+       @param threads number of decoding threads, 0 means the number of
+              hardware threads
+       */
+
+      ~texture_registry();
+      texture_registry(const texture_registry &) = delete;
+      texture_registry &operator=(const texture_registry &) = delete;
+
+      void request(string filename);
+
+      /**<
+       Queues the PNG file for decoding in the background, nothing is
+       done if the file has already been requested. Requesting all the
+       textures of a scene before getting them makes them decode in
+       parallel.
+       */
+
+      shared_ptr<t_color_buffer> get(string filename);
+
+      /**<
+       Gets the decoded texture (with its tiled copy already built), the
+       file is requested if it hasn't been and the call waits until it
+       is decoded. All calls with the same file name share one buffer,
+       it is freed when neither the registry nor any mesh holds it.
+
+       @return decoded texture, empty pointer if the file couldn't be
+               loaded
+       */
+
+      unsigned int get_decode_count();
+
+      /**<
+       Gets the number of decoded files so far, for checking that
+       nothing is decoded twice.
+       */
+
+      void clear();
+
+      /**<
+       Waits for the queued decodes and releases the registry references
+       to the textures, the ones still used by meshes stay alive.
+       */
+  };
+
+class mapped_file                   /**< file mapped to memory, private (copy-on-write) so the data can be modified in memory */
+  {
+    protected:
+      void *data;
+      size_t size;
+
+    public:
+      mapped_file();
+      ~mapped_file();
+      mapped_file(const mapped_file &) = delete;
+      mapped_file &operator=(const mapped_file &) = delete;
+
+      bool map(string filename);
+
+      /**<
+       Maps given file to memory, previously mapped file is unmapped.
+       On systems without mmap the file is read to memory instead.
+
+       @param filename name of the file
+       @return true if the file was mapped, false otherwise
+       */
+
+      void unmap();
+      void *get_data();
+      size_t get_size();
+  };
+
+template <class T> class mesh_array /**< array of mesh data, either owning its items or viewing external (e.g. mapped) memory */
+  {
+    protected:
+      vector<T> storage;
+      T *items;                     /**< points either to storage or to external memory */
+      size_t count;
+      bool external;
+
+      void sync()
+        {
+          this->items = this->storage.data();
+          this->count = this->storage.size();
+        }
+
+      void make_own()               // copies external items to storage so that the array can change size
+        {
+          if (!this->external)
+            return;
+
+          this->storage.assign(this->items,this->items + this->count);
+          this->external = false;
+          this->sync();
+        }
+
+    public:
+      mesh_array()
+        {
+          this->items = 0;
+          this->count = 0;
+          this->external = false;
+        }
+
+      mesh_array(const mesh_array &other)
+        {
+          this->external = false;
+          *this = other;
+        }
+
+      mesh_array &operator=(const mesh_array &other)
+        {
+          if (this == &other)
+            return *this;
+
+          // a copy always owns its items so that modifying it doesn't modify the original
+          this->storage.assign(other.items,other.items + other.count);
+          this->external = false;
+          this->sync();
+          return *this;
+        }
+
+      size_t size() const                           { return this->count; }
+      T &operator[](size_t index)                   { return this->items[index]; }
+      const T &operator[](size_t index) const       { return this->items[index]; }
+      T *data()                                     { return this->items; }
+      bool is_external() const                      { return this->external; }
+      void reserve(size_t size)                     { this->make_own(); this->storage.reserve(size); this->sync(); }
+      void resize(size_t size)                      { this->make_own(); this->storage.resize(size); this->sync(); }
+      void push_back(const T &item)                 { this->make_own(); this->storage.push_back(item); this->sync(); }
+
+      void clear()
+        {
+          this->storage.clear();
+          this->external = false;
+          this->sync();
+        }
+
+      void set_external(T *items, size_t count)
+
+      /**<
+       Makes the array view given memory without copying it, the memory
+       must stay valid for as long as the array uses it.
+       */
+
+        {
+          this->storage.clear();
+          this->items = items;
+          this->count = count;
+          this->external = true;
+        }
+  };
+
+typedef enum                        /**< shape of light_3D, the area lights cast soft shadows */
+  {
+    LIGHT_POINT,
+    LIGHT_SPHERE,
+    LIGHT_DISK,
+    LIGHT_RECTANGLE
+  } light_shape;
+
+typedef struct                      /**< node of the light tree, bounds the lights under it */
+  {
+    point_3D box_min;
+    point_3D box_max;
+    double intensity;               /**< sum of the light intensities */
+    double distance_factor;         /**< maximum distance_factor of the lights */
+    unsigned int children[2];       /**< indices of the child nodes of inner nodes */
+    int light;                      /**< index of the light for leaves, -1 for inner nodes */
+  } light_tree_node;
+
+typedef struct                      /**< cube shadow map of a light, see scene_3D::set_shadow_maps */
+  {
+    unsigned int resolution;        /**< width and height of each face in texels */
+    vector<float> depth;            /**< faces +x, -x, +y, -y, +z, -z by rows, depth (distance along the face axis from the light) of the nearest surface */
+  } shadow_map;
+
 class light_3D                      /**< light in 3D */
   {
     protected:
-      point_3D position;
+      point_3D position;            /**< center for the area lights */
       double intensity;
       color light_color;
+      light_shape shape;
+      double radius;                /**< sphere and disk radius */
+      point_3D normal;              /**< disk normal */
+      point_3D edges[2];            /**< rectangle edges */
 
     public:
       double distance_factor;       /**< says how the distance affects the light intensity (distance where the intensity fades to zero) */
 
       light_3D();
       point_3D get_position();
+      light_shape get_shape();
+      void set_point();
+
+      /**<
+       Makes the light a point light (default), its shadows are hard
+       unless the scene shadow range is set.
+       */
+
+      void set_sphere(double radius);
+
+      /**<
+       Makes the light a sphere centered at its position.
+       */
+
+      void set_disk(double radius, point_3D normal);
+
+      /**<
+       Makes the light a disk centered at its position, both its sides
+       emit light.
+       */
+
+      void set_rectangle(point_3D edge1, point_3D edge2);
+
+      /**<
+       Makes the light a rectangle centered at its position, both its
+       sides emit light. The spherical rectangle sampling relies on
+       perpendicular edges, so the part of edge2 parallel to edge1 is
+       removed (keeping the area of the parallelogram they span).
+
+       @param edge1 vector of the first edge
+       @param edge2 vector of the second edge, perpendicular to edge1
+       */
+
+      double sample_point(point_3D from, point_3D &sample);
+
+      /**<
+       Picks a random point of the light as seen from given point. The
+       sphere and rectangle are sampled uniformly by the solid angle
+       they cover (the cone of the sphere and the spherical rectangle),
+       the disk uniformly by its area.
+
+       @param from point the light is seen from
+       @param sample in this variable the point of the light will be
+              returned
+       @return weight of the sample, proportional to the solid angle
+               the sample represents divided by its probability, so the
+               weighted average of the shadow ray results is the
+               visible fraction of the light, 1 except for the disk
+       */
+
       color get_color();
       void set_intensity(double intensity);
       /**<
@@ -98,6 +811,13 @@ class light_3D                      /**< light in 3D */
        */
 
       double get_intensity();
+      double get_size();
+
+      /**<
+       Gets the radius of the light, i.e. of the sphere or disk, half
+       the longer diagonal of the rectangle, 0 for a point light.
+       */
+
       void set_color(unsigned char r, unsigned char g, unsigned char b);
       void set_position(double x, double y, double z);
   };
@@ -155,7 +875,10 @@ class mesh_3D                       /**< 3D object made of triangles */
   {
     protected:
       t_color_buffer *texture;
+      shared_ptr<t_color_buffer> texture_handle;  /**< keeps shared texture alive */
+      paged_texture *paged;
       texture_3D *tex_3D;
+      shared_ptr<mapped_file> mapping;  /**< mapped mesh cache the vertices and indices may point to */
 
     public:
       material mat;
@@ -163,17 +886,160 @@ class mesh_3D                       /**< 3D object made of triangles */
       point_3D bounding_sphere_center;
       double bounding_sphere_radius;
 
-      vector<vertex_3D> vertices;
-      vector<unsigned int> triangle_indices;
+      mesh_array<vertex_3D> vertices;
+      mesh_array<unsigned int> triangle_indices;
+      mesh_array<material> materials;                   /**< material table, e.g. loaded from mtl file */
+      mesh_array<unsigned short> triangle_materials;    /**< material id (index to materials or MESH_DEFAULT_MATERIAL) of each triangle, empty if all triangles use mat */
+      vector<string> material_names;
+      vector<string> material_files;                    /**< mtl files referenced by the loaded obj file, the mesh cache depends on them */
 
       mesh_3D();
       material get_material();
+      material get_triangle_material(unsigned int triangle);
+
+      /**<
+       Gets the material of given triangle.
+
+       @param triangle triangle number (i.e. index to triangle_indices
+              divided by 3)
+       @return the triangle material: mat with the members defined by
+               the triangle material table entry replaced, or just mat
+               if the triangle doesn't have any, so changes of mat made
+               after loading apply to all triangles
+       */
+
+      bool load_mtl(string filename);
+
+      /**<
+       Loads materials from mtl file and adds them to the material
+       table. Diffuse (Kd), ambient (Ka) and specular (Ks) colors,
+       specular exponent (Ns), dissolve (d, Tr), optical density (Ni)
+       and reflective illumination models (illum) are used, the other
+       properties are taken from mat when the triangle material is
+       requested. Texture maps are ignored.
+
+       @param filename name of the mtl file
+       @return true if the file was loaded, false otherwise
+       */
+
       void update_bounding_sphere();
       void set_texture(t_color_buffer *texture);
+
+      /**<
+       Sets the 2D texture of the mesh, its tiled copy (with mipmaps)
+       used for sampling is built if it doesn't exist yet.
+
+       @param texture texture, it must exist as long as the mesh is
+              rendered
+       */
+
+      void set_texture(shared_ptr<t_color_buffer> texture);
+
+      /**<
+       Sets the 2D texture shared with other meshes (e.g. from
+       texture_registry), the mesh keeps it alive.
+       */
+
       t_color_buffer *get_texture();
+      void set_paged_texture(paged_texture *texture);
+
+      /**<
+       Sets out-of-core 2D texture of the mesh, it is used instead of the
+       texture set by set_texture.
+
+       @param texture texture, it must exist as long as the mesh is
+              rendered, 0 to unset
+       */
+
+      paged_texture *get_paged_texture();
       void set_texture_3D(texture_3D *texture);
       texture_3D *get_texture_3D();
       bool load_obj(string filename);
+
+      /**<
+       Loads the mesh from obj file. The material libraries (mtllib) are
+       loaded to the material table and the usemtl statements set the
+       triangle material ids.
+
+       @param filename name of the obj file
+       @return true if the mesh was loaded, false otherwise
+       */
+
+      bool save_binary(string filename, bool store_bounding_sphere, string source_filename = "");
+
+      /**<
+       Saves the mesh geometry and materials to binary mesh cache file
+       that can be loaded without parsing with load_binary.
+
+       @param filename name of the file
+       @param store_bounding_sphere whether to store the computed
+              bounding sphere (acceleration data) too
+       @param source_filename obj file the mesh was loaded from, if
+              given its modification time and size are recorded along
+              with those of material_files
+       @return true if the file was written, false otherwise
+       */
+
+      bool load_binary(string filename, string source_filename = "");
+
+      /**<
+       Loads the mesh from binary mesh cache file. The file is mapped to
+       memory and the vertices, indices and materials point directly to
+       it, they are only copied when the mesh changes size.
+
+       @param filename name of the file
+       @param source_filename if given, the cache is only loaded if it
+              was saved with this source file and none of its source
+              files (the obj and mtl files) has changed its modification
+              time or size since
+       @return true if the file was loaded, false if it couldn't be
+               opened, is of different version or layout or is out of
+               date
+       */
+
+      bool load_obj_cached(string filename);
+
+      /**<
+       Loads the mesh from obj file through the binary cache file (the
+       obj filename with MESH_CACHE_EXTENSION appended). The cache is
+       regenerated if it is missing, invalid or if the obj file or one
+       of its mtl files has changed.
+
+       @param filename name of the obj file
+       @return true if the mesh was loaded, false otherwise
+       */
+
+      bool load_stl(string filename, bool weld, bool smooth_normals);
+
+      /**<
+       Loads the mesh from binary or ASCII stl file, the format is
+       detected automatically. Binary triangle records are streamed
+       directly to the vertex and index arrays.
+
+       @param filename name of the stl file
+       @param weld whether to merge vertices with the same position (and
+              the same normal if smooth_normals is false) instead of
+              storing three vertices per triangle
+       @param smooth_normals if true, vertex normals are averaged from
+              the (area weighted) normals of all facets sharing the
+              vertex position, otherwise facet normals are used
+       @return true if the mesh was loaded, false otherwise
+       */
+
+      bool load_ply(string filename);
+
+      /**<
+       Loads the mesh from binary little-endian ply file. The file is
+       mapped to memory and the vertex and face elements are converted
+       in bulk. Vertex normals (nx, ny, nz) and texture coordinates
+       (u, v, s, t or texture_u, texture_v) are loaded if present,
+       otherwise the normals are computed from the faces. Polygons are
+       triangulated as fans, other elements are skipped.
+
+       @param filename name of the ply file
+       @return true if the mesh was loaded, false otherwise
+       */
+
       void translate(double x, double y, double z);
       void rotate(double angle, rotation_type type);
       void scale(double x, double y, double z);
@@ -250,6 +1116,112 @@ class line_3D
       bool intersects_sphere(point_3D center, double radius);
   };
 
+typedef struct         /**< nearest surface hit by a ray, everything the shading needs except the material */
+  {
+    bool found;                   /**< false if the ray hit nothing, the other members are then undefined */
+    unsigned int mesh;            /**< index of the mesh in the scene */
+    unsigned int triangle;        /**< triangle number (index to triangle_indices divided by 3) */
+    double barycentric[3];
+    double distance;              /**< distance from the ray origin */
+    point_3D position;
+    point_3D normal;              /**< interpolated normal */
+    point_3D incoming;            /**< normalized vector from the hit towards the ray origin */
+    color texture_color;          /**< sampled texture color, white for meshes without texture */
+  } ray_hit;
+
+typedef struct         /**< entry of the visibility buffer, the nearest triangle rasterized at a pixel */
+  {
+    int mesh;                     /**< index of the mesh in the scene, -1 if no triangle covers the pixel, VISIBILITY_AMBIGUOUS if the pixel has to be traced */
+    unsigned int triangle;        /**< index to triangle_indices of the first vertex */
+  } visibility_sample;
+
+typedef struct         /**< last triangle that blocked a shadow ray towards a light */
+  {
+    int mesh;                     /**< index of the mesh in the scene, -1 if there is no occluder yet */
+    unsigned int triangle;        /**< index to triangle_indices of the first vertex */
+  } shadow_occluder;
+
+typedef struct         /**< features of the first hit of each pixel (by rows) that guide the denoiser */
+  {
+    unsigned int width;
+    unsigned int height;
+    vector<float> albedo;         /**< RGB in <0,1>, the background color where nothing was hit */
+    vector<float> normal;         /**< xyz, zero where nothing was hit */
+    vector<float> depth;          /**< distance from the camera, negative where nothing was hit */
+  } aux_buffers;
+
+#define DENOISE_ALBEDO_OFFSET 0.02  /**< added to the albedo the color is divided by so that dark surfaces don't amplify the noise */
+
+typedef struct         /**< parameters of the edge-aware a-trous denoiser */
+  {
+    unsigned int iterations;      /**< filter passes, the kernel spacing doubles each pass (5 covers about 125 pixels) */
+    double sigma_color;           /**< color (lighting) difference tolerance of the first pass, halved each pass */
+    double normal_exponent;       /**< exponent of the normal dot product, higher preserves more geometric edges */
+    double sigma_depth;           /**< relative depth difference tolerance per pixel of distance */
+    double sigma_albedo;          /**< albedo difference tolerance */
+  } denoise_parameters;
+
+denoise_parameters default_denoise_parameters();
+
+bool denoise(t_color_buffer *buffer, const aux_buffers &aux, denoise_parameters parameters);
+  /**<
+   Reduces the sampling noise of a rendered image with edge-avoiding
+   a-trous wavelet filter (Dammertz et al. 2010). The lighting (color
+   divided by the albedo) is filtered with weights from the color,
+   normal, depth and albedo differences and multiplied back by the
+   albedo, so texture detail and object edges are kept. Pixels where
+   nothing was hit are left as they are.
+
+   @param buffer rendered image, it is denoised in place
+   @param aux first hit features from the same render, see
+          scene_3D::set_aux_buffers
+   @param parameters filter parameters, e.g. default_denoise_parameters
+   @return false if the aux buffers don't match the image size
+   */
+
+typedef struct         /**< memory used by one mesh, in bytes */
+  {
+    size_t vertex_count;
+    size_t vertices;
+    size_t indices;
+    size_t materials;             /**< material table and triangle material ids */
+    size_t acceleration;          /**< bounding sphere */
+    size_t mapped;                /**< part of the above viewing the mapped mesh cache file instead of allocated memory */
+  } mesh_memory;
+
+typedef struct         /**< memory used by one 2D texture, in bytes */
+  {
+    unsigned int width;
+    unsigned int height;
+    size_t image;                 /**< full resolution RGB data */
+    size_t mipmaps;               /**< RGB mipmap levels */
+    size_t tiled;                 /**< tiled copy used for sampling, including its levels */
+    unsigned int users;           /**< meshes using the texture */
+  } texture_memory;
+
+typedef struct         /**< memory used by a scene, see scene_3D::get_memory_report */
+  {
+    vector<mesh_memory> meshes;       /**< in the order the meshes were added */
+    vector<texture_memory> textures;  /**< each texture counted once even if shared by more meshes */
+    size_t framebuffers;              /**< render output buffer (at the set resolution), allocated cost map, aux buffers, hit cache and visibility buffer */
+    size_t shadow_maps;               /**< allocated shadow maps */
+    size_t total;
+    size_t scene_peak;                /**< high-water mark of total, updated by add_mesh and by render after it allocates its buffers */
+    size_t process_peak;              /**< peak resident memory of the whole process, including loader and mipmap building temporaries, 0 if unknown */
+  } memory_report;
+
+size_t process_peak_memory();
+  /**<
+   Gets the peak resident memory of the process so far in bytes (from
+   getrusage), 0 if it can't be determined.
+   */
+
+void print_memory_report(const memory_report &report, ostream &output);
+  /**<
+   Prints the memory report as human readable table, one line per mesh
+   and texture.
+   */
+
 class scene_3D         /**< 3D scene with 3D objects, lights and rendering info */
   {
     protected:
@@ -269,20 +1241,139 @@ class scene_3D         /**< 3D scene with 3D objects, lights and rendering info
       double focal_distance;
       color background_color;
       unsigned int resolution[2];   /**< final picture resolution */
+      bool texture_filtering;       /**< whether 2D textures are sampled with trilinear filtering */
+      bool count_phases;            /**< whether render attributes perf_event_open counters to phases */
+      cost_metric cost_map_metric;
+      vector<double> cost_map;      /**< cost of each pixel of the last render, by rows */
+      bool report_memory;           /**< whether render prints the memory report at the start */
+      bool record_aux;              /**< whether render records the aux buffers */
+      aux_buffers aux;
+      bool cache_hits;              /**< whether render keeps the primary hits for relighting */
+      bool hit_cache_valid;
+      vector<ray_hit> hit_cache;    /**< primary hit of the central ray of each pixel, by rows */
+      unsigned int light_samples;   /**< lights sampled per shading point, 0 for all */
+      unsigned int adaptive_probes; /**< rays cast before deciding whether to cast the rest, 0 if adaptive sampling is off */
+      unsigned int adaptive_threshold;  /**< maximum probe color difference (per channel) considered agreeing */
+      vector<light_tree_node> light_tree;   /**< root first, built by render */
+      unsigned int shadow_map_resolution;   /**< face resolution of the shadow maps, 0 for ray-traced shadows */
+      bool rasterize_primary;       /**< whether render rasterizes the primary visibility */
+      vector<visibility_sample> visibility_buffer;   /**< by rows, built by render */
+
+      void build_visibility_buffer();
+
+      /**<
+       Rasterizes all the triangles from the camera (z-buffer) into the
+       visibility buffer, the pixels are sampled at the points the
+       central primary rays go through. The second nearest depth is kept
+       too and pixels where it is within VISIBILITY_TIE of the nearest
+       one (near ties, e.g. shared edges in the tolerance band or
+       coplanar triangles) are marked VISIBILITY_AMBIGUOUS, as the
+       rasterized depth order may differ from the traced one there.
+       */
+      vector<shadow_map> shadow_maps;       /**< one per light, built by render */
+
+      void build_shadow_maps();
+
+      /**<
+       Rasterizes the depth of all the triangles into the cube shadow
+       map of each light, or frees the maps if they are off.
+       */
+
+      double shadow_map_visibility(unsigned int light_index, point_3D position, point_3D normal, double light_size);
+
+      /**<
+       Approximates the visible fraction of a light from its shadow map
+       (percentage closer soft shadows): the texels around the point are
+       searched for blockers, their average depth gives the penumbra
+       width and that many texels around are filtered (PCF). The
+       filtering doesn't cross the cube faces.
+
+       @param light_index index of the light in the scene
+       @param position point to get the visibility of
+       @param normal surface normal at the point, the point is offset
+              along it to avoid the self shadowing
+       @param light_size radius of the light, 0 gives hard shadows
+       @return visible fraction of the light, 0.0 to 1.0
+       */
+
+      unsigned int build_light_tree_node(vector<unsigned int> &indices, unsigned int begin, unsigned int end);
+
+      /**<
+       Builds the light tree node of given lights by splitting them at
+       the median of the longest axis of their bounding box.
+
+       @return index of the node in light_tree
+       */
+
+      void build_light_tree();
+
+      int sample_light_tree(point_3D position, point_3D normal, double &pdf);
+
+      /**<
+       Randomly picks a light by descending the light tree, the child
+       nodes are chosen with probability proportional to their
+       estimated contribution (intensity and distance falloff at the
+       nearest point of their bounding box, lower if the box is behind
+       the surface).
+
+       @param position shaded point
+       @param normal surface normal at the point
+       @param pdf in this variable the probability of picking the light
+              will be returned
+       @return index of the light, -1 if no light can reach the point
+       */
+
+      void add_light_contribution(point_3D position, material &surface_material, point_3D surface_normal,
+        point_3D vector_to_camera, unsigned int light_index, double weight, int color_sum[3]);
+
+      /**<
+       Adds the diffuse and specular light of one light to color_sum,
+       the shadow rays are only cast if the light reaches the point (is
+       in range) and its diffuse or specular term isn't zero.
+
+       @param light_index index of the light in the scene
+       @param weight factor of the contribution, 1 unless the light was
+              sampled
+       */
+
+      size_t peak_memory;           /**< high-water mark of the scene memory total, see memory_report::scene_peak */
+      size_t mesh_memory_total;     /**< running total of the mesh and 2D texture memory, counted as the meshes are added */
+      vector<t_color_buffer *> memory_textures;  /**< textures already counted in mesh_memory_total */
 
-      bool cast_shadow_ray(point_3D position, light_3D light, double threshold, double range);
+      size_t get_buffer_memory() const;
 
       /**<
-       Cast a shadow ray to given light and checks if the point the
-       ray was casted from is vidible (lit) by the light.
+       Gets the memory of the render output buffer and the allocated
+       render buffers (see memory_report::framebuffers and shadow_maps).
+       */
+
+      void update_peak_memory(size_t temporary);
+
+      /**<
+       Updates the memory high-water mark with the mesh memory total,
+       the render buffers and given temporary memory not in the report.
+       Called by add_mesh and after the render buffers are allocated,
+       it doesn't walk the meshes so adding meshes stays linear.
+       */
+
+      bool cast_shadow_ray(point_3D position, point_3D light_position, double threshold,
+        shadow_occluder *occluder = 0);
+
+      /**<
+       Cast a shadow ray to given point of a light and checks if the
+       point the ray was casted from is vidible (lit) by the light.
 
        @param position position to cast the ray from
-       @param light light to be checked
+       @param light_position point of the light, see
+              light_3D::sample_point
        @param threshold distance to which the intersections don't count
               so that the triangles don't cast shadows on themselves due
               to numerical errors
-       @param range how much the ray should be altered (for distributed
-              shadow computation)
+       @param occluder if not 0, triangle that blocked the previous
+              shadow ray towards the same light: it is tested before
+              the traversal, as neighbouring points in shadow are mostly
+              blocked by the same triangle, and it is replaced by the
+              blocking triangle found by the traversal
        @return true if the ray hits the light without hitting any
                other object in the scene, false otherwise
        */
@@ -301,7 +1392,66 @@ class scene_3D         /**< 3D scene with 3D objects, lights and rendering info
        @return the computed color
        */
 
-      color cast_ray(line_3D line, double threshold, unsigned int recursion_depth);
+      bool find_nearest_hit(line_3D line, double threshold, ray_cone cone, ray_hit &hit);
+
+      /**<
+       Finds the nearest intersection of the ray with the scene and
+       interpolates the surface attributes (normal, texture color) at
+       it.
+
+       @param line line representing the ray
+       @param threshold distance to which intersections don't count
+       @param cone footprint of the ray used to choose the texture
+              mipmap level
+       @param hit in this variable the hit will be returned
+       @return true if the ray hit something, false otherwise
+       */
+
+      bool resolve_visible_hit(line_3D line, double threshold, ray_cone cone, visibility_sample sample, ray_hit &hit);
+
+      /**<
+       Turns a visibility buffer sample into the hit of the primary ray
+       of its pixel. The ray is intersected with the rasterized triangle
+       only, with the same computation as in find_nearest_hit, so the
+       hit is the same as the traced one.
+
+       @param line line representing the primary ray of the pixel
+       @param threshold distance to which intersections don't count
+       @param cone footprint of the ray
+       @param sample visibility buffer sample of the pixel
+       @param hit in this variable the hit (or a miss) will be returned
+       @return false if the rasterized triangle can't be confirmed (the
+               sample is ambiguous, the ray only hits it within the
+               rasterization tolerance or closer than threshold), the
+               ray then has to be traced
+       */
+
+      void complete_hit(line_3D &line, ray_cone cone, unsigned int mesh_index, unsigned int triangle_index, ray_hit &hit);
+
+      /**<
+       Fills in the mesh, triangle, incoming vector, interpolated normal
+       and texture color of a hit whose position, distance and
+       barycentric coordinates are set.
+
+       @param triangle_index index to triangle_indices of the first
+              vertex of the hit triangle
+       */
+
+      color shade_hit(const ray_hit &hit, unsigned int recursion_depth, ray_cone cone);
+
+      /**<
+       Computes the color of the surface hit by a ray: the lighting
+       (with shadow rays) with the material of the hit triangle and the
+       secondary rays.
+
+       @param hit hit found by find_nearest_hit
+       @param recursion_depth depth of recursion, 0 means no secondary
+              ray will be cast
+       @param cone footprint of the ray at its origin
+       @return computed color
+       */
+
+      color cast_ray(line_3D line, double threshold, unsigned int recursion_depth, ray_cone cone, ray_hit *primary_hit = 0);
 
       /**<
        Casts a ray and gets the color it hits (it is recursively
@@ -313,6 +1463,11 @@ class scene_3D         /**< 3D scene with 3D objects, lights and rendering info
               rays hit the surface they were cast from
        @param recursion depth depth of recursion, 0 means no secondary
               ray will be cast
+       @param cone footprint of the ray, it is propagated to the
+              secondary rays and used to choose the texture mipmap
+              level
+       @param primary_hit if not 0, the nearest hit of the ray is
+              recorded here
        @return computed color
        */
 
@@ -332,8 +1487,9 @@ class scene_3D         /**< 3D scene with 3D objects, lights and rendering info
               casting multiple shadow rays in slightly different
               directions and averaging them makes smooth shadows
        @param shadow_range if multiple shadow rays are being casted
-              from each point, this parameter says how much they should
-              differ
+              from each point, the point lights are treated as spheres
+              of this diameter for them (area lights use their own
+              shape)
        @param reflection_rays number of rays casted from the surface of
               materials with reflection
        @param reflection_range sets the range within which the
@@ -351,27 +1507,217 @@ class scene_3D         /**< 3D scene with 3D objects, lights and rendering info
               which the refraction rays will be generated
        */
 
-      void render(t_color_buffer *buffer, void (* progress_callback)(int));
+      render_statistics render(t_color_buffer *buffer, void (* progress_callback)(render_progress));
 
       /**<
        Renders the set up scene into given color buffer.
 
        @param buffer buffer to render the scene to, it must not be
               initialised
-       @param progress_callback function that will be called at the
-              beginning of processing of each line, the parameter is
-              the line number, this parameter can be NULL
+       @param progress_callback function that will be called with the
+              progress as the rows are finished, at most every
+              PROGRESS_INTERVAL seconds, this parameter can be NULL
+       @return counts of the rays and intersection tests of the render
        */
 
       void add_mesh(mesh_3D *mesh);
       void set_resolution(unsigned int width, unsigned int height);
       void add_light(light_3D *light);
       void set_focal_distance(float distance);
+      void set_texture_filtering(bool enabled);
+
+      /**<
+       Sets whether 2D textures are sampled with trilinear (mipmap)
+       filtering by the ray footprint or by the nearest pixel. The
+       filtering is enabled by default.
+       */
+
+      void set_phase_counters(bool enabled);
+
+      /**<
+       Sets whether render attributes the perf_event_open counters to
+       the render phases (traversal, shading, texture sampling), they
+       are reported in the render statistics. Each phase switch reads
+       the counters with a system call, so this makes the render
+       noticeably slower and the counts include some of that overhead.
+       */
+
+      memory_report get_memory_report() const;
+
+      /**<
+       Gets the memory used by the meshes (vertices, indices, materials,
+       acceleration data), their 2D textures, the render output buffer
+       at the set resolution and the render buffers allocated so far
+       (cost map, aux buffers, hit cache, visibility buffer, shadow
+       maps). Out-of-core textures are not included, their tiles are
+       accounted by their texture_cache.
+       */
+
+      void set_aux_buffers(bool enabled);
+
+      /**<
+       Sets whether render records the albedo, normal and depth of the
+       first hit of each pixel (of its central ray), used by denoise.
+       */
+
+      const aux_buffers &get_aux_buffers();
+
+      /**<
+       Gets the aux buffers of the last render, empty if they weren't
+       recorded.
+       */
+
+      void set_adaptive_sampling(unsigned int probes, unsigned int threshold);
+
+      /**<
+       Sets up adaptive distributed sampling: the shadow rays of a light
+       and the reflection and refraction rays of a hit start with given
+       number of probe rays and the rest of the rays is only cast if the
+       probes disagree, i.e. in penumbrae and where the glossy
+       reflections or refractions change. Off by default.
+
+       @param probes number of probe rays, less than 2 turns the
+              adaptive sampling off
+       @param threshold maximum difference of the reflection and
+              refraction probe colors (in each channel, 0 - 255) for
+              which they agree, the shadow probes agree if they are all
+              lit or all shadowed, DEFAULT_ADAPTIVE_THRESHOLD is a good
+              start
+       */
+
+      void set_primary_rasterization(bool enabled);
+
+      /**<
+       Sets the hybrid rendering: render rasterizes the meshes into a
+       visibility buffer (the triangle seen through each pixel) before
+       rendering and the central primary rays are resolved from it
+       instead of tracing them through the scene, only the secondary,
+       shadow and depth of field rays are traced. The hits are the same
+       as the traced ones, the pixels the rasterized triangle can't be
+       confirmed for are traced. Off by default.
+       */
+
+      void set_shadow_maps(unsigned int resolution);
+
+      /**<
+       Sets up approximate shadows for fast previews: render rasterizes
+       a cube shadow map of each light and the shadows are looked up in
+       them instead of casting shadow rays. The soft shadows of the area
+       lights and of shadow_range are approximated by filtering the
+       maps. The default (0) are the exact ray-traced shadows.
+
+       @param resolution width and height of each cube face in texels,
+              0 turns the shadow maps off
+       */
+
+      void set_light_samples(unsigned int count);
+
+      /**<
+       Sets how many lights are sampled for each shading point. With 0
+       (default) all the lights are evaluated, otherwise given number of
+       lights is picked randomly through the light tree with
+       probability proportional to their estimated contribution and
+       weighted by it, so the lighting cost stops growing with the
+       number of lights at the price of noise.
+       */
+
+      void set_hit_cache(bool enabled);
+
+      /**<
+       Sets whether render keeps the primary hit (mesh, triangle,
+       position, normal, texture color) of the central ray of each
+       pixel. The following renders then only shade the cached hits,
+       skipping the primary visibility and texture sampling, so changes
+       of the lights and materials are re-rendered faster. The result is
+       the same as from a full render with the same random seed.
+
+       The cache is invalidated by the scene when the meshes, camera,
+       resolution or texture filtering change through the scene. Changes
+       of the meshes or their textures made directly on mesh_3D need
+       invalidate_hit_cache.
+       */
+
+      void invalidate_hit_cache();
+
+      void set_memory_report(bool enabled);
+
+      /**<
+       Sets whether render prints the memory report to the standard
+       output after allocating its buffers, before tracing, disabled by
+       default.
+       */
+
+      void set_cost_map(cost_metric metric);
+
+      /**<
+       Sets whether render records the cost of each pixel and which one.
+       The ray and test counts fall back to time when the statistics are
+       compiled out.
+       */
+
+      const vector<double> &get_cost_map();
+
+      /**<
+       Gets the pixel costs of the last render (by rows), empty if no
+       cost map was recorded.
+       */
+
+      bool save_cost_heatmap(string filename);
+
+      /**<
+       Writes the cost map of the last render as false color png, on
+       logarithmic scale from the cheapest (black) to the most expensive
+       (white) pixel.
+
+       @param filename name of the png file
+       @return true if the file was written, false if there is no cost
+               map or the file couldn't be written
+       */
+
       void set_background_color(unsigned char r, unsigned char g, unsigned char b);
       void camera_translate(double x, double y, double z);
       void camera_rotate(double angle, rotation_type type);
   };
 
+class gltf_model       /**< meshes and textures imported from glTF 2.0 binary (.glb) file, owns them */
+  {
+    protected:
+      void clear();
+
+    public:
+      vector<mesh_3D *> meshes;         /**< one mesh per primitive of each node (instance) */
+      vector<t_color_buffer *> textures;
+
+      gltf_model();
+      ~gltf_model();
+      gltf_model(const gltf_model &) = delete;
+      gltf_model &operator=(const gltf_model &) = delete;
+
+      bool load_glb(string filename);
+
+      /**<
+       Loads the model from glTF 2.0 binary file. Triangle primitives of
+       all nodes of the default scene are loaded, the accessor data
+       (positions, normals, first texture coordinates and indices) are
+       read directly from the binary chunk. Each node the mesh is
+       instanced in gets its own mesh_3D with the node world transform
+       applied. The pbrMetallicRoughness materials are approximated by
+       the material struct and png base color textures (embedded or
+       external) are decoded. The model coordinates are kept as they
+       are in the file (+y up).
+
+       @param filename name of the glb file
+       @return true if the model was loaded, false otherwise
+       */
+
+      void add_to_scene(scene_3D *scene);
+
+      /**<
+       Adds all the model meshes to given scene, the model must exist as
+       long as the scene is used.
+       */
+  };
+
 void substract_vectors(point_3D vector1, point_3D vector2, point_3D &final_vector);
 double point_distance(point_3D a, point_3D b);
 int saturate_int(int value, int min, int max);
@@ -406,6 +1752,28 @@ void alter_vector(point_3D &what, double range);
    @param range range that affects how much the vector will be altered
    */
 
+void add_render_statistics(render_statistics &total, render_statistics part);
+  /**<
+   Adds the counters (and time) of part to total, used to merge the
+   counters of the threads.
+   */
+
+void print_render_statistics(render_statistics statistics, ostream &output);
+  /**<
+   Prints the statistics as a single line JSON object, with the derived
+   rays per second and tests per ray.
+   */
+
+long long file_modification_time(string filename);
+  /**<
+   Gets the file modification time.
+
+   @param filename name of the file
+   @return modification time in nanoseconds (with the resolution of the
+           file system, seconds on some platforms), -1 if the file
+           doesn't exist
+   */
+
 double random_double();
   /**<
    Returns random double in range <0,1>
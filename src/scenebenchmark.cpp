@@ -0,0 +1,405 @@
+/**
+ End-to-end scene benchmark.
+
+ Renders a fixed set of the demo and synthetic scenes at fixed
+ resolution and seed, reports the time, ray throughput (by ray type,
+ from the render statistics) and peak memory
+ of each render as JSON on the standard output and compares the images
+ against stored reference images. Optionally it checks that relighting
+ from the hit cache gives the same image as a full render, that
+ adaptive sampling stays close to the full sample budget and pages the
+ generated textures through a small out-of-core texture cache.
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <math.h>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <chrono>
+#include "raytracer.hpp"
+#include "scenes.hpp"
+
+#define RESOURCE_PATH "resources/"
+#define REFERENCE_PATH "references/"
+#define MODEL_PATH ""             // the model files are in the source root
+#define PAGED_TEXTURE_PATH ""     // the pre-tiled textures of -t are written to the working directory
+#define BENCHMARK_SEED 1
+#define BENCHMARK_WIDTH 240
+#define BENCHMARK_HEIGHT 180
+#define DEFAULT_MIN_PSNR 40.0     // dB, lower PSNR against the reference fails the check
+#define MAX_PSNR 100.0            // reported for identical images instead of infinity
+#define RELIGHT_INTENSITY 0.5     // factor the first light is dimmed by for the hit cache check
+#define DEFAULT_MIN_ADAPTIVE_PSNR 34.0  // dB against the full budget render, two full renders of spheres_2 with different seeds differ by 36.6 dB
+
+using namespace std;
+
+typedef struct
+  {
+    unsigned int scene_number;
+    unsigned int variant;
+  } benchmark_scene_id;
+
+const benchmark_scene_id benchmark_scenes[] =
+  {
+    {0, 2},     // scene 1, soft shadows
+    {1, 1},     // scene 2, distributed reflection
+    {2, 2},     // scene 3, distributed refraction
+    {3, 0},     // synthetic spheres
+    {3, 1},
+    {3, 2},
+    {3, 3},     // many lights
+    {3, 4},     // disk lights
+    {4, 0},     // synthetic terrain
+    {4, 1},
+    {5, 0},     // companion cube, stl loader
+    {5, 1},     // dodecahedron, ply loader
+    {5, 2}      // octahedra, glb loader
+  };
+
+bool compare_images(t_color_buffer *image, t_color_buffer *reference, double &rmse, double &psnr)
+
+  /**<
+   Computes RMSE (in 0-255 units over all channels) and PSNR of the
+   image against the reference.
+
+   @return false if the images have different sizes
+   */
+
+  {
+    unsigned int x, y;
+    unsigned char r1, g1, b1, r2, g2, b2;
+    double sum;
+
+    if (image->width != reference->width || image->height != reference->height)
+      return false;
+
+    sum = 0;
+
+    for (y = 0; y < image->height; y++)
+      for (x = 0; x < image->width; x++)
+        {
+          color_buffer_get_pixel(image,x,y,&r1,&g1,&b1);
+          color_buffer_get_pixel(reference,x,y,&r2,&g2,&b2);
+
+          sum += (r1 - r2) * (r1 - r2) + (g1 - g2) * (g1 - g2) + (b1 - b2) * (b1 - b2);
+        }
+
+    rmse = sqrt(sum / (3.0 * image->width * image->height));
+    psnr = rmse == 0 ? MAX_PSNR : min(MAX_PSNR,20 * log10(255.0 / rmse));
+
+    return true;
+  }
+
+int main(int argc, char **argv)
+  {
+    unsigned int i, count, light_samples, adaptive_probes, texture_budget;
+    string helper, only, reference_file, status, cache_status, adaptive_status;
+    bool update, failed, first, rasterize, check_cache;
+    double min_psnr, min_adaptive_psnr, seconds, rmse, psnr, cache_seconds, cache_rmse, cache_psnr, adaptive_seconds, adaptive_rmse,
+      adaptive_psnr;
+    unsigned long long adaptive_skipped;
+    render_statistics statistics;
+    texture_registry textures(0);
+
+    update = false;
+    rasterize = false;
+    check_cache = false;
+    light_samples = 0;
+    adaptive_probes = 0;
+    texture_budget = 0;
+    min_psnr = DEFAULT_MIN_PSNR;
+    min_adaptive_psnr = DEFAULT_MIN_ADAPTIVE_PSNR;
+
+    for (i = 1; i < (unsigned int) argc; i++)
+      {
+        helper = argv[i];
+
+        if (helper.compare("-h") == 0)
+          {
+            cout << "scene benchmark, usage:" << endl;
+            cout << "scenebenchmark [-u] [-p PSNR] [-n NAME] [-r] [-c] [-k N] [-a N [-q PSNR]] [-t KIB] | -h" << endl << endl;
+            cout << "-u writes the rendered images as new references." << endl;
+            cout << "-p sets the minimum PSNR (dB) against the reference (default " << DEFAULT_MIN_PSNR << ")." << endl;
+            cout << "-n renders only the scene with given name (e.g. spheres_1), useful to measure" << endl;
+            cout << "   its peak memory alone." << endl;
+            cout << "-r rasterizes the primary visibility, the images must still match the" << endl;
+            cout << "   references." << endl;
+            cout << "-c checks the hit cache: after each render the first light is dimmed, the" << endl;
+            cout << "   scene is re-rendered from the cached primary hits and compared with a" << endl;
+            cout << "   full render of the changed scene, any difference fails." << endl;
+            cout << "-k samples N lights per shading point through the light tree instead of" << endl;
+            cout << "   evaluating all of them (noisy, lower -p accordingly)." << endl;
+            cout << "-a also renders each scene with adaptive sampling with N probe rays and" << endl;
+            cout << "   compares it with the full sample budget render." << endl;
+            cout << "-q sets the minimum PSNR (dB) of the adaptive render against the full budget" << endl;
+            cout << "   one (default " << DEFAULT_MIN_ADAPTIVE_PSNR << ")." << endl;
+            cout << "-t samples the generated textures out-of-core, paged through a texture" << endl;
+            cout << "   cache with KIB KiB budget, the images must still match the references." << endl;
+            cout << "-h prints help." << endl << endl;
+            cout << "The results are written to the standard output as JSON, the exit status" << endl;
+            cout << "is 1 if some image differs from its reference or has no reference (or the" << endl;
+            cout << "hit cache or adaptive sampling check fails)." << endl;
+            return 0;
+          }
+        else if (helper.compare("-u") == 0)
+          {
+            update = true;
+          }
+        else if (helper.compare("-p") == 0 && i + 1 < (unsigned int) argc)
+          {
+            i++;
+            min_psnr = atof(argv[i]);
+          }
+        else if (helper.compare("-r") == 0)
+          {
+            rasterize = true;
+          }
+        else if (helper.compare("-c") == 0)
+          {
+            check_cache = true;
+          }
+        else if (helper.compare("-k") == 0 && i + 1 < (unsigned int) argc)
+          {
+            i++;
+            light_samples = atoi(argv[i]);
+          }
+        else if (helper.compare("-a") == 0 && i + 1 < (unsigned int) argc)
+          {
+            i++;
+            adaptive_probes = atoi(argv[i]);
+          }
+        else if (helper.compare("-q") == 0 && i + 1 < (unsigned int) argc)
+          {
+            i++;
+            min_adaptive_psnr = atof(argv[i]);
+          }
+        else if (helper.compare("-t") == 0 && i + 1 < (unsigned int) argc)
+          {
+            i++;
+            texture_budget = atoi(argv[i]);
+          }
+        else if (helper.compare("-n") == 0 && i + 1 < (unsigned int) argc)
+          {
+            i++;
+            only = argv[i];
+          }
+        else
+          {
+            cerr << "error: bad argument " << helper << endl;
+            return 1;
+          }
+      }
+
+    failed = false;
+    first = true;
+    count = sizeof(benchmark_scenes) / sizeof(benchmark_scene_id);
+
+    if (only.length() != 0)
+      {
+        for (i = 0; i < count; i++)
+          if (only.compare(demo_scene::get_name(benchmark_scenes[i].scene_number,benchmark_scenes[i].variant)) == 0)
+            break;
+
+        if (i >= count)
+          {
+            cerr << "error: no benchmark scene is named " << only << endl;
+            return 1;
+          }
+      }
+
+    cout << setprecision(10);
+    cout << "{" << endl;
+    cout << "  \"seed\": " << BENCHMARK_SEED << "," << endl;
+    cout << "  \"width\": " << BENCHMARK_WIDTH << "," << endl;
+    cout << "  \"height\": " << BENCHMARK_HEIGHT << "," << endl;
+    cout << "  \"min_psnr\": " << min_psnr << "," << endl;
+    cout << "  \"rasterize_primary\": " << (rasterize ? "true" : "false") << "," << endl;
+    cout << "  \"light_samples\": " << light_samples << "," << endl;
+    cout << "  \"adaptive_probes\": " << adaptive_probes << "," << endl;
+    cout << "  \"min_adaptive_psnr\": " << min_adaptive_psnr << "," << endl;
+    cout << "  \"texture_cache_kb\": " << texture_budget << "," << endl;
+    cout << "  \"check_hit_cache\": " << (check_cache ? "true" : "false") << "," << endl;
+    cout << "  \"scenes\": [";
+
+    for (i = 0; i < count; i++)
+      {
+        texture_cache tiles(texture_budget * 1024);
+        demo_scene scene(BENCHMARK_WIDTH,BENCHMARK_HEIGHT);
+        t_color_buffer image, reference;
+        texture_cache_statistics tile_statistics;
+
+        if (only.length() != 0 &&
+            only.compare(demo_scene::get_name(benchmark_scenes[i].scene_number,benchmark_scenes[i].variant)) != 0)
+          continue;
+
+        if (!scene.setup(benchmark_scenes[i].scene_number,benchmark_scenes[i].variant,&textures,RESOURCE_PATH,MODEL_PATH))
+          {
+            if (benchmark_scenes[i].scene_number < DEMO_SCENE_COUNT)
+              {
+                cerr << "skipping " << scene.name << ", its resources couldn't be loaded" << endl;
+                continue;
+              }
+
+            cerr << "error: couldn't set up scene " << benchmark_scenes[i].scene_number << ", variant " <<
+              benchmark_scenes[i].variant << endl;
+            failed = true;
+            continue;
+          }
+
+        cerr << "rendering " << scene.name << " (" << scene.info << ")" << endl;
+
+        if (texture_budget != 0 && !scene.page_textures(&tiles,PAGED_TEXTURE_PATH))
+          {
+            cerr << "error: couldn't page the textures of " << scene.name << endl;
+            failed = true;
+            continue;
+          }
+
+        scene.scene.set_primary_rasterization(rasterize);
+        scene.scene.set_hit_cache(check_cache);
+        scene.scene.set_light_samples(light_samples);
+
+        srand(BENCHMARK_SEED);
+
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        statistics = scene.scene.render(&image,NULL);
+        chrono::steady_clock::time_point end = chrono::steady_clock::now();
+
+        seconds = chrono::duration<double>(end - start).count();
+        tile_statistics = tiles.get_statistics();
+
+        if (texture_budget != 0)
+          tiles.print_statistics(cerr);
+
+        reference_file = REFERENCE_PATH + scene.name + ".png";
+        rmse = 0;
+        psnr = MAX_PSNR;
+        cache_seconds = 0;
+        cache_rmse = 0;
+        adaptive_seconds = 0;
+        adaptive_psnr = MAX_PSNR;
+        adaptive_skipped = 0;
+
+        if (update)
+          {
+            status = color_buffer_save_to_png(&image,(char *) reference_file.c_str()) ? "updated" : "error";
+          }
+        else if (!color_buffer_load_from_png(&reference,(char *) reference_file.c_str()))
+          {
+            status = "missing";
+          }
+        else
+          {
+            if (!compare_images(&image,&reference,rmse,psnr))
+              status = "size_mismatch";
+            else
+              status = psnr >= min_psnr ? "pass" : "fail";
+
+            color_buffer_destroy(&reference);
+          }
+
+        if (status.compare("pass") != 0 && status.compare("updated") != 0)
+          failed = true;     // including a missing reference, it has to be made with -u
+
+        if (adaptive_probes != 0)
+          {
+            t_color_buffer adaptive;
+            render_statistics adaptive_statistics;
+
+            scene.scene.set_adaptive_sampling(adaptive_probes,DEFAULT_ADAPTIVE_THRESHOLD);
+            srand(BENCHMARK_SEED);
+
+            start = chrono::steady_clock::now();
+            adaptive_statistics = scene.scene.render(&adaptive,NULL);
+            end = chrono::steady_clock::now();
+
+            adaptive_seconds = chrono::duration<double>(end - start).count();
+            adaptive_skipped = adaptive_statistics.adaptive_skipped_rays;
+
+            if (!compare_images(&adaptive,&image,adaptive_rmse,adaptive_psnr))
+              adaptive_status = "size_mismatch";
+            else
+              adaptive_status = adaptive_psnr >= min_adaptive_psnr ? "pass" : "fail";
+
+            if (adaptive_status.compare("pass") != 0)
+              failed = true;
+
+            scene.scene.set_adaptive_sampling(0,0);
+            color_buffer_destroy(&adaptive);
+          }
+
+        if (check_cache)
+          {
+            t_color_buffer relit, full;
+            light_3D *light = scene.get_light(0);
+
+            light->set_intensity(light->get_intensity() * RELIGHT_INTENSITY);
+
+            srand(BENCHMARK_SEED);
+
+            start = chrono::steady_clock::now();
+            scene.scene.render(&relit,NULL);     // from the hit cache
+            end = chrono::steady_clock::now();
+
+            cache_seconds = chrono::duration<double>(end - start).count();
+
+            scene.scene.invalidate_hit_cache();
+            srand(BENCHMARK_SEED);
+            scene.scene.render(&full,NULL);
+
+            if (!compare_images(&relit,&full,cache_rmse,cache_psnr))
+              cache_status = "size_mismatch";
+            else
+              cache_status = cache_rmse == 0 ? "pass" : "fail";
+
+            if (cache_status.compare("pass") != 0)
+              failed = true;
+
+            color_buffer_destroy(&relit);
+            color_buffer_destroy(&full);
+          }
+
+        cout << (first ? "" : ",") << endl;
+        first = false;
+
+        cout << "    {" << endl;
+        cout << "      \"name\": \"" << scene.name << "\"," << endl;
+        cout << "      \"wall_time_s\": " << seconds << "," << endl;
+        cout << "      \"statistics\": ";
+        print_render_statistics(statistics,cout);
+        cout << "," << endl;
+        cout << "      \"peak_memory_kb\": " << process_peak_memory() / 1024 << "," << endl;
+        cout << "      \"reference\": {\"status\": \"" << status << "\", \"rmse\": " << rmse <<
+          ", \"psnr\": " << psnr << "}" << (check_cache || adaptive_probes != 0 || texture_budget != 0 ? "," : "") << endl;
+
+        if (texture_budget != 0)
+          {
+            unsigned long long lookups = tile_statistics.hits + tile_statistics.misses;
+
+            cout << "      \"texture_cache\": {\"lookups\": " << lookups << ", \"hit_rate\": " <<
+              (lookups == 0 ? 0.0 : tile_statistics.hits / ((double) lookups)) << ", \"evictions\": " <<
+              tile_statistics.evictions << ", \"peak_kb\": " << tile_statistics.peak_bytes_used / 1024 << "}" <<
+              (check_cache || adaptive_probes != 0 ? "," : "") << endl;
+          }
+
+        if (adaptive_probes != 0)
+          cout << "      \"adaptive\": {\"status\": \"" << adaptive_status << "\", \"wall_time_s\": " <<
+            adaptive_seconds << ", \"skipped_rays\": " << adaptive_skipped << ", \"psnr\": " << adaptive_psnr << "}" <<
+            (check_cache ? "," : "") << endl;
+
+        if (check_cache)
+          cout << "      \"hit_cache\": {\"status\": \"" << cache_status <<
+            "\", \"relight_time_s\": " << cache_seconds << ", \"rmse\": " << cache_rmse << "}" << endl;
+
+        cout << "    }";
+
+        color_buffer_destroy(&image);
+      }
+
+    cout << endl << "  ]" << endl;
+    cout << "}" << endl;
+
+    return failed ? 1 : 0;
+  }
@@ -0,0 +1,955 @@
+#include "scenes.hpp"
+
+/*
+ The demo scenes load their meshes and textures from the resource
+ files, the synthetic scenes are generated so that they can be rendered
+ anywhere and are bigger (more triangles and meshes) than the demo ones.
+ */
+
+#define SPHERE_GRID 6             // the spheres scene has SPHERE_GRID^2 spheres
+#define TERRAIN_CHUNKS 8          // the terrain has TERRAIN_CHUNKS^2 meshes
+#define TERRAIN_CHUNK_QUADS 16    // each terrain mesh has TERRAIN_CHUNK_QUADS^2 quads
+#define TERRAIN_CHUNK_SIZE 5.0
+#define COMPANION_CUBE_FILE "Weighted_Companion_Cube.stl"
+#define COMPANION_CUBE_TRIANGLES 13376
+#define COMPANION_CUBE_VERTICES 6690      // after welding with smooth normals
+#define DODECAHEDRON_FILE "dodecahedron.ply"   // binary little-endian, 12 pentagons
+#define DODECAHEDRON_VERTICES 20
+#define DODECAHEDRON_FACES 12
+#define OCTAHEDRA_FILE "octahedra.glb"   // two instances (parent and child node) of one octahedron
+#define OCTAHEDRA_INSTANCES 2
+#define OCTAHEDRON_VERTICES 24            // flat shaded, three vertices per face
+#define OCTAHEDRON_TRIANGLES 8
+#define MANY_LIGHTS 200           // short-range lights of the many lights variant of the spheres
+
+static void make_uv_sphere(mesh_3D *mesh, unsigned int segments, unsigned int rings)
+
+  /**<
+   Makes unit sphere mesh with normals and texture coordinates.
+   */
+
+  {
+    unsigned int i, j, a;
+    double longitude, latitude;
+    vertex_3D vertex;
+
+    mesh->vertices.clear();
+    mesh->triangle_indices.clear();
+    mesh->triangle_materials.clear();
+
+    for (j = 0; j <= rings; j++)
+      for (i = 0; i <= segments; i++)
+        {
+          longitude = i / ((double) segments) * 2 * PI;
+          latitude = j / ((double) rings) * PI;
+
+          vertex.normal.x = sin(latitude) * cos(longitude);
+          vertex.normal.y = sin(latitude) * sin(longitude);
+          vertex.normal.z = cos(latitude);
+          vertex.position = vertex.normal;
+          vertex.texture_coords[0] = i / ((double) segments);
+          vertex.texture_coords[1] = j / ((double) rings);
+          vertex.texture_coords[2] = 0;
+
+          mesh->vertices.push_back(vertex);
+        }
+
+    for (j = 0; j < rings; j++)
+      for (i = 0; i < segments; i++)
+        {
+          a = j * (segments + 1) + i;
+
+          mesh->triangle_indices.push_back(a);
+          mesh->triangle_indices.push_back(a + segments + 1);
+          mesh->triangle_indices.push_back(a + 1);
+
+          mesh->triangle_indices.push_back(a + 1);
+          mesh->triangle_indices.push_back(a + segments + 1);
+          mesh->triangle_indices.push_back(a + segments + 2);
+        }
+
+    mesh->update_bounding_sphere();
+  }
+
+static double terrain_height(double x, double y, double relief)
+  {
+    return relief * (1.5 * sin(0.3 * x) * cos(0.25 * y) + 0.5 * sin(0.9 * x + 0.4 * y));
+  }
+
+static void make_terrain_chunk(mesh_3D *mesh, double x0, double y0, double relief)
+
+  /**<
+   Makes one square of the terrain height field, with normals from the
+   height function, relief 0 makes a flat square.
+   */
+
+  {
+    unsigned int i, j, a;
+    double step, x, y;
+    vertex_3D vertex;
+    point_3D dx, dy;
+
+    step = TERRAIN_CHUNK_SIZE / TERRAIN_CHUNK_QUADS;
+
+    for (j = 0; j <= TERRAIN_CHUNK_QUADS; j++)
+      for (i = 0; i <= TERRAIN_CHUNK_QUADS; i++)
+        {
+          x = x0 + i * step;
+          y = y0 + j * step;
+
+          vertex.position.x = x;
+          vertex.position.y = y;
+          vertex.position.z = terrain_height(x,y,relief);
+
+          dx.x = 2 * step;
+          dx.y = 0;
+          dx.z = terrain_height(x + step,y,relief) - terrain_height(x - step,y,relief);
+          dy.x = 0;
+          dy.y = 2 * step;
+          dy.z = terrain_height(x,y + step,relief) - terrain_height(x,y - step,relief);
+          cross_product(dx,dy,vertex.normal);
+          normalize(vertex.normal);
+
+          vertex.texture_coords[0] = x / TERRAIN_CHUNK_SIZE;
+          vertex.texture_coords[1] = y / TERRAIN_CHUNK_SIZE;
+          vertex.texture_coords[2] = 0;
+
+          mesh->vertices.push_back(vertex);
+        }
+
+    for (j = 0; j < TERRAIN_CHUNK_QUADS; j++)
+      for (i = 0; i < TERRAIN_CHUNK_QUADS; i++)
+        {
+          a = j * (TERRAIN_CHUNK_QUADS + 1) + i;
+
+          mesh->triangle_indices.push_back(a);
+          mesh->triangle_indices.push_back(a + 1);
+          mesh->triangle_indices.push_back(a + TERRAIN_CHUNK_QUADS + 2);
+
+          mesh->triangle_indices.push_back(a);
+          mesh->triangle_indices.push_back(a + TERRAIN_CHUNK_QUADS + 2);
+          mesh->triangle_indices.push_back(a + TERRAIN_CHUNK_QUADS + 1);
+        }
+
+    mesh->update_bounding_sphere();
+  }
+
+static shared_ptr<t_color_buffer> make_checker_texture(unsigned int size, unsigned int squares)
+  {
+    t_color_buffer *texture = new t_color_buffer;
+    unsigned int x, y;
+    bool dark;
+
+    color_buffer_init(texture,size,size);
+
+    for (y = 0; y < size; y++)
+      for (x = 0; x < size; x++)
+        {
+          dark = ((x * squares / size) + (y * squares / size)) % 2 == 0;
+
+          color_buffer_set_pixel(texture,x,y,dark ? 60 : 230,dark ? 70 : 220,dark ? 90 : 200);
+        }
+
+    return shared_ptr<t_color_buffer>(texture,[](t_color_buffer *buffer)
+      {
+        color_buffer_destroy(buffer);
+        delete buffer;
+      });
+  }
+
+static bool is_fan_triangulation(mesh_3D *mesh, unsigned int polygons, unsigned int sides)
+
+  /**<
+   Checks that the mesh triangles are the fan triangulation of given
+   number of polygons with given number of sides, i.e. that the
+   consecutive triangles of each polygon share the first vertex and
+   the edge to the next one.
+   */
+
+  {
+    unsigned int i, j, triangles;
+
+    triangles = sides - 2;
+
+    if (mesh->triangle_indices.size() != 3 * polygons * triangles)
+      return false;
+
+    for (i = 0; i < polygons; i++)
+      for (j = 1; j < triangles; j++)
+        {
+          unsigned int previous = 3 * (i * triangles + j - 1), current = previous + 3;
+
+          if (mesh->triangle_indices[current] != mesh->triangle_indices[previous] ||
+              mesh->triangle_indices[current + 1] != mesh->triangle_indices[previous + 2])
+            return false;
+        }
+
+    return true;
+  }
+
+demo_scene::demo_scene(unsigned int width, unsigned int height): scene(width,height)
+  {
+  }
+
+mesh_3D *demo_scene::new_mesh()
+  {
+    this->meshes.push_back(unique_ptr<mesh_3D>(new mesh_3D));
+    return this->meshes.back().get();
+  }
+
+light_3D *demo_scene::new_light()
+  {
+    this->lights.push_back(unique_ptr<light_3D>(new light_3D));
+    return this->lights.back().get();
+  }
+
+bool demo_scene::page_textures(texture_cache *cache, string path)
+  {
+    unsigned int i;
+    string filename = path + this->name + PAGED_TEXTURE_EXTENSION;
+
+    if (!this->generated_texture)
+      return true;
+
+    this->paged.reset(new paged_texture);
+
+    if (!save_paged_texture(this->generated_texture.get(),filename,PAGED_TEXTURE_TILE_SIZE) ||
+        !this->paged->open(filename,cache))
+      {
+        this->paged.reset();
+        return false;
+      }
+
+    for (i = 0; i < this->meshes.size(); i++)
+      if (this->meshes[i]->get_texture() == this->generated_texture.get())
+        this->meshes[i]->set_paged_texture(this->paged.get());
+
+    this->scene.invalidate_hit_cache();
+    return true;
+  }
+
+light_3D *demo_scene::get_light(unsigned int index)
+  {
+    return index < this->lights.size() ? this->lights[index].get() : NULL;
+  }
+
+unsigned int demo_scene::get_variant_count(unsigned int scene_number)
+  {
+    switch (scene_number)
+      {
+        case 0: return 5;
+        case 1: return 9;
+        case 2: return 5;
+        case 3: return 5;
+        case 4: return 2;
+        case 5: return 3;
+        default: return 0;
+      }
+  }
+
+string demo_scene::get_name(unsigned int scene_number, unsigned int variant)
+  {
+    string prefix;
+    unsigned int count = get_variant_count(scene_number);
+
+    switch (scene_number)
+      {
+        case 0: prefix = "scene1"; break;
+        case 1: prefix = "scene2"; break;
+        case 2: prefix = "scene3"; break;
+        case 3: prefix = "spheres"; break;
+        case 4: prefix = "terrain"; break;
+        case 5: prefix = "models"; break;
+        default: return "";
+      }
+
+    return prefix + "_" + to_string(min(variant,count - 1));
+  }
+
+bool demo_scene::setup(unsigned int scene_number, unsigned int variant, texture_registry *textures, string resource_path,
+  string model_path)
+  {
+    TRACE_ZONE("scene setup","load");
+
+    if (get_variant_count(scene_number) == 0)
+      return false;
+
+    variant = min(variant,get_variant_count(scene_number) - 1);
+    this->name = get_name(scene_number,variant);
+
+    switch (scene_number)
+      {
+        case 0: return this->setup_scene_1(variant,textures,resource_path);
+        case 1: return this->setup_scene_2(variant,textures,resource_path);
+        case 2: return this->setup_scene_3(variant,textures,resource_path);
+        case 3: return this->setup_spheres(variant);
+        case 4: return this->setup_terrain(variant);
+        case 5: return this->setup_models(variant,model_path);
+        default: return false;
+      }
+  }
+
+bool demo_scene::setup_scene_1(unsigned int variant, texture_registry *textures, string resource_path)
+  /* shadow demonstration, variant goes from 0 to 4:
+     0: hard shadows
+     1: soft shadows, few rays, small range
+     2: soft shadows, many rays, small range
+     3: soft shadows, few rays, high range
+     4: soft shadows, many rays, high range
+     */
+  {
+    mesh_3D *cube, *floor, *cup, *sphere;
+    light_3D *light, *light2;
+    shared_ptr<t_color_buffer> cube_texture, floor_texture;
+    bool loaded = true;
+
+    textures->request(resource_path + "compcube.png");
+    textures->request(resource_path + "floor.png");
+
+    cube = this->new_mesh();
+    sphere = this->new_mesh();
+    cup = this->new_mesh();
+    floor = this->new_mesh();
+    light2 = this->new_light();
+    light = this->new_light();
+
+    light->set_position(-6,-4,3);
+    light->set_intensity(0.7);
+    light->distance_factor = 100;
+
+    light2->set_position(6,3,3);
+    light2->set_intensity(0.4);
+    light2->distance_factor = 50;
+
+    color c1, c2;
+    c1.red = 255;
+    c1.green = 0;
+    c1.blue = 0;
+    c2.red = 0;
+    c2.green = 255;
+    c2.blue = 0;
+
+    this->checkers.reset(new texture_3D_checkers(c1,c2,1,true,true,false));
+
+    loaded = sphere->load_obj_cached(resource_path + "sphere.obj") && loaded;
+    sphere->scale(0.9,0.9,0.9);
+    sphere->translate(8.5,24,8);
+    sphere->mat.reflection = 0.5;
+    sphere->mat.specular_exponent = 50;
+    sphere->mat.specular_intensity = 1.0;
+
+    loaded = cup->load_obj_cached(resource_path + "cup.obj") && loaded;
+    cup->rotate(- PI / 2.0,AROUND_X);
+    cup->scale(1.5,1.5,1.5);
+    cup->translate(15,14.5,5);
+    cup->use_3D_texture = true;
+    cup->set_texture_3D(this->checkers.get());
+    cup->mat.ambient_intensity = 0.3;
+    cup->mat.diffuse_intensity = 0.8;
+    cup->mat.specular_intensity = 0.9;
+    cup->mat.specular_exponent = 1;
+
+    loaded = cube->load_obj_cached(resource_path + "compcube.obj") && loaded;
+    cube->mat.ambient_intensity = 0.4;
+    cube->mat.diffuse_intensity = 0.6;
+    cube->mat.specular_intensity = 0.5;
+    cube->mat.specular_exponent = 30;
+    cube->scale(0.8,0.8,0.8);
+    cube_texture = textures->get(resource_path + "compcube.png");
+    cube->set_texture(cube_texture);
+
+    cube->rotate(PI,AROUND_X);
+    cube->rotate(PI + PI / 2.0,AROUND_Z);
+    cube->translate(3,13,5);
+
+    loaded = floor->load_obj_cached(resource_path + "plane.obj") && loaded;
+    floor->scale(10,10,10);
+    floor->rotate(-PI / 2.0,AROUND_X);
+    floor->translate(0,0,-5);
+    floor->translate(-1,19,2);
+    floor_texture = textures->get(resource_path + "floor.png");
+    floor->set_texture(floor_texture);
+    floor->mat.ambient_intensity = 0.2;
+
+    this->scene.add_mesh(cube);
+    this->scene.add_mesh(sphere);
+    this->scene.add_mesh(cup);
+    this->scene.add_mesh(floor);
+    this->scene.add_light(light2);
+    this->scene.add_light(light);
+
+    this->scene.camera_translate(11,3,15);
+    this->scene.camera_rotate(-0.1,AROUND_Z);
+    this->scene.camera_rotate(0.5,AROUND_X);
+    this->scene.set_background_color(255,200,100);
+
+    unsigned int rays;
+    double range;
+
+    switch (variant)
+      {
+        case 0: rays = 1; range = 0; this->info = "hard shadows"; break;
+        case 1: rays = 3; range = 0.2; this->info = "soft shadows, few lines, small range"; break;
+        case 2: rays = 15; range = 0.2; this->info = "soft shadows, many lines, small range"; break;
+        case 3: rays = 3; range = 1.2; this->info = "soft shadows, few lines, high range"; break;
+        default: rays = 15; range = 1.2; this->info = "soft shadows, many lines, high range"; break;
+      }
+
+    this->scene.set_distribution_parameters(
+      rays,  // shadow rays
+      range, // shadow range
+      1,     // reflection rays
+      1,     // reflection range
+      1,     // DOF rays
+      1,     // lens width
+      1,     // focus distance
+      1,     // refraction rays
+      0      // refraction range
+      );
+
+    this->scene.set_focal_distance(0.4);
+
+    return loaded && cube_texture && floor_texture;
+  }
+
+bool demo_scene::setup_scene_2(unsigned int variant, texture_registry *textures, string resource_path)
+  /* depth of field and reflection demonstration, variant can be:
+     0: non-distributed raytracing
+     1: distributed reflection, small range
+     2: distributed reflection, high range
+     3: depth of field distance 1
+     4: depth of field distance 2
+     5: depth of field distance 3
+     6: depth of field distance 4
+     7: depth of field distance 2, lens wisth 1
+     8: depth of field distance 2, lens wisth 2
+   */
+  {
+    mesh_3D *floor, *cup, *wall, *mirror, *pyramid;
+    light_3D *light, *light2;
+    shared_ptr<t_color_buffer> floor_texture, wall_texture, pyramid_texture;
+    bool loaded = true;
+
+    textures->request(resource_path + "floor.png");
+    textures->request(resource_path + "wall.png");
+    textures->request(resource_path + "pyramid.png");
+
+    cup = this->new_mesh();
+    floor = this->new_mesh();
+    wall = this->new_mesh();
+    mirror = this->new_mesh();
+    pyramid = this->new_mesh();
+    light2 = this->new_light();
+    light = this->new_light();
+
+    light->set_position(-50,-10,5);
+    light->set_intensity(1.0);
+    light->distance_factor = 200;
+
+    light2->set_position(-50,20,3);
+    light2->set_intensity(1.0);
+    light2->distance_factor = 150;
+
+    loaded = cup->load_obj_cached(resource_path + "cup.obj") && loaded;
+    cup->rotate(- PI / 2.0,AROUND_X);
+    cup->rotate(-0.6,AROUND_Y);
+    cup->rotate(-0.3,AROUND_Z);
+    cup->scale(1.5,1.5,1.5);
+    cup->translate(20,14.5,5);
+    cup->mat.surface_color.red = 100;
+    cup->mat.surface_color.green = 100;
+    cup->mat.surface_color.blue = 0;
+    cup->mat.diffuse_intensity = 0.8;
+    cup->mat.specular_intensity = 0.7;
+    cup->mat.specular_exponent = 5;
+
+    loaded = pyramid->load_obj_cached(resource_path + "pyramid.obj") && loaded;
+    pyramid->rotate(0.4,AROUND_Z);
+    pyramid->translate(5,30,0);
+    pyramid_texture = textures->get(resource_path + "pyramid.png");
+    pyramid->set_texture(pyramid_texture);
+    pyramid->mat.diffuse_intensity = 0.9;
+
+    loaded = floor->load_obj_cached(resource_path + "plane.obj") && loaded;
+    floor->scale(10,10,10);
+    floor->rotate(-PI / 2.0,AROUND_X);
+    floor->translate(0,0,-5);
+    floor->translate(-1,19,2);
+    floor_texture = textures->get(resource_path + "floor.png");
+    floor->set_texture(floor_texture);
+    floor->mat.ambient_intensity = 0.2;
+
+    loaded = wall->load_obj_cached(resource_path + "plane.obj") && loaded;
+    wall->scale(10,10,10);
+    wall->translate(0,20,-5);
+    wall->translate(-1,19,2);
+    wall_texture = textures->get(resource_path + "wall.png");
+    wall->set_texture(wall_texture);
+    wall->mat.ambient_intensity = 0.2;
+
+    loaded = mirror->load_obj_cached(resource_path + "plane.obj") && loaded;
+    mirror->scale(2,2,1);
+    mirror->mat.reflection = 0.7;
+    mirror->rotate(-PI / 2.0,AROUND_Z);
+    mirror->translate(-10,19,5);
+    mirror->mat.ambient_intensity = 0.2;
+
+    this->scene.add_mesh(cup);
+    this->scene.add_mesh(floor);
+    this->scene.add_mesh(wall);
+    this->scene.add_mesh(mirror);
+    this->scene.add_mesh(pyramid);
+    this->scene.add_light(light2);
+    this->scene.add_light(light);
+
+    this->scene.camera_translate(40,25,10);
+    this->scene.camera_rotate(-1.6,AROUND_Z);
+    this->scene.camera_rotate(0.2,AROUND_X);
+    this->scene.set_background_color(50,10,10);
+
+    this->scene.set_focal_distance(0.6);
+    this->scene.set_recursion_depth(4);
+
+    unsigned int reflection_rays, dof_rays;
+    double distance, reflection_range;
+    double lens_width;
+
+    switch (variant)
+      {
+        case 0: reflection_rays = 1; reflection_range = 0.7; dof_rays = 1; distance = 0; lens_width = 1.0; this->info = "non-distributed raytracing"; break;
+        case 1: reflection_rays = 30; reflection_range = 0.05; dof_rays = 1; distance = 0; lens_width = 1.0; this->info = "distributed reflection, small range"; break;
+        case 2: reflection_rays = 30; reflection_range = 0.2; dof_rays = 1; distance = 0; lens_width = 1.0; this->info = "distributed reflection, high range"; break;
+        case 3: reflection_rays = 1; reflection_range = 0; dof_rays = 30; distance = 20; lens_width = 1.5; this->info = "depth of field distance 1"; break;
+        case 4: reflection_rays = 1; reflection_range = 0; dof_rays = 30; distance = 30; lens_width = 1.5; this->info = "depth of field distance 2"; break;
+        case 5: reflection_rays = 1; reflection_range = 0; dof_rays = 30; distance = 40; lens_width = 1.5; this->info = "depth of field distance 3"; break;
+        case 6: reflection_rays = 1; reflection_range = 0; dof_rays = 30; distance = 50; lens_width = 1.5; this->info = "depth of field distance 4"; break;
+        case 7: reflection_rays = 1; reflection_range = 0; dof_rays = 30; distance = 30; lens_width = 2.3; this->info = "depth of field distance 2, lens width 2"; break;
+        default: reflection_rays = 1; reflection_range = 0; dof_rays = 30; distance = 30; lens_width = 3.0; this->info = "depth of field distance 3, lens width 3"; break;
+      }
+
+    this->scene.set_distribution_parameters(
+      1,                 // shadow rays
+      0,                 // shadow range
+      reflection_rays,   // reflection rays
+      reflection_range,  // reflection range
+      dof_rays,          // DOF rays
+      lens_width,        // lens width
+      distance,          // focus distance
+      1,                 // refraction rays
+      0                  // refraction range
+      );
+
+    return loaded && floor_texture && wall_texture && pyramid_texture;
+  }
+
+bool demo_scene::setup_scene_3(unsigned int variant, texture_registry *textures, string resource_path)
+  /* refraction demonstration, variant can be:
+     0: perfect refraction
+     1: distributed refraction, few rays, small range
+     2: distributed refraction, many rays, small range
+     3: distributed refraction, few rays, high range
+     4: distributed refraction, many rays, high range
+     */
+  {
+    mesh_3D *cube, *floor, *cup, *sphere;
+    light_3D *light, *light2;
+    shared_ptr<t_color_buffer> floor_texture;
+    bool loaded = true;
+
+    textures->request(resource_path + "floor.png");
+
+    cube = this->new_mesh();
+    sphere = this->new_mesh();
+    cup = this->new_mesh();
+    floor = this->new_mesh();
+    light2 = this->new_light();
+    light = this->new_light();
+
+    light->set_position(-3,2,30);
+    light->set_intensity(0.8);
+    light->distance_factor = 100;
+
+    light2->set_position(6,3,3);
+    light2->set_intensity(0.6);
+    light2->distance_factor = 50;
+
+    loaded = sphere->load_obj_cached(resource_path + "sphere.obj") && loaded;
+    sphere->scale(1.0,1.0,1.0);
+    sphere->translate(12,24,11);
+    sphere->mat.surface_color.red = 0;
+    sphere->mat.surface_color.green = 230;
+    sphere->mat.surface_color.blue = 255;
+    sphere->mat.transparency = 0.8;
+    sphere->mat.specular_exponent = 50;
+    sphere->mat.specular_intensity = 1.0;
+
+    loaded = cup->load_obj_cached(resource_path + "cup.obj") && loaded;
+    cup->rotate(- PI / 2.0,AROUND_X);
+    cup->scale(5,5,5);
+    cup->translate(-1,40,15);
+    cup->mat.ambient_intensity = 0.3;
+    cup->mat.diffuse_intensity = 0.8;
+    cup->mat.specular_intensity = 0.9;
+    cup->mat.surface_color.red = 255;
+    cup->mat.surface_color.green = 0;
+    cup->mat.surface_color.blue = 0;
+    cup->mat.specular_exponent = 100;
+
+    loaded = cube->load_obj_cached(resource_path + "cube.obj") && loaded;
+    cube->mat.ambient_intensity = 0.4;
+    cube->mat.diffuse_intensity = 0.6;
+    cube->mat.specular_intensity = 0.5;
+    cube->mat.specular_exponent = 30;
+    cube->mat.transparency = 0.9;
+    cube->mat.surface_color.red = 255;
+    cube->mat.surface_color.green = 255;
+    cube->mat.surface_color.blue = 0;
+    cube->rotate(PI,AROUND_X);
+    cube->scale(0.2,1.0,1.2);
+    cube->rotate(PI,AROUND_X);
+    cube->rotate(PI + PI / 2.0,AROUND_Z);
+    cube->translate(3,13,5);
+
+    loaded = floor->load_obj_cached(resource_path + "plane.obj") && loaded;
+    floor->scale(10,10,10);
+    floor->rotate(-PI / 2.0,AROUND_X);
+    floor->translate(0,0,-5);
+    floor->translate(-1,19,2);
+    floor_texture = textures->get(resource_path + "floor.png");
+    floor->set_texture(floor_texture);
+    floor->mat.ambient_intensity = 0.2;
+
+    this->scene.add_mesh(cube);
+    this->scene.add_mesh(sphere);
+    this->scene.add_mesh(cup);
+    this->scene.add_mesh(floor);
+    this->scene.add_light(light2);
+    this->scene.add_light(light);
+
+    this->scene.camera_translate(11,3,15);
+    this->scene.camera_rotate(-0.1,AROUND_Z);
+    this->scene.camera_rotate(0.5,AROUND_X);
+    this->scene.set_background_color(255,200,100);
+
+    this->scene.set_focal_distance(0.4);
+    this->scene.set_recursion_depth(4);
+
+    unsigned int rays;
+    double range;
+
+    switch (variant)
+      {
+        case 0: rays = 1; range = 0; this->info = "perfect refraction"; break;
+        case 1: rays = 3; range = 0.02; this->info = "distributed refraction, few rays, small range"; break;
+        case 2: rays = 7; range = 0.02; this->info = "distributed refraction, many rays, small range"; break;
+        case 3: rays = 3; range = 0.08; this->info = "distributed refraction, few rays, high range"; break;
+        default: rays = 7; range = 0.08; this->info = "distributed refraction, many rays, high range"; break;
+      }
+
+    this->scene.set_distribution_parameters(
+      1,     // shadow rays
+      0,     // shadow range
+      1,     // reflection rays
+      1,     // reflection range
+      1,     // DOF rays
+      1,     // lens width
+      1,     // focus distance
+      rays,  // refraction rays
+      range  // refraction range
+      );
+
+    this->scene.set_focal_distance(0.4);
+
+    return loaded && floor_texture;
+  }
+
+bool demo_scene::setup_spheres(unsigned int variant)
+  /* grid of reflective, transparent and diffuse spheres over a checker
+     floor, variant can be:
+     0: hard shadows, perfect reflection
+     1: soft shadows, distributed reflection
+     2: rectangle and sphere area lights
+     3: hard shadows, MANY_LIGHTS more short-range point lights
+     4: disk lights, one facing down and one tilted towards the spheres
+     */
+  {
+    mesh_3D *floor, *sphere;
+    light_3D *light, *light2;
+    unsigned int i, j;
+
+    this->generated_texture = make_checker_texture(256,8);
+
+    floor = this->new_mesh();
+    make_terrain_chunk(floor,0,0,0);
+    floor->scale(8,8,1);
+    floor->translate(-20,-5,-2);
+    floor->set_texture(this->generated_texture);
+    floor->mat.ambient_intensity = 0.2;
+    floor->mat.reflection = 0.2;
+    this->scene.add_mesh(floor);
+
+    for (j = 0; j < SPHERE_GRID; j++)
+      for (i = 0; i < SPHERE_GRID; i++)
+        {
+          sphere = this->new_mesh();
+          make_uv_sphere(sphere,16,12);
+          sphere->scale(1.2,1.2,1.2);
+          sphere->translate(-9 + i * 3.6,10 + j * 3.6,-0.8 + (i + j) % 3 * 0.6);
+
+          sphere->mat.surface_color.red = 60 + i * 35;
+          sphere->mat.surface_color.green = 60 + j * 35;
+          sphere->mat.surface_color.blue = 200;
+          sphere->mat.specular_intensity = 0.8;
+          sphere->mat.specular_exponent = 40;
+
+          switch ((i + 2 * j) % 3)
+            {
+              case 0: sphere->mat.reflection = 0.6; break;
+              case 1: sphere->mat.transparency = 0.7; sphere->mat.refractive_index = 1.3; break;
+              default: break;
+            }
+
+          this->scene.add_mesh(sphere);
+        }
+
+    light = this->new_light();
+    light->set_position(-10,0,15);
+    light->set_intensity(0.8);
+    light->distance_factor = 100;
+    this->scene.add_light(light);
+
+    light2 = this->new_light();
+    light2->set_position(12,20,8);
+    light2->set_intensity(0.5);
+    light2->distance_factor = 60;
+    this->scene.add_light(light2);
+
+    this->scene.camera_translate(0.3,-3,4);   // not aligned with the floor edges
+    this->scene.camera_rotate(0.3,AROUND_X);
+    this->scene.set_background_color(40,60,90);
+    this->scene.set_focal_distance(0.5);
+    this->scene.set_recursion_depth(2);
+
+    if (variant == 0)
+      {
+        this->info = "synthetic spheres, hard shadows";
+        this->scene.set_distribution_parameters(1,0,1,0,1,1,1,1,0);
+      }
+    else if (variant == 1)
+      {
+        this->info = "synthetic spheres, soft shadows, distributed reflection";
+        this->scene.set_distribution_parameters(3,0.5,3,0.05,1,1,1,1,0);
+      }
+    else if (variant == 3)
+      {
+        for (i = 0; i < MANY_LIGHTS; i++)   // spread by the golden ratio sequences, independent of rand
+          {
+            light_3D *small_light = this->new_light();
+
+            small_light->set_position(fmod(i * 0.6180339887,1.0) * 40 - 20,fmod(i * 0.7548776662,1.0) * 40,
+              1 + fmod(i * 0.5698402910,1.0) * 4);
+            small_light->set_intensity(1.5 / sqrt(MANY_LIGHTS));
+            small_light->distance_factor = 8;
+            this->scene.add_light(small_light);
+          }
+
+        this->info = "synthetic spheres, many lights";
+        this->scene.set_distribution_parameters(1,0,1,0,1,1,1,1,0);
+      }
+    else if (variant == 4)
+      {
+        point_3D normal1, normal2;
+
+        normal1.x = 0; normal1.y = 0; normal1.z = -1;
+        normal2.x = -1; normal2.y = 0; normal2.z = -0.6;
+
+        light->set_disk(3,normal1);
+        light2->set_disk(1.5,normal2);
+
+        this->info = "synthetic spheres, disk lights";
+        this->scene.set_distribution_parameters(4,0,1,0,1,1,1,1,0);
+      }
+    else
+      {
+        point_3D edge1, edge2;
+
+        edge1.x = 4; edge1.y = 0; edge1.z = 0;
+        edge2.x = 0; edge2.y = 4; edge2.z = 0;
+
+        light->set_rectangle(edge1,edge2);
+        light2->set_sphere(1.5);
+
+        this->info = "synthetic spheres, area lights";
+        this->scene.set_distribution_parameters(4,0,1,0,1,1,1,1,0);
+      }
+
+    return true;
+  }
+
+bool demo_scene::setup_terrain(unsigned int variant)
+  /* height field terrain split to many meshes with a glass sphere,
+     variant can be:
+     0: no distribution
+     1: depth of field
+     */
+  {
+    mesh_3D *chunk, *sphere;
+    light_3D *light;
+    unsigned int i, j;
+
+    this->generated_texture = make_checker_texture(512,32);
+
+    for (j = 0; j < TERRAIN_CHUNKS; j++)
+      for (i = 0; i < TERRAIN_CHUNKS; i++)
+        {
+          chunk = this->new_mesh();
+          make_terrain_chunk(chunk,(i - TERRAIN_CHUNKS / 2.0) * TERRAIN_CHUNK_SIZE,j * TERRAIN_CHUNK_SIZE,1);
+          chunk->translate(0,0,-4);
+          chunk->set_texture(this->generated_texture);
+          chunk->mat.ambient_intensity = 0.25;
+          chunk->mat.diffuse_intensity = 0.8;
+          chunk->mat.specular_intensity = 0.1;
+          this->scene.add_mesh(chunk);
+        }
+
+    sphere = this->new_mesh();
+    make_uv_sphere(sphere,32,24);
+    sphere->scale(2.5,2.5,2.5);
+    sphere->translate(0,14,-1);
+    sphere->mat.transparency = 0.85;
+    sphere->mat.refractive_index = 1.4;
+    sphere->mat.specular_intensity = 1.0;
+    sphere->mat.specular_exponent = 60;
+    sphere->mat.surface_color.red = 220;
+    sphere->mat.surface_color.green = 240;
+    sphere->mat.surface_color.blue = 255;
+    this->scene.add_mesh(sphere);
+
+    light = this->new_light();
+    light->set_position(-20,30,25);
+    light->set_intensity(1.0);
+    light->distance_factor = 200;
+    this->scene.add_light(light);
+
+    this->scene.camera_translate(0.3,-4,2);
+    this->scene.camera_rotate(0.25,AROUND_X);
+    this->scene.set_background_color(150,190,230);
+    this->scene.set_focal_distance(0.5);
+    this->scene.set_recursion_depth(3);
+
+    if (variant == 0)
+      {
+        this->info = "synthetic terrain";
+        this->scene.set_distribution_parameters(1,0,1,0,1,1,1,1,0);
+      }
+    else
+      {
+        this->info = "synthetic terrain, depth of field";
+        this->scene.set_distribution_parameters(1,0,1,0,8,1.0,18,1,0);
+      }
+
+    return true;
+  }
+
+bool demo_scene::setup_models(unsigned int variant, string model_path)
+  /* a model file shipped with the sources on a checker floor, the model
+     is checked against its known size so that the loaders are tested,
+     variant can be:
+     0: companion cube, binary stl welded with smooth normals
+     1: dodecahedron, binary ply with pentagons triangulated as fans
+     2: two octahedra, glb with interleaved vertex data and node hierarchy
+     */
+  {
+    mesh_3D *floor, *model;
+    light_3D *light;
+    unsigned int i;
+
+    this->generated_texture = make_checker_texture(256,8);
+
+    floor = this->new_mesh();
+    make_terrain_chunk(floor,0,0,0);
+    floor->scale(4,4,1);
+    floor->translate(-10,-2,-1.5);
+    floor->set_texture(this->generated_texture);
+    floor->mat.ambient_intensity = 0.2;
+    this->scene.add_mesh(floor);
+
+    if (variant == 2)
+      {
+        this->imported.reset(new gltf_model);
+
+        if (!this->imported->load_glb(model_path + OCTAHEDRA_FILE) ||
+            this->imported->meshes.size() != OCTAHEDRA_INSTANCES)
+          return false;
+
+        for (i = 0; i < this->imported->meshes.size(); i++)
+          {
+            model = this->imported->meshes[i];    // material from the file
+
+            if (model->vertices.size() != OCTAHEDRON_VERTICES ||
+                model->triangle_indices.size() != 3 * OCTAHEDRON_TRIANGLES)
+              return false;
+
+            model->rotate(M_PI / 2,AROUND_X);    // +y up to +z up
+            model->translate(0,4,-0.3);
+            this->scene.add_mesh(model);
+          }
+
+        this->info = "octahedra, glb";
+      }
+    else
+      {
+        model = this->new_mesh();
+
+        if (variant == 0)
+          {
+            if (!model->load_stl(model_path + COMPANION_CUBE_FILE,true,true) ||
+                model->triangle_indices.size() != 3 * COMPANION_CUBE_TRIANGLES ||
+                model->vertices.size() != COMPANION_CUBE_VERTICES)
+              return false;
+
+            model->translate(-12.7,-12.7,0);   // the cube spans 0 to 25.4 on all axes
+            model->scale(0.15,0.15,0.15);
+            model->rotate(0.5,AROUND_Z);
+            model->translate(0,4,-1.5);
+
+            this->info = "companion cube, binary stl";
+          }
+        else
+          {
+            if (!model->load_ply(model_path + DODECAHEDRON_FILE) ||
+                model->vertices.size() != DODECAHEDRON_VERTICES ||
+                !is_fan_triangulation(model,DODECAHEDRON_FACES,5))
+              return false;
+
+            model->rotate(0.4,AROUND_Z);
+            model->rotate(0.3,AROUND_X);
+            model->scale(1.1,1.1,1.1);
+            model->translate(0,4,0.4);         // the circumradius is sqrt(3)
+
+            this->info = "dodecahedron, binary ply";
+          }
+
+        model->mat.surface_color.red = 210;
+        model->mat.surface_color.green = 200;
+        model->mat.surface_color.blue = 190;
+        model->mat.specular_intensity = 0.5;
+        model->mat.specular_exponent = 30;
+        this->scene.add_mesh(model);
+      }
+
+    light = this->new_light();
+    light->set_position(-6,0,8);
+    light->set_intensity(0.9);
+    light->distance_factor = 60;
+    this->scene.add_light(light);
+
+    this->scene.camera_translate(0,-2,2);
+    this->scene.camera_rotate(0.3,AROUND_X);
+    this->scene.set_background_color(40,60,90);
+    this->scene.set_focal_distance(0.5);
+    this->scene.set_recursion_depth(2);
+    this->scene.set_distribution_parameters(1,0,1,0,1,1,1,1,0);
+
+    return true;
+  }
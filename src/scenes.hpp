@@ -0,0 +1,107 @@
+#ifndef SCENES_H
+#define SCENES_H
+
+/**
+ Demo scenes shared by the demo and the scene benchmark.
+
+ @date 2014
+ @author Miloslav Číž
+ */
+
+#include "raytracer.hpp"
+
+#define DEMO_SCENE_COUNT 3        /**< scenes built from the resource files */
+#define SYNTHETIC_SCENE_COUNT 2   /**< generated scenes that don't need any resources, numbered after the demo scenes */
+#define MODEL_SCENE_COUNT 1       /**< scenes of the model files shipped with the sources, numbered after the synthetic scenes */
+
+class demo_scene       /**< one variant of a demo or synthetic scene, owns its meshes, lights and textures */
+  {
+    protected:
+      vector<unique_ptr<mesh_3D> > meshes;
+      vector<unique_ptr<light_3D> > lights;
+      unique_ptr<texture_3D> checkers;
+      shared_ptr<t_color_buffer> generated_texture;
+      unique_ptr<paged_texture> paged;   /**< out-of-core copy of generated_texture, see page_textures */
+      unique_ptr<gltf_model> imported;   /**< owns the meshes of the glb model scene */
+
+      mesh_3D *new_mesh();
+      light_3D *new_light();
+      bool setup_scene_1(unsigned int variant, texture_registry *textures, string resource_path);
+      bool setup_scene_2(unsigned int variant, texture_registry *textures, string resource_path);
+      bool setup_scene_3(unsigned int variant, texture_registry *textures, string resource_path);
+      bool setup_spheres(unsigned int variant);
+      bool setup_terrain(unsigned int variant);
+      bool setup_models(unsigned int variant, string model_path);
+
+    public:
+      scene_3D scene;
+      string name;                  /**< scene and variant name, e.g. scene1_2 */
+      string info;                  /**< description of the variant */
+
+      demo_scene(unsigned int width, unsigned int height);
+      demo_scene(const demo_scene &) = delete;
+      demo_scene &operator=(const demo_scene &) = delete;
+
+      bool setup(unsigned int scene_number, unsigned int variant, texture_registry *textures, string resource_path,
+        string model_path);
+
+      /**<
+       Builds given scene variant.
+
+       @param scene_number number of the scene, 0 to DEMO_SCENE_COUNT - 1
+              are the demo scenes, the following SYNTHETIC_SCENE_COUNT
+              numbers are the synthetic scenes and the following
+              MODEL_SCENE_COUNT numbers the model scenes
+       @param variant variant of the scene (the rendering parameters),
+              see get_variant_count, higher numbers build the last
+              variant
+       @param textures registry the textures are loaded through
+       @param resource_path path to the meshes and textures of the demo
+              scenes
+       @param model_path path to the model files of the model scenes
+              (the source root)
+       @return true if the scene was built, false if some resource
+               couldn't be loaded, a model doesn't have its known
+               vertex and triangle count or the number is wrong
+       */
+
+      static unsigned int get_variant_count(unsigned int scene_number);
+
+      static string get_name(unsigned int scene_number, unsigned int variant);
+
+      /**<
+       Gets the name setup gives to given scene variant without building
+       it, e.g. to pick scenes by name.
+
+       @return the name, e.g. spheres_3, empty if there is no such scene
+       */
+
+      bool page_textures(texture_cache *cache, string path);
+
+      /**<
+       Makes the meshes of the built synthetic scene sample their
+       generated texture out-of-core: the texture is written to a
+       pre-tiled file and paged in through given cache. The images stay
+       the same.
+
+       @param cache cache the tiles are kept in, it must exist as long
+              as the scene is rendered
+       @param path path the pre-tiled file (named after the scene) is
+              written to
+       @return true if the texture was paged (or the scene has no
+               generated texture), false if the file couldn't be
+               written or opened
+       */
+
+      light_3D *get_light(unsigned int index);
+
+      /**<
+       Gets a light of the built scene, e.g. to change it between
+       renders.
+
+       @param index index of the light in the order of creation
+       @return the light or NULL if there is no such light
+       */
+  };
+
+#endif
@@ -0,0 +1,566 @@
+#include "raytracer.hpp"
+#include <string.h>
+
+#ifndef _WIN32
+  #include <unistd.h>
+#endif
+
+/*
+ Out-of-core textures: the textures are stored in pre-tiled files with
+ all mipmap levels and only the tiles that are actually sampled are
+ read, they are kept in a shared cache with a memory budget.
+
+ In-memory textures are shared through texture_registry which decodes
+ each file once.
+ */
+
+texture_cache::texture_cache(size_t budget)
+  {
+    this->budget = budget;
+    this->texture_count = 0;
+    memset(&this->statistics,0,sizeof(this->statistics));
+  }
+
+unsigned int texture_cache::register_texture()
+  {
+    lock_guard<mutex> guard(this->lock);
+
+    this->texture_count++;
+    return this->texture_count;
+  }
+
+shared_ptr<const vector<unsigned int> > texture_cache::get_tile(paged_texture *texture, unsigned int level, unsigned int tile_x, unsigned int tile_y)
+  {
+    uint64_t key;
+    shared_ptr<vector<unsigned int> > loaded;
+    cache_entry entry;
+
+    key = (((uint64_t) texture->get_id()) << 48) | (((uint64_t) level) << 40) |
+      (((uint64_t) tile_y) << 20) | tile_x;
+
+    {
+      lock_guard<mutex> guard(this->lock);
+      unordered_map<uint64_t,cache_entry>::iterator item = this->tiles.find(key);
+
+      if (item != this->tiles.end())
+        {
+          this->lru.splice(this->lru.begin(),this->lru,item->second.position);
+          this->statistics.hits++;
+          return item->second.texels;
+        }
+
+      this->statistics.misses++;
+    }
+
+    // the file is read without holding the lock so that other threads can sample cached tiles
+
+    loaded = make_shared<vector<unsigned int> >();
+
+    if (!texture->read_tile(level,tile_x,tile_y,*loaded))
+      return shared_ptr<const vector<unsigned int> >();
+
+    {
+      lock_guard<mutex> guard(this->lock);
+      unordered_map<uint64_t,cache_entry>::iterator item = this->tiles.find(key);
+
+      if (item != this->tiles.end())   // loaded by other thread in the meantime
+        return item->second.texels;
+
+      this->lru.push_front(key);
+      entry.texels = loaded;
+      entry.position = this->lru.begin();
+      this->tiles[key] = entry;
+
+      this->statistics.bytes_used += loaded->size() * sizeof(unsigned int);
+
+      if (this->statistics.bytes_used > this->statistics.peak_bytes_used)
+        this->statistics.peak_bytes_used = this->statistics.bytes_used;
+
+      while (this->statistics.bytes_used > this->budget && this->lru.size() > 1)
+        {
+          item = this->tiles.find(this->lru.back());
+
+          this->statistics.bytes_used -= item->second.texels->size() * sizeof(unsigned int);
+          this->statistics.evictions++;
+          this->tiles.erase(item);
+          this->lru.pop_back();
+        }
+    }
+
+    return loaded;
+  }
+
+void texture_cache::set_budget(size_t budget)
+  {
+    lock_guard<mutex> guard(this->lock);
+    this->budget = budget;
+  }
+
+texture_cache_statistics texture_cache::get_statistics()
+  {
+    lock_guard<mutex> guard(this->lock);
+    return this->statistics;
+  }
+
+void texture_cache::print_statistics(ostream &output)
+  {
+    texture_cache_statistics current = this->get_statistics();
+    unsigned long long lookups = current.hits + current.misses;
+
+    output << "texture cache: " << lookups << " lookups, hit rate " <<
+      (lookups == 0 ? 0.0 : current.hits * 100.0 / lookups) << " %, " <<
+      current.evictions << " evictions, " << current.bytes_used / 1024 << " KiB used (peak " <<
+      current.peak_bytes_used / 1024 << " KiB, budget " << this->budget / 1024 << " KiB)" << endl;
+  }
+
+void texture_cache::clear()
+  {
+    lock_guard<mutex> guard(this->lock);
+
+    this->tiles.clear();
+    this->lru.clear();
+    this->statistics.bytes_used = 0;
+  }
+
+paged_texture::paged_texture()
+  {
+    this->file = NULL;
+    this->cache = 0;
+    this->id = 0;
+    this->tile_size = 0;
+  }
+
+paged_texture::~paged_texture()
+  {
+    if (this->file != NULL)
+      fclose(this->file);
+  }
+
+bool paged_texture::open(string filename, texture_cache *cache)
+  {
+    paged_texture_header header;
+    unsigned int i;
+
+    if (this->file != NULL)
+      fclose(this->file);
+
+    this->levels.clear();
+    this->file = fopen(filename.c_str(),"rb");
+
+    if (this->file == NULL)
+      return false;
+
+    if (fread(&header,sizeof(header),1,this->file) != 1 ||
+        memcmp(header.magic,PAGED_TEXTURE_MAGIC,sizeof(PAGED_TEXTURE_MAGIC)) != 0 ||
+        header.version != PAGED_TEXTURE_VERSION || header.tile_size == 0 || header.level_count == 0)
+      {
+        fclose(this->file);
+        this->file = NULL;
+        return false;
+      }
+
+    this->levels.resize(header.level_count);
+
+    for (i = 0; i < header.level_count; i++)
+      if (fread(&this->levels[i],sizeof(paged_texture_level),1,this->file) != 1 ||
+          this->levels[i].width == 0 || this->levels[i].height == 0)
+        {
+          fclose(this->file);
+          this->file = NULL;
+          this->levels.clear();
+          return false;
+        }
+
+    this->tile_size = header.tile_size;
+    this->cache = cache;
+    this->id = cache->register_texture();
+    return true;
+  }
+
+bool paged_texture::read_tile(unsigned int level, unsigned int tile_x, unsigned int tile_y, vector<unsigned int> &texels)
+  {
+    uint64_t offset;
+    size_t bytes;
+
+    if (this->file == NULL || level >= this->levels.size() ||
+        tile_x >= this->levels[level].tiles_x || tile_y >= this->levels[level].tiles_y)
+      return false;
+
+    bytes = this->get_tile_bytes();
+    offset = this->levels[level].offset + (((uint64_t) tile_y) * this->levels[level].tiles_x + tile_x) * bytes;
+    texels.resize(this->tile_size * this->tile_size);
+
+#ifndef _WIN32
+    return pread(fileno(this->file),texels.data(),bytes,offset) == (ssize_t) bytes;
+#else
+    lock_guard<mutex> guard(this->file_lock);
+
+    return _fseeki64(this->file,offset,SEEK_SET) == 0 &&
+      fread(texels.data(),bytes,1,this->file) == 1;
+#endif
+  }
+
+unsigned int paged_texture::get_width()
+  {
+    return this->levels.size() == 0 ? 0 : this->levels[0].width;
+  }
+
+unsigned int paged_texture::get_height()
+  {
+    return this->levels.size() == 0 ? 0 : this->levels[0].height;
+  }
+
+unsigned int paged_texture::get_id()
+  {
+    return this->id;
+  }
+
+size_t paged_texture::get_tile_bytes()
+  {
+    return this->tile_size * this->tile_size * sizeof(unsigned int);
+  }
+
+static inline unsigned int wrap_coordinate(int coordinate, unsigned int limit)
+  {
+    if ((limit & (limit - 1)) == 0)    // power of two
+      return ((unsigned int) coordinate) & (limit - 1);
+
+    coordinate %= (int) limit;
+    return coordinate < 0 ? coordinate + limit : coordinate;
+  }
+
+unsigned int paged_texture::get_texel(unsigned int level, int x, int y, shared_ptr<const vector<unsigned int> > &tile, int &tile_x, int &tile_y)
+
+  /**<
+    Gets the texel, the tile it is in is only fetched from the cache if
+    it's not the one given (the one the last texel was in).
+   */
+
+  {
+    paged_texture_level *current = &this->levels[level];
+    unsigned int wrapped_x, wrapped_y;
+
+    wrapped_x = wrap_coordinate(x,current->width);
+    wrapped_y = wrap_coordinate(y,current->height);
+
+    if (!tile || (int) (wrapped_x / this->tile_size) != tile_x || (int) (wrapped_y / this->tile_size) != tile_y)
+      {
+        tile_x = wrapped_x / this->tile_size;
+        tile_y = wrapped_y / this->tile_size;
+        tile = this->cache->get_tile(this,level,tile_x,tile_y);
+
+        if (!tile)
+          return 0;
+      }
+
+    return (*tile)[(wrapped_y % this->tile_size) * this->tile_size + wrapped_x % this->tile_size];
+  }
+
+void paged_texture::sample_bilinear(unsigned int level, double u, double v, double result[3])
+  {
+    shared_ptr<const vector<unsigned int> > tile;
+    int tile_x, tile_y, x0, y0, channel, i;
+    double x, y, fraction_x, fraction_y, weights[4];
+    unsigned int texels[4];
+
+    x = u * this->levels[level].width - 0.5;
+    y = v * this->levels[level].height - 0.5;
+
+    x0 = (int) floor(x);
+    y0 = (int) floor(y);
+    fraction_x = x - x0;
+    fraction_y = y - y0;
+    tile_x = -1;
+    tile_y = -1;
+
+    texels[0] = this->get_texel(level,x0,y0,tile,tile_x,tile_y);
+    texels[1] = this->get_texel(level,x0 + 1,y0,tile,tile_x,tile_y);
+    texels[2] = this->get_texel(level,x0,y0 + 1,tile,tile_x,tile_y);
+    texels[3] = this->get_texel(level,x0 + 1,y0 + 1,tile,tile_x,tile_y);
+
+    weights[0] = (1 - fraction_x) * (1 - fraction_y);
+    weights[1] = fraction_x * (1 - fraction_y);
+    weights[2] = (1 - fraction_x) * fraction_y;
+    weights[3] = fraction_x * fraction_y;
+
+    for (channel = 0; channel < 3; channel++)
+      {
+        result[channel] = 0;
+
+        for (i = 0; i < 4; i++)
+          result[channel] += ((texels[i] >> (8 * channel)) & 0xff) * weights[i];
+      }
+  }
+
+void paged_texture::sample(double u, double v, double level, unsigned char *red, unsigned char *green, unsigned char *blue)
+  {
+    double color1[3], color2[3], fraction;
+    unsigned int level1, last_level;
+
+    if (this->levels.size() == 0)
+      {
+        *red = 0;
+        *green = 0;
+        *blue = 0;
+        return;
+      }
+
+    last_level = this->levels.size() - 1;
+
+    if (!(level > 0))     // also catches NaN
+      level = 0;
+
+    if (level > last_level)
+      level = last_level;
+
+    level1 = (unsigned int) level;
+    fraction = level - level1;
+
+    this->sample_bilinear(level1,u,v,color1);
+
+    if (fraction > 0 && level1 < last_level)
+      {
+        this->sample_bilinear(level1 + 1,u,v,color2);
+
+        color1[0] = color1[0] * (1 - fraction) + color2[0] * fraction;
+        color1[1] = color1[1] * (1 - fraction) + color2[1] * fraction;
+        color1[2] = color1[2] * (1 - fraction) + color2[2] * fraction;
+      }
+
+    *red = saturate_int(color1[0] + 0.5,0,255);
+    *green = saturate_int(color1[1] + 0.5,0,255);
+    *blue = saturate_int(color1[2] + 0.5,0,255);
+  }
+
+bool save_paged_texture(t_color_buffer *buffer, string filename, unsigned int tile_size)
+  {
+    paged_texture_header header;
+    vector<paged_texture_level> levels;
+    vector<unsigned int> tile;
+    t_color_buffer *level;
+    unsigned int i, tile_x, tile_y, x, y, source_x, source_y;
+    uint64_t offset;
+    unsigned char *pixel;
+    bool own_mipmaps, result;
+
+    if (tile_size == 0)
+      return false;
+
+    ofstream file(filename.c_str(),ios::out | ios::binary | ios::trunc);
+
+    if (!file.is_open())
+      return false;
+
+    own_mipmaps = buffer->mipmaps == NULL;
+
+    if (own_mipmaps && !color_buffer_build_mipmaps(buffer))
+      return false;
+
+    memset(&header,0,sizeof(header));
+    memcpy(header.magic,PAGED_TEXTURE_MAGIC,sizeof(PAGED_TEXTURE_MAGIC));
+    header.version = PAGED_TEXTURE_VERSION;
+    header.tile_size = tile_size;
+    header.level_count = buffer->mipmap_count + 1;
+
+    offset = sizeof(header) + header.level_count * sizeof(paged_texture_level);
+
+    for (i = 0; i < header.level_count; i++)
+      {
+        paged_texture_level record;
+
+        level = i == 0 ? buffer : &buffer->mipmaps[i - 1];
+        record.width = level->width;
+        record.height = level->height;
+        record.tiles_x = (level->width + tile_size - 1) / tile_size;
+        record.tiles_y = (level->height + tile_size - 1) / tile_size;
+        record.offset = offset;
+
+        offset += ((uint64_t) record.tiles_x) * record.tiles_y * tile_size * tile_size * sizeof(unsigned int);
+        levels.push_back(record);
+      }
+
+    file.write((char *) &header,sizeof(header));
+    file.write((char *) levels.data(),levels.size() * sizeof(paged_texture_level));
+
+    tile.resize(tile_size * tile_size);
+
+    for (i = 0; i < header.level_count; i++)
+      {
+        level = i == 0 ? buffer : &buffer->mipmaps[i - 1];
+
+        for (tile_y = 0; tile_y < levels[i].tiles_y; tile_y++)
+          for (tile_x = 0; tile_x < levels[i].tiles_x; tile_x++)
+            {
+              for (y = 0; y < tile_size; y++)
+                for (x = 0; x < tile_size; x++)
+                  {
+                    // texels outside the image are never sampled, the edge is repeated there
+                    source_x = tile_x * tile_size + x;
+                    source_y = tile_y * tile_size + y;
+                    source_x = source_x < level->width ? source_x : level->width - 1;
+                    source_y = source_y < level->height ? source_y : level->height - 1;
+
+                    pixel = level->data + 3 * (source_y * level->width + source_x);
+                    tile[y * tile_size + x] = pixel[0] | (pixel[1] << 8) | (pixel[2] << 16);
+                  }
+
+              file.write((char *) tile.data(),tile.size() * sizeof(unsigned int));
+            }
+      }
+
+    file.close();
+    result = !file.fail();
+
+    if (own_mipmaps)
+      color_buffer_destroy_mipmaps(buffer);
+
+    return result;
+  }
+
+texture_registry::texture_registry(unsigned int threads)
+  {
+    this->thread_count = threads == 0 ? thread::hardware_concurrency() : threads;
+
+    if (this->thread_count == 0)
+      this->thread_count = 1;
+
+    this->decode_count = 0;
+    this->stopping = false;
+  }
+
+texture_registry::~texture_registry()
+  {
+    unsigned int i;
+
+    {
+      lock_guard<mutex> guard(this->lock);
+      this->stopping = true;
+    }
+
+    this->work_available.notify_all();
+
+    for (i = 0; i < this->workers.size(); i++)
+      this->workers[i].join();
+  }
+
+shared_ptr<t_color_buffer> texture_registry::decode(string filename)
+  {
+    TRACE_ZONE("decode png","decode");
+
+    t_color_buffer *texture = new t_color_buffer;
+
+    if (!color_buffer_load_from_png(texture,(char *) filename.c_str()))
+      {
+        delete texture;
+        return shared_ptr<t_color_buffer>();
+      }
+
+    // the tiled copy is built here too so that mesh_3D::set_texture doesn't build it serially
+
+    color_buffer_build_tiled(texture);
+
+    return shared_ptr<t_color_buffer>(texture,[](t_color_buffer *buffer)
+      {
+        color_buffer_destroy(buffer);
+        delete buffer;
+      });
+  }
+
+void texture_registry::worker_loop()
+  {
+    string filename;
+    shared_ptr<t_color_buffer> texture;
+
+    while (true)
+      {
+        {
+          unique_lock<mutex> guard(this->lock);
+
+          while (this->queue.empty() && !this->stopping)
+            this->work_available.wait(guard);
+
+          if (this->stopping)
+            return;
+
+          filename = this->queue.front();
+          this->queue.pop_front();
+        }
+
+        texture = decode(filename);
+
+        {
+          lock_guard<mutex> guard(this->lock);
+          registry_entry &entry = this->entries[filename];
+
+          entry.texture = texture;
+          entry.done = true;
+          this->decode_count++;
+        }
+
+        texture.reset();
+        this->work_done.notify_all();
+      }
+  }
+
+void texture_registry::request(string filename)
+  {
+    unsigned int i;
+
+    {
+      lock_guard<mutex> guard(this->lock);
+
+      if (this->entries.find(filename) != this->entries.end())
+        return;
+
+      this->entries[filename].done = false;
+      this->queue.push_back(filename);
+
+      if (this->workers.size() == 0)
+        for (i = 0; i < this->thread_count; i++)
+          this->workers.push_back(thread(&texture_registry::worker_loop,this));
+    }
+
+    this->work_available.notify_one();
+  }
+
+shared_ptr<t_color_buffer> texture_registry::get(string filename)
+  {
+    this->request(filename);
+
+    unique_lock<mutex> guard(this->lock);
+
+    while (!this->entries[filename].done)
+      this->work_done.wait(guard);
+
+    return this->entries[filename].texture;
+  }
+
+unsigned int texture_registry::get_decode_count()
+  {
+    lock_guard<mutex> guard(this->lock);
+    return this->decode_count;
+  }
+
+void texture_registry::clear()
+  {
+    unique_lock<mutex> guard(this->lock);
+    unordered_map<string,registry_entry>::iterator item;
+    bool pending = true;
+
+    while (pending)
+      {
+        pending = false;
+
+        for (item = this->entries.begin(); item != this->entries.end(); item++)
+          if (!item->second.done)
+            {
+              pending = true;
+              break;
+            }
+
+        if (pending)
+          this->work_done.wait(guard);
+      }
+
+    this->entries.clear();
+  }
@@ -0,0 +1,103 @@
+#include "raytracer.hpp"
+
+/*
+ Timeline tracing: the trace zones are collected in memory while the
+ tracing is enabled and written as Chrome trace event JSON at the end.
+ */
+
+typedef struct
+  {
+    const char *name;
+    const char *category;
+    int index;
+    unsigned int thread;
+    double start;             // microseconds from trace_start
+    double duration;          // microseconds
+  } trace_event;
+
+atomic<bool> trace_enabled(false);
+
+static mutex trace_lock;
+static vector<trace_event> trace_events;
+static chrono::steady_clock::time_point trace_epoch;
+static atomic<unsigned int> trace_thread_count(0);
+
+static unsigned int trace_thread_id()
+
+  /**<
+    Gets small sequential id of the current thread.
+   */
+
+  {
+    static thread_local unsigned int id = trace_thread_count.fetch_add(1) + 1;
+    return id;
+  }
+
+void trace_record(const char *name, const char *category, int index, chrono::steady_clock::time_point start,
+  chrono::steady_clock::time_point end)
+  {
+    trace_event event;
+
+    event.name = name;
+    event.category = category;
+    event.index = index;
+    event.thread = trace_thread_id();
+
+    lock_guard<mutex> guard(trace_lock);
+
+    event.start = chrono::duration<double,micro>(start - trace_epoch).count();
+    event.duration = chrono::duration<double,micro>(end - start).count();
+    trace_events.push_back(event);
+  }
+
+void trace_start()
+  {
+    lock_guard<mutex> guard(trace_lock);
+
+    trace_events.clear();
+    trace_epoch = chrono::steady_clock::now();
+    trace_enabled = true;
+  }
+
+bool trace_stop(string filename)
+  {
+    unsigned int i, threads;
+
+    trace_enabled = false;
+
+    lock_guard<mutex> guard(trace_lock);
+    ofstream file(filename.c_str());
+
+    if (!file.is_open())
+      return false;
+
+    file.precision(3);
+    file << fixed;
+    file << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [" << endl;
+
+    threads = 0;
+
+    for (i = 0; i < trace_events.size(); i++)
+      threads = trace_events[i].thread > threads ? trace_events[i].thread : threads;
+
+    for (i = 1; i <= threads; i++)     // thread names
+      file << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << i <<
+        ", \"args\": {\"name\": \"thread " << i << "\"}}," << endl;
+
+    for (i = 0; i < trace_events.size(); i++)
+      {
+        file << "{\"name\": \"" << trace_events[i].name << "\", \"cat\": \"" << trace_events[i].category <<
+          "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << trace_events[i].thread <<
+          ", \"ts\": " << trace_events[i].start << ", \"dur\": " << trace_events[i].duration;
+
+        if (trace_events[i].index >= 0)
+          file << ", \"args\": {\"index\": " << trace_events[i].index << "}";
+
+        file << "}" << (i + 1 < trace_events.size() ? "," : "") << endl;
+      }
+
+    file << "]}" << endl;
+    trace_events.clear();
+
+    return true;
+  }